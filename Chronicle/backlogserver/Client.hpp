@@ -1,22 +1,38 @@
 // 远程备份debug等级以上的日志信息-发送端
-#include <iostream>
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
 #include <cstring>
+#include <deque>
+#include <iostream>
+#include <mutex>
+#include <random>
 #include <string>
+#include <thread>
+#include <vector>
+#include <fcntl.h>
+#include <poll.h>
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <sys/stat.h>
+#include <sys/uio.h>
 #include <arpa/inet.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <unistd.h>
 #include "../src/Util.hpp"
 
 extern Chronicle::Util::JsonData *g_conf_data;
-void start_backup(const std::string &message){
+// 单次备份: 每条消息新建连接, 发送后关闭; retry: 连接失败时的重连次数, 采用指数退避; 返回是否发送成功
+bool start_backup(const std::string &message, int retry = 5){
     // 1. create socket
     int sock = socket(AF_INET, SOCK_STREAM, 0);
     if (sock < 0){
         std::cout << __FILE__ << " " << __LINE__ << " socket error : " << strerror(errno) << std::endl;
         perror(NULL);
+        return false;
     }
 
     struct sockaddr_in server;
@@ -26,16 +42,16 @@ void start_backup(const std::string &message){
     inet_aton(g_conf_data->backup_addr.c_str(), &(server.sin_addr));
     cout << "连接" << g_conf_data->backup_addr.c_str() << ":" << g_conf_data->backup_port << endl;
 
-    int cnt = 5;
+    int cnt = retry;
     while (-1 == connect(sock, (struct sockaddr *)&server, sizeof(server))){
         std::cout << "正在尝试重连, 重连次数还有: " << cnt << std::endl;
         if (cnt <= 0){
             std::cout << __FILE__ << " " << __LINE__ << " connect error: " << strerror(errno) << std::endl;
             close(sock);
             perror(NULL);
-            return;
+            return false;
         }
-        sleep(1 << (5 - cnt));  //指数退避重试策略
+        sleep(1 << (retry - cnt));  //指数退避重试策略
         cnt--;
     }
 
@@ -43,12 +59,289 @@ void start_backup(const std::string &message){
     //char buffer[1024];
     std::cout << "连接成功!" << endl;
     
-    // 4. 发送日志数据
-    if (-1 == write(sock, message.c_str(), message.size())){
-        std::cout << __FILE__ << " " << __LINE__ << " send to server error: " << strerror(errno) << std::endl;
-        perror(NULL);
+    // 4. 发送日志数据, 批量发送时数据可能较大, 需要处理部分写入
+    size_t sent = 0;
+    while (sent < message.size()){
+        ssize_t ret = write(sock, message.c_str() + sent, message.size() - sent);
+        if (ret == -1){
+            if (errno == EINTR){
+                continue;
+            }
+            std::cout << __FILE__ << " " << __LINE__ << " send to server error: " << strerror(errno) << std::endl;
+            perror(NULL);
+            close(sock);
+            return false;
+        }
+        sent += ret;
     }
 
     // 5. close socket
     close(sock);
-}
\ No newline at end of file
+    return true;
+}
+
+// 长连接备份客户端: 保持到backup_addr:backup_port的连接, 一次系统调用写入多条日志
+// 连接断开后由调用方(BackupShipper的发送线程)按带抖动的指数退避重连
+class BackupClient {
+public:
+    BackupClient() : _m_sock(-1), _m_connects(0), _m_syscalls(0) {}
+    ~BackupClient() { Disconnect(); }
+    BackupClient(const BackupClient &) = delete;
+    BackupClient &operator=(const BackupClient &) = delete;
+
+    bool Connected() const { return _m_sock != -1; }
+
+    // 建立连接, 连接超时为kConnectTimeoutMs, 避免备份服务器不可达时长时间阻塞
+    bool Connect() {
+        if (_m_sock != -1){
+            return true;
+        }
+        struct sockaddr_in server;
+        memset(&server, 0, sizeof(server));
+        server.sin_family = AF_INET;
+        server.sin_port = htons(g_conf_data->backup_port);
+        if (inet_aton(g_conf_data->backup_addr.c_str(), &(server.sin_addr)) == 0){
+            std::cout << __FILE__ << " " << __LINE__ << " invalid backup_addr: " << g_conf_data->backup_addr << std::endl;
+            return false;
+        }
+        int sock = socket(AF_INET, SOCK_STREAM, 0);
+        if (sock < 0){
+            std::cout << __FILE__ << " " << __LINE__ << " socket error : " << strerror(errno) << std::endl;
+            return false;
+        }
+        ++_m_connects;
+        int flags = fcntl(sock, F_GETFL, 0);
+        fcntl(sock, F_SETFL, flags | O_NONBLOCK);
+        int ret = connect(sock, (struct sockaddr *)&server, sizeof(server));
+        if (ret == -1 && errno == EINPROGRESS){
+            struct pollfd pfd;
+            pfd.fd = sock;
+            pfd.events = POLLOUT;
+            int err = 0;
+            socklen_t err_len = sizeof(err);
+            if (poll(&pfd, 1, kConnectTimeoutMs) == 1 &&
+                getsockopt(sock, SOL_SOCKET, SO_ERROR, &err, &err_len) == 0 && err == 0){
+                ret = 0;
+            }
+            else{
+                errno = err != 0 ? err : ETIMEDOUT;
+            }
+        }
+        if (ret == -1){
+            std::cout << __FILE__ << " " << __LINE__ << " connect error: " << strerror(errno) << std::endl;
+            close(sock);
+            return false;
+        }
+        fcntl(sock, F_SETFL, flags);
+        // 日志已经成批写入, 关闭Nagle避免小批次被延迟; 发送超时避免服务端停止读取时永久阻塞
+        int one = 1;
+        setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        struct timeval tv;
+        tv.tv_sec = kSendTimeoutSec;
+        tv.tv_usec = 0;
+        setsockopt(sock, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+        _m_sock = sock;
+        return true;
+    }
+
+    void Disconnect() {
+        if (_m_sock != -1){
+            close(_m_sock);
+            _m_sock = -1;
+        }
+    }
+
+    // 发送iov[0, cnt)中的全部数据, 每一段是一条完整的日志, 每次系统调用最多写入kMaxIov段
+    // 失败时断开连接并返回false, iov会被更新为尚未完整发送的日志: 已发送部分的日志在新连接上从头重发,
+    // 旧连接上只收到一半的日志由服务端丢弃, 新连接上不会出现从一条日志中间开始的数据
+    bool Send(struct iovec *iov, size_t cnt) {
+        if (!Connect()){
+            return false;
+        }
+        // 服务端已关闭连接时先重连, 否则第一次写入会成功但数据丢失
+        char peek;
+        if (recv(_m_sock, &peek, 1, MSG_PEEK | MSG_DONTWAIT) == 0){
+            Disconnect();
+            if (!Connect()){
+                return false;
+            }
+        }
+        size_t idx = 0;
+        size_t partial = 0;     // iov[idx]已发送的字节数
+        while (idx < cnt){
+            struct msghdr msg;
+            memset(&msg, 0, sizeof(msg));
+            msg.msg_iov = iov + idx;
+            msg.msg_iovlen = std::min(cnt - idx, static_cast<size_t>(kMaxIov));
+            // 等价于writev, MSG_NOSIGNAL避免对端关闭时进程被SIGPIPE终止
+            ssize_t ret = sendmsg(_m_sock, &msg, MSG_NOSIGNAL);
+            ++_m_syscalls;
+            if (ret == -1){
+                if (errno == EINTR){
+                    continue;
+                }
+                std::cout << __FILE__ << " " << __LINE__ << " send to server error: " << strerror(errno) << std::endl;
+                // 恢复到中断的日志的开头
+                if (partial > 0){
+                    iov[idx].iov_base = static_cast<char *>(iov[idx].iov_base) - partial;
+                    iov[idx].iov_len += partial;
+                }
+                Disconnect();
+                return false;
+            }
+            // 跳过已完整发送的段, 调整部分发送的段
+            size_t n = ret;
+            while (idx < cnt && n >= iov[idx].iov_len){
+                n -= iov[idx].iov_len;
+                iov[idx].iov_len = 0;
+                ++idx;
+                partial = 0;
+            }
+            if (n > 0){
+                iov[idx].iov_base = static_cast<char *>(iov[idx].iov_base) + n;
+                iov[idx].iov_len -= n;
+                partial += n;
+            }
+        }
+        return true;
+    }
+
+    size_t Connects() const { return _m_connects; }    // 累计建立连接次数
+    size_t Syscalls() const { return _m_syscalls; }    // 累计发送系统调用次数
+
+private:
+    enum { kConnectTimeoutMs = 1000, kSendTimeoutSec = 5, kMaxIov = 1024 };
+
+    int _m_sock;
+    size_t _m_connects;
+    size_t _m_syscalls;
+};
+
+// 远程备份队列(单例): 业务线程只把日志放入队列后立即返回, 由后台发送线程通过BackupClient长连接批量发送
+// 队列(含正在发送的批次)占用的内存有上限(config.conf中的backup_queue_size), 超出时丢弃新日志并计数,
+// 备份服务器不可用时也不会阻塞业务线程
+class BackupShipper {
+public:
+    static BackupShipper &GetInstance() {
+        static BackupShipper shipper;
+        return shipper;
+    }
+
+    // 放入一条待备份日志, 超出内存上限时丢弃并返回false
+    bool Enqueue(const char *data, size_t len) {
+        {
+            std::unique_lock<std::mutex> lock(_m_mtx);
+            if (_m_stop || _m_bytes + len > _m_capacity){
+                ++_m_dropped;
+                return false;
+            }
+            _m_queue.emplace_back(data, len);
+            _m_bytes += len;
+        }
+        _m_cond.notify_one();
+        return true;
+    }
+
+    // 因队列已满或发送失败而丢弃的日志条数(累计)
+    size_t Dropped() const { return _m_dropped.load(); }
+
+    // 队列中尚未发送的字节数
+    size_t Pending() {
+        std::unique_lock<std::mutex> lock(_m_mtx);
+        return _m_bytes;
+    }
+
+    ~BackupShipper() {
+        {
+            std::unique_lock<std::mutex> lock(_m_mtx);
+            _m_stop = true;
+        }
+        _m_cond.notify_all();
+        _m_thread.join();
+    }
+
+private:
+    BackupShipper() : _m_capacity(kDefaultCapacity), _m_bytes(0), _m_dropped(0), _m_reported(0), _m_stop(false) {
+        if (g_conf_data != nullptr && g_conf_data->backup_queue_size > 0){
+            _m_capacity = g_conf_data->backup_queue_size;
+        }
+        _m_thread = std::thread(&BackupShipper::ShipperThreadEntry, this);
+    }
+    BackupShipper(const BackupShipper &) = delete;
+    BackupShipper &operator=(const BackupShipper &) = delete;
+
+    // 每次取出队列中的全部日志, 以writev方式通过长连接发送; 退出前发送完剩余日志
+    void ShipperThreadEntry() {
+        std::deque<std::string> batch;
+        std::vector<struct iovec> iov;
+        std::string notice;
+        std::mt19937 rng(std::random_device{}());
+        int failures = 0;
+        for (;;){
+            bool stopping = false;
+            size_t batch_bytes = 0;
+            {
+                std::unique_lock<std::mutex> lock(_m_mtx);
+                _m_cond.wait(lock, [&]() { return _m_stop || !_m_queue.empty(); });
+                if (_m_queue.empty()){
+                    return;     // _m_stop且已发送完
+                }
+                batch.swap(_m_queue);
+                stopping = _m_stop;
+            }
+            iov.clear();
+            // 发生过丢弃(队列满或发送失败)时在批次开头说明丢弃数量, 让服务端能看出缺失
+            size_t dropped = _m_dropped.load();
+            if (dropped != _m_reported){
+                notice = "[backup] " + std::to_string(dropped - _m_reported) + " records dropped\n";
+                std::cout << __FILE__ << " " << __LINE__ << " "
+                          << dropped - _m_reported << " backup records dropped" << std::endl;
+                _m_reported = dropped;
+                iov.push_back({&notice[0], notice.size()});
+            }
+            for (auto &e : batch){
+                iov.push_back({&e[0], e.size()});
+                batch_bytes += e.size();
+            }
+            // 发送失败时按带抖动的指数退避重连后从中断的日志开头继续, 等待可被退出打断; 退出阶段只尝试一次
+            bool sent = _m_client.Send(iov.data(), iov.size());
+            while (!sent && !stopping){
+                int delay = kRetryBaseMs << std::min(failures, static_cast<int>(kRetryMaxShift));
+                std::uniform_int_distribution<int> jitter(delay / 2, delay);
+                ++failures;
+                std::unique_lock<std::mutex> lock(_m_mtx);
+                stopping = _m_cond.wait_for(lock, std::chrono::milliseconds(jitter(rng)), [&]() { return _m_stop; });
+                lock.unlock();
+                sent = _m_client.Send(iov.data(), iov.size());
+            }
+            if (sent){
+                failures = 0;
+            }
+            else{
+                _m_dropped += batch.size();
+                std::cout << __FILE__ << " " << __LINE__ << " backup failed, "
+                          << batch.size() << " records not sent" << std::endl;
+            }
+            batch.clear();
+            {
+                std::unique_lock<std::mutex> lock(_m_mtx);
+                _m_bytes -= batch_bytes;
+            }
+        }
+    }
+
+private:
+    static const size_t kDefaultCapacity = 4 * 1024 * 1024;    // 未配置时的内存上限
+    enum { kRetryBaseMs = 100, kRetryMaxShift = 8 };            // 重连退避: 100ms起, 最长约25.6秒
+
+    std::mutex _m_mtx;
+    std::condition_variable _m_cond;
+    std::deque<std::string> _m_queue;   // 待发送日志
+    size_t _m_capacity;                 // 队列内存上限(字节)
+    size_t _m_bytes;                    // 队列及正在发送批次中日志的总字节数
+    std::atomic<size_t> _m_dropped;     // 累计丢弃条数
+    size_t _m_reported;                 // 已经报告过的丢弃条数, 仅发送线程访问
+    bool _m_stop;
+    BackupClient _m_client;             // 长连接, 仅发送线程访问
+    std::thread _m_thread;
+};
@@ -105,8 +105,9 @@ public:
     }
 
     void service(int sock, const std::string&& client_info) {
-        char buf[1024];
-        // 循环读取直到连接关闭
+        char buf[4096];
+        std::string pending;    // 尚未收到换行的不完整日志
+        // 循环读取直到连接关闭, 客户端使用长连接批量发送, 按行拆分后逐条处理
         while (true) { 
             ssize_t r_ret = read(sock, buf, sizeof(buf));
             if (r_ret == -1) {
@@ -117,11 +118,25 @@ public:
                 std::cout << "client disconnected: " << client_info << std::endl;
                 break;
             } else {
-                buf[r_ret] = '\0';
-                std::string tmp = buf;
-                _m_func(client_info + tmp); // 处理数据, 这里是强制落盘
+                pending.append(buf, r_ret);
+                size_t end = pending.rfind('\n');
+                if (end == std::string::npos) continue;
+                std::string lines;
+                size_t pos = 0;
+                while (pos <= end) {
+                    size_t nl = pending.find('\n', pos);
+                    lines += client_info;
+                    lines.append(pending, pos, nl + 1 - pos);
+                    pos = nl + 1;
+                }
+                pending.erase(0, end + 1);
+                _m_func(lines); // 处理数据, 这里是强制落盘
             }
         }
+        // 连接中断时未以换行结束的日志只收到一半, 客户端会在新连接上从头重发整条日志, 这里丢弃
+        if (!pending.empty()) {
+            std::cerr << "discard " << pending.size() << " bytes of an incomplete record from " << client_info << std::endl;
+        }
     }
 
     ~TcpServer() = default;
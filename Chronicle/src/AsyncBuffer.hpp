@@ -17,6 +17,10 @@ namespace Chronicle{
         Buffer() : _m_write_pos(0), _m_read_pos(0) {
             _m_buffer.resize(g_conf_data->buffer_size);
         }
+        //指定初始容量, 用于线程本地暂存缓冲区等小缓冲区
+        explicit Buffer(size_t size) : _m_write_pos(0), _m_read_pos(0) {
+            _m_buffer.resize(size);
+        }
 
         //向缓冲区写入数据, 并自动扩容
         void Push(const char *data, size_t len){
@@ -26,6 +30,18 @@ namespace Chronicle{
             _m_write_pos += len;
         }
 
+        //预留至少len字节的连续可写空间并返回写入地址, 调用方直接在该空间内格式化数据
+        //写入完成后调用Commit提交实际写入的长度, 未提交的部分不会被读取
+        char *Reserve(size_t len){
+            CheckAndReserve(len);
+            return &_m_buffer[_m_write_pos];
+        }
+
+        //提交Reserve后实际写入的len字节
+        void Commit(size_t len){
+            MoveWritePos(len);
+        }
+
         //获取可读数据的起始地址, 需要指定读取的长度
         char* ReadBegin(size_t len){
             assert(len <= ReadableSize());
@@ -52,6 +68,12 @@ namespace Chronicle{
             _m_write_pos += len;
         }
         
+        //丢弃末尾已写入的数据, 只保留len字节可读数据
+        void Truncate(size_t len){
+            assert(len <= ReadableSize());
+            _m_write_pos = _m_read_pos + len;
+        }
+        
         //向后移动读指针, 移动长度len字节
         void MoveReadPos(size_t len){
             assert(len <= ReadableSize());
@@ -65,6 +87,28 @@ namespace Chronicle{
             std::swap(_m_write_pos, buf._m_write_pos);
         }
 
+        // 当前容量(字节), 即缓冲区实际占用的内存
+        size_t Capacity(){
+            return _m_buffer.size();
+        }
+
+        // 写入len字节后缓冲区的容量, 不实际扩容, 用于在扩容前判断内存是否超限
+        size_t CapacityAfter(size_t len){
+            size_t capacity = _m_buffer.size();
+            while (len > capacity - _m_write_pos){
+                capacity = NextCapacity(capacity, len);
+            }
+            return capacity;
+        }
+
+        // 缓冲区为空时将容量收缩为size, 归还扩容占用的内存
+        void Shrink(size_t size){
+            if (IsEmpty() && _m_buffer.size() > size){
+                std::vector<char>(size).swap(_m_buffer);
+                Reset();
+            }
+        }
+
         //判断缓冲区是否为空
         bool IsEmpty() { 
             return _m_write_pos == _m_read_pos; 
@@ -81,20 +125,21 @@ namespace Chronicle{
         // - 容量小于阈值时, 按倍数扩容(指数增长)
         // - 容量超过阈值时, 按固定值扩容(线性增长)
         void CheckAndReserve(size_t len){
-            size_t buffersize = _m_buffer.size();
-            //cout << "buffersize = " << buffersize << endl;
-            if (len > WriteableSize()){
+            //单次扩容可能仍不足以容纳len, 循环直到空间足够
+            while (len > WriteableSize()){
                 /*需要扩容*/
-                if (buffersize < g_conf_data->threshold){
-                    _m_buffer.resize(2 * buffersize);
-                }
-                else{
-                    _m_buffer.resize(g_conf_data->linear_growth + buffersize);
-                }
+                _m_buffer.resize(NextCapacity(_m_buffer.size(), len));
                 //cout << "CheckAndReserve: len from " << buffersize << " to " << _m_buffer.size() << endl;
             }
         }
 
+        static size_t NextCapacity(size_t buffersize, size_t len){
+            if (buffersize < g_conf_data->threshold){
+                return buffersize == 0 ? len : 2 * buffersize;
+            }
+            return g_conf_data->linear_growth + buffersize;
+        }
+
     protected:
         std::vector<char> _m_buffer; // 缓冲区, 初始大小g_conf_data->buffer_size
         size_t _m_write_pos;         // 生产者写指针的偏移量
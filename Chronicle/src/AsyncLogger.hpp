@@ -1,172 +1,1231 @@
 #pragma once
+#include <algorithm>
 #include <atomic>
 #include <cassert>
+#include <chrono>
+#include <condition_variable>
 #include <cstdarg>
+#include <cstring>
 #include <memory>
 #include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
 
 #include "Level.hpp"
+#include "Format.hpp"           //{}占位符格式化
+#include "BinaryLog.hpp"        //二进制延迟格式化
 #include "AsyncWorker.hpp"      //后台落盘, log_flush
 #include "Message.hpp"
+#include "Structured.hpp"       //键值字段与JSON/logfmt编码
+#include "StormGuard.hpp"       //日志风暴抑制
 #include "LogFlush.hpp"         //日志输出策略(terminal, file, rollfile...)
+#include "UringFlush.hpp"       //io_uring文件输出策略
+#include "MmapFlush.hpp"        //内存映射分段文件输出策略
+#ifdef CHRONICLE_WITH_ZLIB
+#include "GzipFlush.hpp"        //压缩帧文件输出策略, 需要链接zlib(-lz)
+#endif
+#include "SinkQueue.hpp"        //输出策略的独立队列
 #include "../backlogserver/Client.hpp"      //远程备份客户端
 #include "ThreadPool.hpp"
 
 extern ThreadPool *thread_pool;
 
 namespace Chronicle {
+    // 持久化策略: 由日志器统一决定何时调用输出策略的Sync(), 替代flush_log == 2时每批一次的fsync
+    // 满足任一条件即在该批写入后同步, 都未设置时不启用(仍按flush_log处理)
+    //  every_batch:    每批写入后同步, 与flush_log == 2相同
+    //  interval_ms:    距上次同步超过interval_ms时同步, 空闲时由后台线程补做, 掉电最多丢失interval_ms内的日志
+    //  bytes:          未同步的数据达到bytes字节时同步
+    //  on_error:       批次中包含ERROR/FATAL时同步(ASYNC_LOCKFREE不区分等级, 每批都同步)
+    //  level:          同步方式, WRITE_BEHIND只发起回写不等待, DATA为fdatasync, FULL为fsync
+    // 需要确定落盘的调用方使用AsyncLogger::Sync()
+    struct DurabilityPolicy {
+        bool every_batch = false;
+        uint32_t interval_ms = 0;
+        size_t bytes = 0;
+        bool on_error = false;
+        SyncLevel level = SyncLevel::DATA;
+        bool Enabled() const { return every_batch || interval_ms > 0 || bytes > 0 || on_error; }
+    };
+
+    // 输出策略的路由规则, 以下条件全部满足时该输出策略才接收一条日志, 默认接收全部日志
+    //  min_level:      最低日志等级
+    //  loggers:        日志器名称, 任一相同即可, 为空时不限; 只在构建日志器时判断一次
+    //  file_prefixes:  源文件路径(__FILE__)前缀, 任一匹配即可, 为空时不限
+    // 每条日志的去向在生产者线程写入时决定一次, 消费者线程按记录帧头分发, 不解析日志文本
+    struct FlushRoute {
+        LogLevel::value min_level = LogLevel::value::DEBUG;
+        std::vector<std::string> loggers;
+        std::vector<std::string> file_prefixes;
+        bool Enabled() const {
+            return min_level != LogLevel::value::DEBUG || !loggers.empty() || !file_prefixes.empty();
+        }
+        bool operator==(const FlushRoute &other) const {
+            return min_level == other.min_level && loggers == other.loggers && file_prefixes == other.file_prefixes;
+        }
+    };
+
+    // 日志器的可选配置, 由LoggerBuilder填写
+    struct LoggerOptions {
+        size_t staging_size = 0;                                // 线程本地暂存缓冲区大小, 0表示不启用
+        size_t staging_interval_ms = 5;                         // 暂存数据的最长停留时间
+        LogLevel::value min_level = LogLevel::value::DEBUG;     // 日志等级阈值
+        TimeFormat time_format = TimeFormat::TIME;              // 日志时间格式
+        TimePrecision time_precision = TimePrecision::MILLI;    // 日志时间精度
+        bool binary = false;                                    // 二进制延迟格式化模式
+        bool binary_render = false;                             // 二进制模式下是否由消费者线程渲染为文本后再输出
+        std::string binary_registry;                            // 调用点登记表文件路径, 离线解码需要
+        OverflowRule overflow[LogLevel::kCount];                // 各等级在ASYNC_SAFE缓冲池写满时的处理策略, 默认阻塞
+        size_t shards = 1;                                      // 异步工作器分片数, 每个分片有独立的缓冲池和消费者线程, 输出策略共用
+        bool sequence = false;                                  // 是否在每条文本记录头部写入全局序号
+        FlushScheduler::ptr scheduler;                          // 共享落盘调度器, 为空时每个分片使用独立的消费者线程
+        DurabilityPolicy durability;                            // 持久化策略
+        std::vector<FlushRoute> routes;                         // 各输出策略的路由规则, 与输出策略按下标对应, 缺省时接收全部日志
+        LogFormat format = LogFormat::TEXT;                     // 文本记录的编码格式
+        StormPolicy storm;                                      // 日志风暴抑制策略
+    };
+
     //异步日志器, 实现日志的异步生成、格式化和输出
     class AsyncLogger {
     public:
         using ptr = std::shared_ptr<AsyncLogger>;
         //初始化日志器名称、输出策略和异步工作器
+        //  options.staging_size > 0 时启用线程本地暂存缓冲区, 每个线程攒满一批后再一次性写入异步工作器
+        //  options.shards > 1 时创建多个异步工作器分片, 生产者线程按线程固定分配到其中一个分片;
+        //  各分片共用同一组输出策略, 对输出策略的写入由_m_sink_mtx串行
         AsyncLogger(const std::string &logger_name, 
             std::vector<LogFlush::ptr> &flushs, 
-            AsyncType type):
+            AsyncType type,
+            const LoggerOptions &options = LoggerOptions()):
             _m_logger_name(logger_name),                // 日志器名称
             _m_flushs(flushs.begin(), flushs.end()),    // 写入策略(支持多种)
-            //启动异步工作器
-            _m_asyncworker(std::make_shared<AsyncWorker>(  
-                  std::bind(&AsyncLogger::RealFlush, this, std::placeholders::_1),
-                  type)) {}
-        virtual ~AsyncLogger() {};
+            _m_id(NextId()),
+            _m_alive(std::make_shared<char>(0)),
+            _m_staging_size(options.staging_size),
+            _m_staging_interval_ms(options.staging_interval_ms),
+            _m_staging_stop(false),
+            _m_min_level(static_cast<int>(options.min_level)),
+            _m_time_format(options.time_format),
+            _m_time_precision(options.time_precision),
+            _m_format(options.format),
+            _m_binary(options.binary),
+            _m_binary_render(options.binary_render),
+            _m_registry_file(NULL),
+            _m_backup(BackupShipper::GetInstance()),
+            _m_sequence(options.sequence),
+            _m_next_seq(0),
+            _m_durability(options.durability),
+            _m_unsynced(0),
+            _m_last_sync(std::chrono::steady_clock::now()),
+            _m_sync_count(0),
+            _m_sync_stop(false),
+            _m_routed(false) {
+            std::copy(options.overflow, options.overflow + LogLevel::kCount, _m_overflow);
+            SetupRoutes(options.routes);
+            if (options.storm.Enabled()){
+                _m_storm.reset(new StormGuard(options.storm));
+            }
+            //启动异步工作器, 每个分片的消费者线程只访问自己的ShardState
+            size_t shards = std::max<size_t>(options.shards, 1);
+            uint64_t device = 0;
+            for (auto &e : _m_flushs){
+                if (device == 0){
+                    device = e->Device();
+                }
+            }
+            if (_m_durability.Enabled()){
+                for (auto &e : _m_flushs){
+                    e->SetManagedSync(true);
+                }
+            }
+            _m_workers.reserve(shards);
+            for (size_t i = 0; i < shards; ++i){
+                _m_shard_states.emplace_back(new ShardState(kSummaryBufferSize));
+            }
+            for (size_t i = 0; i < shards; ++i){
+                _m_workers.push_back(std::make_shared<AsyncWorker>(
+                    std::bind(&AsyncLogger::RealFlush, this, std::placeholders::_1, i), type, 0,
+                    options.scheduler, device));
+                _m_workers.back()->SetDrainFunc(std::bind(&AsyncLogger::DrainSinks, this));
+            }
+            if (_m_binary && !options.binary_registry.empty()){
+                _m_registry_file = Binary::Registry::GetInstance().Attach(options.binary_registry, _m_logger_name);
+            }
+            if (_m_staging_size > 0){
+                _m_staging_thread = std::thread(&AsyncLogger::StagingThreadEntry, this);
+            }
+            if (_m_durability.interval_ms > 0){
+                _m_sync_thread = std::thread(&AsyncLogger::SyncThreadEntry, this);
+            }
+        }
+        virtual ~AsyncLogger() {
+            if (_m_staging_thread.joinable()){
+                {
+                    std::unique_lock<std::mutex> lock(_m_staging_mtx);
+                    _m_staging_stop = true;
+                }
+                _m_staging_cond.notify_all();
+                _m_staging_thread.join();
+            }
+            // 汇总尚未输出的风暴抑制计数
+            if (_m_storm){
+                ReportStorm();
+            }
+            // 发布所有线程中剩余的暂存数据, 再停止异步工作器, 保证落盘时输出策略和分片状态仍然有效
+            PublishAllStaging();
+            // 逐个停止后再释放: 停止时会处理剩余数据, 各分片的回调函数仍按下标访问_m_workers
+            for (auto &e : _m_workers){
+                e->Stop();
+            }
+            _m_workers.clear();
+            // 其他线程的线程本地表仍引用暂存缓冲区, 先释放缓冲区内存, 表中的条目随_m_alive失效
+            _m_alive.reset();
+            for (auto &st : _m_stagings){
+                std::lock_guard<std::mutex> st_lock(st->mtx);
+                Buffer released(0);
+                st->buffer.Swap(released);
+            }
+            // 剩余数据都已写入输出策略, 按持久化策略做最后一次同步
+            if (_m_sync_thread.joinable()){
+                {
+                    std::unique_lock<std::mutex> lock(_m_sink_mtx);
+                    _m_sync_stop = true;
+                }
+                _m_sync_cond.notify_all();
+                _m_sync_thread.join();
+            }
+            if (_m_durability.Enabled()){
+                std::unique_lock<std::mutex> lock(_m_sink_mtx);
+                SyncSinks(lock, _m_durability.level);
+            }
+            if (_m_registry_file != NULL){
+                Binary::Registry::GetInstance().Detach(_m_registry_file);
+            }
+        };
         std::string Name() { return _m_logger_name; }
+        size_t Shards() const { return _m_workers.size(); }
+
+        // 持久化屏障: 返回时本调用之前由当前线程写入的日志(其他线程已写入的同样包括在内)都已落盘
+        //  暂存缓冲区中的数据先发布, 再等待各分片处理完, 最后按max(DATA, 策略的level)同步输出策略
+        //  按溢出策略丢弃的日志不在保证之内; 带独立队列的输出策略最多等待其drain_timeout_ms; 不能在输出策略中调用
+        void Sync() {
+            if (_m_storm){
+                ReportStorm();
+            }
+            PublishAllStaging();
+            for (auto &e : _m_workers){
+                e->Barrier();
+            }
+            {
+                std::unique_lock<std::mutex> lock(_m_sink_mtx);
+                DrainSinksLocked();
+                SyncSinks(lock, std::max(_m_durability.level, SyncLevel::DATA));
+            }
+            // 带独立队列的输出策略只是放入了同步标记, 释放输出锁后再等待其写入线程处理完
+            DrainQueuedSinks();
+        }
+
+        // 各输出策略的队列统计, 顺序与BuildLoggerFlush的添加顺序相同, 没有独立队列的输出策略为空统计
+        std::vector<SinkStats> SinkStatistics() {
+            std::vector<SinkStats> stats;
+            for (auto &e : _m_flushs){
+                stats.push_back(e->Stats());
+            }
+            return stats;
+        }
+
+        // 已执行的同步次数(持久化策略触发与Sync()调用)
+        size_t SyncCount() const { return _m_sync_count.load(std::memory_order_relaxed); }
+
+        // 缓冲池写满时按溢出策略丢弃的记录条数和字节数(累计), 为所有分片之和
+        size_t DroppedRecords() const {
+            size_t n = 0;
+            for (auto &e : _m_workers){
+                n += e->DroppedRecords();
+            }
+            return n;
+        }
+        size_t DroppedBytes() const {
+            size_t n = 0;
+            for (auto &e : _m_workers){
+                n += e->DroppedBytes();
+            }
+            return n;
+        }
+
+        // 生产者因缓冲池写满(或溢出段写入失败)而阻塞的最长时间(微秒, 所有分片中的最大值)和次数(所有分片之和)
+        int64_t MaxStallMicros() const {
+            int64_t n = 0;
+            for (auto &e : _m_workers){
+                n = std::max(n, e->MaxStallMicros());
+            }
+            return n;
+        }
+        size_t StallCount() const {
+            size_t n = 0;
+            for (auto &e : _m_workers){
+                n += e->StallCount();
+            }
+            return n;
+        }
+
+        // 不安全模式下写入磁盘溢出段的字节数(累计), 为所有分片之和
+        size_t SpilledBytes() const {
+            size_t n = 0;
+            for (auto &e : _m_workers){
+                n += e->SpilledBytes();
+            }
+            return n;
+        }
+
+        // 日志风暴抑制累计被限速丢弃、被合并的重复日志条数, 未启用时为0
+        size_t StormSuppressed() const { return _m_storm ? _m_storm->Suppressed() : 0; }
+        size_t StormCollapsed() const { return _m_storm ? _m_storm->Collapsed() : 0; }
+
+        // 运行期日志等级阈值, 低于该等级的日志在格式化之前直接丢弃, 可随时修改
+        void SetLevel(LogLevel::value level) {
+            _m_min_level.store(static_cast<int>(level), std::memory_order_relaxed);
+        }
+        LogLevel::value GetLevel() {
+            return static_cast<LogLevel::value>(_m_min_level.load(std::memory_order_relaxed));
+        }
+        bool ShouldLog(LogLevel::value level) {
+            return static_cast<int>(level) >= _m_min_level.load(std::memory_order_relaxed);
+        }
+
+        // 编译期被CHRONICLE_MIN_LEVEL关闭的日志宏展开为该空函数
+        void Disabled() {}
+
         //该函数则是特定日志级别的日志信息的格式化，当外部调用该日志器时，使用debug模式的日志就会进来
         //在serialize时把日志信息中的日志级别定义为DEBUG。
-        void Debug(const std::string &file, size_t line, const std::string format,
-                   ...) {
+        void Debug(const char *file, size_t line, const char *format, ...) {
+            if (!ShouldLog(LogLevel::value::DEBUG)){
+                return;
+            }
             // 获取可变参数列表中的格式
             va_list va;
             va_start(va, format);
-            char *ret;
-            int r = vasprintf(&ret, format.c_str(), va);
-            if (r == -1){
-                perror("vasprintf failed!!!: ");
-            }
+            serialize(LogLevel::value::DEBUG, file, line, [&](Buffer &buf) {
+                LogMessage::FormatPayload(buf, format, va);
+            }); // 生成格式化日志信息并写文件
             va_end(va); // 将va指针置空
-
-            serialize(LogLevel::value::DEBUG, file, line, ret); // 生成格式化日志信息并写文件
-
-            free(ret);
-            ret = nullptr;
         };
 
-        void Info(const std::string &file, size_t line, const std::string format,
-                  ...) {
+        void Info(const char *file, size_t line, const char *format, ...) {
+            if (!ShouldLog(LogLevel::value::INFO)){
+                return;
+            }
             va_list va;
             va_start(va, format);
-            char *ret;
-            int r = vasprintf(&ret, format.c_str(), va);
-            if (r == -1){
-                perror("vasprintf failed!!!: ");
-            }
+            serialize(LogLevel::value::INFO, file, line, [&](Buffer &buf) {
+                LogMessage::FormatPayload(buf, format, va);
+            });
             va_end(va);
-
-            serialize(LogLevel::value::INFO, file, line, ret);
-
-            free(ret);
-            ret = nullptr;
         };
 
-        void Warn(const std::string &file, size_t line, const std::string format,
-                  ...) {
+        void Warn(const char *file, size_t line, const char *format, ...) {
+            if (!ShouldLog(LogLevel::value::WARN)){
+                return;
+            }
             va_list va;
             va_start(va, format);
-            char *ret;
-            int r = vasprintf(&ret, format.c_str(), va);
-            if (r == -1){
-                perror("vasprintf failed!!!: ");
-            }
+            serialize(LogLevel::value::WARN, file, line, [&](Buffer &buf) {
+                LogMessage::FormatPayload(buf, format, va);
+            });
             va_end(va);
-
-            serialize(LogLevel::value::WARN, file, line, ret);
-
-            free(ret);
-            ret = nullptr;
         };
 
-        void Error(const std::string &file, size_t line, const std::string format,
-                   ...) {
+        void Error(const char *file, size_t line, const char *format, ...) {
+            if (!ShouldLog(LogLevel::value::ERROR)){
+                return;
+            }
             va_list va;
             va_start(va, format);
-            char *ret;
-            int r = vasprintf(&ret, format.c_str(), va);
-            if (r == -1){
-                perror("vasprintf failed!!!: ");
-            }
+            serialize(LogLevel::value::ERROR, file, line, [&](Buffer &buf) {
+                LogMessage::FormatPayload(buf, format, va);
+            });
             va_end(va);
-
-            serialize(LogLevel::value::ERROR, file, line, ret);
-
-            free(ret);
-            ret = nullptr;
         };
         
-        void Fatal(const std::string &file, size_t line, const std::string format,
-                   ...) {
+        void Fatal(const char *file, size_t line, const char *format, ...) {
+            if (!ShouldLog(LogLevel::value::FATAL)){
+                return;
+            }
             va_list va;
             va_start(va, format);
-            char *ret;
-            int r = vasprintf(&ret, format.c_str(), va);
-            if (r == -1){
-                perror("vasprintf failed!!!: ");
-            }
+            serialize(LogLevel::value::FATAL, file, line, [&](Buffer &buf) {
+                LogMessage::FormatPayload(buf, format, va);
+            });
             va_end(va);
+        };
 
-            serialize(LogLevel::value::FATAL, file, line, ret);
+        //类型安全的模板接口, 使用{}占位符, 参数按类型直接写入缓冲区, 不经过printf
+        //通过Chronicle.hpp中的同名宏调用时传入静态调用点, 格式串中占位符数量在编译期检查
+        template <typename... Args>
+        void DebugFmt(const char *file, size_t line, const char *format, const Args &...args) {
+            if (!ShouldLog(LogLevel::value::DEBUG)){
+                return;
+            }
+            serialize(LogLevel::value::DEBUG, file, line, [&](Buffer &buf) {
+                Fmt::FormatTo(buf, format, args...);
+            });
+        }
+        template <typename... Args>
+        void DebugFmt(Fmt::CallSite &site, const Args &...args) {
+            LogCallSite(LogLevel::value::DEBUG, site, args...);
+        }
 
-            free(ret);
-            ret = nullptr;
-        };
+        template <typename... Args>
+        void InfoFmt(const char *file, size_t line, const char *format, const Args &...args) {
+            if (!ShouldLog(LogLevel::value::INFO)){
+                return;
+            }
+            serialize(LogLevel::value::INFO, file, line, [&](Buffer &buf) {
+                Fmt::FormatTo(buf, format, args...);
+            });
+        }
+        template <typename... Args>
+        void InfoFmt(Fmt::CallSite &site, const Args &...args) {
+            LogCallSite(LogLevel::value::INFO, site, args...);
+        }
+
+        template <typename... Args>
+        void WarnFmt(const char *file, size_t line, const char *format, const Args &...args) {
+            if (!ShouldLog(LogLevel::value::WARN)){
+                return;
+            }
+            serialize(LogLevel::value::WARN, file, line, [&](Buffer &buf) {
+                Fmt::FormatTo(buf, format, args...);
+            });
+        }
+        template <typename... Args>
+        void WarnFmt(Fmt::CallSite &site, const Args &...args) {
+            LogCallSite(LogLevel::value::WARN, site, args...);
+        }
+
+        template <typename... Args>
+        void ErrorFmt(const char *file, size_t line, const char *format, const Args &...args) {
+            if (!ShouldLog(LogLevel::value::ERROR)){
+                return;
+            }
+            serialize(LogLevel::value::ERROR, file, line, [&](Buffer &buf) {
+                Fmt::FormatTo(buf, format, args...);
+            });
+        }
+        template <typename... Args>
+        void ErrorFmt(Fmt::CallSite &site, const Args &...args) {
+            LogCallSite(LogLevel::value::ERROR, site, args...);
+        }
+
+        template <typename... Args>
+        void FatalFmt(const char *file, size_t line, const char *format, const Args &...args) {
+            if (!ShouldLog(LogLevel::value::FATAL)){
+                return;
+            }
+            serialize(LogLevel::value::FATAL, file, line, [&](Buffer &buf) {
+                Fmt::FormatTo(buf, format, args...);
+            });
+        }
+        template <typename... Args>
+        void FatalFmt(Fmt::CallSite &site, const Args &...args) {
+            LogCallSite(LogLevel::value::FATAL, site, args...);
+        }
+
+        //结构化接口: 日志内容加上任意个Kv(key, value)字段, 字段按类型直接编码到缓冲区
+        //  TEXT格式下字段以 key=value 追加在内容之后, JSON/LOGFMT格式下为记录中的独立字段
+        //  通过Chronicle.hpp中的同名宏调用时自动传入文件名和行号, 例如:
+        //  logger->InfoKv("request done", Chronicle::Kv("status", 200), Chronicle::Kv("cost_ms", 0.25));
+        template <typename... Fields>
+        void DebugKv(const char *file, size_t line, const char *message, const Fields &...fields) {
+            LogKv(LogLevel::value::DEBUG, file, line, message, fields...);
+        }
+        template <typename... Fields>
+        void InfoKv(const char *file, size_t line, const char *message, const Fields &...fields) {
+            LogKv(LogLevel::value::INFO, file, line, message, fields...);
+        }
+        template <typename... Fields>
+        void WarnKv(const char *file, size_t line, const char *message, const Fields &...fields) {
+            LogKv(LogLevel::value::WARN, file, line, message, fields...);
+        }
+        template <typename... Fields>
+        void ErrorKv(const char *file, size_t line, const char *message, const Fields &...fields) {
+            LogKv(LogLevel::value::ERROR, file, line, message, fields...);
+        }
+        template <typename... Fields>
+        void FatalKv(const char *file, size_t line, const char *message, const Fields &...fields) {
+            LogKv(LogLevel::value::FATAL, file, line, message, fields...);
+        }
 
     protected:
+        template <typename... Fields>
+        void LogKv(LogLevel::value level, const char *file, size_t line, const char *message,
+                   const Fields &...fields) {
+            if (!ShouldLog(level)){
+                return;
+            }
+            serialize(level, file, line, [&](Buffer &buf) {
+                Fmt::WriteArg(buf, message);
+            }, [&](Buffer &buf, LogFormat format) {
+                Structured::WriteFields(buf, format, fields...);
+            });
+        }
+
+        // 没有键值字段的日志使用的空字段写入器
+        struct NoFields {
+            void operator()(Buffer &, LogFormat) const {}
+        };
+
+        // 通过静态调用点记录日志: 二进制模式只编码调用点id与原始参数, 否则按{}格式化为文本
+        template <typename... Args>
+        void LogCallSite(LogLevel::value level, Fmt::CallSite &site, const Args &...args) {
+            if (!ShouldLog(level)){
+                return;
+            }
+            if (_m_binary){
+                // 二进制记录不在生产者线程格式化, 只按调用点限速, 不合并重复
+                StormGuard::Slot *slot = nullptr;
+                if (_m_storm && !StormAdmit(level, site.file, site.line, &slot)){
+                    return;
+                }
+                uint32_t id = site.id.load(std::memory_order_acquire);
+                if (id == 0){
+                    id = Binary::Registry::GetInstance().Register(site, Binary::Signature<Args...>());
+                }
+                serializeRecord(level, site.file, [&](Buffer &buf) {
+                    Binary::Encode(buf, id, args...);
+                });
+                return;
+            }
+            serialize(level, site.file, site.line, [&](Buffer &buf) {
+                Fmt::FormatTo(buf, site.format, args...);
+            });
+        }
+
         // 序列化日志消息并处理输出
-        void serialize(LogLevel::value level, const std::string &file, size_t line,
-                       char *ret_future) {
-            LogMessage msg(level, file, line, _m_logger_name, ret_future);
-            // 获取具体的log内容行
-            std::string data = msg.format();
-            //远程备份ERROR、FATAL日志
-            if (level == LogLevel::value::FATAL || level == LogLevel::value::ERROR){
-                try{
-                    auto ret_future = thread_pool->enqueue(start_backup, data);
-                    ret_future.get();   //无返回值, 这里实际上是等待异步执行结束, 即等待连接客户端发送msg给socket并断开socket
+        // write_payload(Buffer&)负责写入日志内容(printf风格或{}风格), 头部和换行由这里统一处理
+        // 二进制模式下内容仍在生产者线程格式化, 与文件名、行号一起编码为文本记录
+        // write_fields(Buffer&, LogFormat)负责写入结构化接口的键值字段
+        template <typename PayloadWriter>
+        void serialize(LogLevel::value level, const char *file, size_t line,
+                       const PayloadWriter &write_payload) {
+            serialize(level, file, line, write_payload, NoFields());
+        }
+        template <typename PayloadWriter, typename FieldsWriter>
+        void serialize(LogLevel::value level, const char *file, size_t line,
+                       const PayloadWriter &write_payload, const FieldsWriter &write_fields) {
+            if (_m_storm){
+                serializeGuarded(level, file, line, write_payload, write_fields);
+                return;
+            }
+            serializeRecord(level, file, [&](Buffer &buf) {
+                WriteRecord(buf, level, file, line, write_payload, write_fields);
+            });
+        }
+
+        // 启用日志风暴抑制时的写入路径: 先按调用点限速(此时还没有格式化), 再与该调用点的上一条内容比较
+        // 内容和字段先写入线程本地缓冲区, 重复的日志不进入异步工作器, 也不触发远程备份
+        template <typename PayloadWriter, typename FieldsWriter>
+        void serializeGuarded(LogLevel::value level, const char *file, size_t line,
+                              const PayloadWriter &write_payload, const FieldsWriter &write_fields) {
+            StormGuard::Slot *slot = nullptr;
+            if (!StormAdmit(level, file, line, &slot)){
+                return;
+            }
+            if (slot == nullptr || !_m_storm->Policy().collapse_repeats){
+                serializeRecord(level, file, [&](Buffer &buf) {
+                    WriteRecord(buf, level, file, line, write_payload, write_fields);
+                });
+                return;
+            }
+            Buffer &content = LocalContentBuffer();
+            content.Reset();
+            write_payload(content);
+            size_t payload_len = content.ReadableSize();
+            write_fields(content, _m_binary ? LogFormat::TEXT : _m_format);
+            uint64_t repeats = 0;
+            if (_m_storm->Repeat(slot, level, StormGuard::Hash(content.Begin(), content.ReadableSize()), &repeats)){
+                return;
+            }
+            if (repeats > 0){
+                ReportStormSite(level, file, line, 0, repeats);
+            }
+            serializeRecord(level, file, [&](Buffer &buf) {
+                WriteRecord(buf, level, file, line, [&](Buffer &b) {
+                    b.Push(content.Begin(), payload_len);
+                }, [&](Buffer &b, LogFormat) {
+                    b.Push(content.Begin() + payload_len, content.ReadableSize() - payload_len);
+                });
+            });
+        }
+
+        // 按调用点限速, 返回false表示丢弃; 到了汇总时间时顺便输出各调用点的抑制计数
+        bool StormAdmit(LogLevel::value level, const char *file, size_t line, StormGuard::Slot **slot) {
+            bool admitted = _m_storm->Admit(level, file, line, slot);
+            if (_m_storm->ReportDue()){
+                ReportStorm();
+            }
+            return admitted;
+        }
+
+        // 输出所有调用点尚未汇总的抑制计数
+        void ReportStorm() {
+            _m_storm->Sweep([this](LogLevel::value level, const char *file, size_t line,
+                                   uint64_t suppressed, uint64_t repeats) {
+                ReportStormSite(level, file, line, suppressed, repeats);
+            });
+        }
+
+        // 以被抑制日志的调用点和等级输出汇总记录, 不再经过限速
+        void ReportStormSite(LogLevel::value level, const char *file, size_t line,
+                             uint64_t suppressed, uint64_t repeats) {
+            auto report = [&](const char *format, uint64_t count) {
+                serializeRecord(level, file, [&](Buffer &buf) {
+                    WriteRecord(buf, level, file, line, [&](Buffer &b) {
+                        char *p = b.Reserve(kSummaryBufferSize / 2);
+                        int n = snprintf(p, kSummaryBufferSize / 2, format, static_cast<unsigned long long>(count));
+                        b.Commit(n > 0 ? static_cast<size_t>(n) : 0);
+                    });
+                });
+            };
+            if (repeats > 0){
+                report("last message repeated %llu times", repeats);
+            }
+            if (suppressed > 0){
+                report("%llu similar records suppressed by rate limit", suppressed);
+            }
+        }
+
+        // 写入一条完整记录: 二进制模式下编码为文本记录(字段按TEXT格式追加在内容之后), 否则按日志格式格式化
+        template <typename PayloadWriter>
+        void WriteRecord(Buffer &buf, LogLevel::value level, const char *file, size_t line,
+                         const PayloadWriter &write_payload) {
+            WriteRecord(buf, level, file, line, write_payload, NoFields());
+        }
+        template <typename PayloadWriter, typename FieldsWriter>
+        void WriteRecord(Buffer &buf, LogLevel::value level, const char *file, size_t line,
+                         const PayloadWriter &write_payload, const FieldsWriter &write_fields) {
+            if (_m_binary){
+                Binary::EncodeText(buf, level, file, line, [&](Buffer &b) {
+                    write_payload(b);
+                    write_fields(b, LogFormat::TEXT);
+                });
+            }
+            else{
+                FormatRecord(buf, level, file, line, write_payload, write_fields);
+            }
+        }
+
+        // 写入一条完整记录并推送到异步工作器
+        // 记录直接写入Buffer的预留空间中(启用暂存缓冲区时为线程本地暂存缓冲区, 否则为线程本地格式化缓冲区),
+        // 单行不超过格式化缓冲区容量时没有堆分配
+        // 启用路由时先按等级和源文件决定去向, 没有输出策略接收的日志不再格式化(ERROR/FATAL仍要远程备份)
+        template <typename RecordWriter>
+        void serializeRecord(LogLevel::value level, const char *file, const RecordWriter &write_record) {
+            bool backup = (level == LogLevel::value::FATAL || level == LogLevel::value::ERROR);
+            uint32_t groups = _m_routed ? RouteOf(level, file) : 0;
+            if (_m_routed && groups == 0 && !backup){
+                return;
+            }
+            if (_m_staging_size > 0){
+                StagingBuffer &staging = LocalStaging();
+                std::lock_guard<std::mutex> lock(staging.mtx);
+                size_t start = staging.buffer.ReadableSize();
+                size_t begin = BeginRecord(staging.buffer);
+                write_record(staging.buffer);
+                EndRecord(staging.buffer, begin, groups);
+                if (backup){
+                    Backup(staging.buffer.Begin() + begin, staging.buffer.ReadableSize() - begin);
+                }
+                // 不小于暂存缓冲区的记录不经过暂存, 单独写入异步工作器
+                if (staging.buffer.ReadableSize() - start >= _m_staging_size){
+                    PublishOversizedLocked(staging, start, level);
+                    return;
                 }
-                catch (const std::runtime_error &e){
-                    std::cout << __FILE__ << " " << __LINE__ << " thread pool runtime error" << std::endl;
+                if (start == 0){
+                    staging.first = std::chrono::steady_clock::now();
                 }
+                staging.Add(level);
+                // 暂存缓冲区额外预留了一行的空间, 达到_m_staging_size或遇到ERROR/FATAL时整批发布
+                if (staging.buffer.ReadableSize() >= _m_staging_size || backup){
+                    PublishLocked(staging);
+                }
+                return;
+            }
+
+            Buffer &buf = LocalFormatBuffer();
+            buf.Reset();
+            size_t begin = BeginRecord(buf);
+            write_record(buf);
+            EndRecord(buf, begin, groups);
+            if (backup){
+                Backup(buf.Begin() + begin, buf.ReadableSize() - begin);
             }
             // 将日志数据推送到异步缓冲区, AsyncWoker自动调用回调函数处理缓冲区
-            PushToBuffer(data.c_str(), data.size());
+            LocalWorker().Push(buf.Begin(), buf.ReadableSize(), _m_overflow[static_cast<int>(level)], 1,
+                               IsUrgent(static_cast<int>(level)));
 
             /*业务线程调用Push()将日志数据放入生产者缓冲区后，立即返回继续执行，而实际刷盘操作由后台线程异步处理*/
             // std::cout << "Debug:serialize Flush\n";
         }
 
-        // 推送日志数据到异步工作器, 由AsyncWorker的回调函数实现日志落地
-        // 由AsyncWorker保证线程安全, 这里不需要加锁
-        void PushToBuffer(const char *data, size_t len) {
-            _m_asyncworker->Push(data, len); 
+        // 启用路由时每条记录前的帧头, 消费者线程按groups分发记录后去掉, 输出策略收到的仍是原来的记录
+        struct RouteHeader {
+            uint32_t len;       // 记录长度, 不含帧头
+            uint32_t groups;    // 接收该记录的路由组位图, 第g位对应路由组g
+        };
+
+        // 启用路由时为一条记录预留帧头, 返回记录内容在buf中的起始偏移
+        size_t BeginRecord(Buffer &buf) {
+            if (_m_routed){
+                buf.Reserve(sizeof(RouteHeader));
+                buf.Commit(sizeof(RouteHeader));
+            }
+            return buf.ReadableSize();
+        }
+
+        // 记录写完后填写帧头
+        void EndRecord(Buffer &buf, size_t begin, uint32_t groups) {
+            if (!_m_routed){
+                return;
+            }
+            RouteHeader header = { static_cast<uint32_t>(buf.ReadableSize() - begin), groups };
+            memcpy(buf.ReadBegin(0) + begin - sizeof(RouteHeader), &header, sizeof(RouteHeader));
+        }
+
+        // 一条日志去往的路由组位图, file为空时不检查源文件前缀
+        uint32_t RouteOf(LogLevel::value level, const char *file) const {
+            int l = static_cast<int>(level);
+            uint32_t groups = _m_level_groups[l];
+            for (auto &r : _m_file_routes){
+                if (l >= r.min_level && (file == nullptr || r.Match(file))){
+                    groups |= r.bit;
+                }
+            }
+            return groups;
+        }
+
+        template <typename PayloadWriter, typename FieldsWriter>
+        void FormatRecord(Buffer &buf, LogLevel::value level, const char *file, size_t line,
+                          const PayloadWriter &write_payload, const FieldsWriter &write_fields) {
+            if (_m_format != LogFormat::TEXT){
+                uint64_t seq = _m_sequence ? _m_next_seq.fetch_add(1, std::memory_order_relaxed) : 0;
+                Structured::FormatRecord(buf, _m_format, level, file, line, _m_logger_name, _m_time_format,
+                                         _m_time_precision, _m_sequence ? &seq : nullptr, write_payload,
+                                         [&](Buffer &b) { write_fields(b, _m_format); });
+                return;
+            }
+            // 序号在格式化时分配, 不保证按序号顺序输出(见SetShards), 恢复全局顺序需要按[#序号]排序
+            if (_m_sequence){
+                buf.Push("[#", 2);
+                Fmt::WriteArg(buf, _m_next_seq.fetch_add(1, std::memory_order_relaxed));
+                buf.Push("]", 1);
+            }
+            LogMessage::FormatHeader(buf, level, file, line, _m_logger_name, _m_time_format, _m_time_precision);
+            write_payload(buf);
+            write_fields(buf, LogFormat::TEXT);
+            buf.Push("\n", 1);
+        }
+
+        //远程备份ERROR、FATAL日志, 只放入备份队列, 由后台线程批量发送, 不阻塞业务线程
+        //二进制记录先渲染为文本
+        void Backup(const char *data, size_t len) {
+            if (!_m_binary){
+                _m_backup.Enqueue(data, len);
+                return;
+            }
+            // 只查找本条记录的调用点
+            std::string text;
+            Binary::SiteInfo site;
+            Binary::Render(text, data, len, [&](uint32_t id) -> const Binary::SiteInfo * {
+                return Binary::Registry::GetInstance().Lookup(id, &site) ? &site : nullptr;
+            }, _m_logger_name, _m_time_format, _m_time_precision);
+            _m_backup.Enqueue(text.data(), text.size());
+        }
+
+        // 线程本地格式化缓冲区, 每个线程只在首次使用(或遇到超长日志)时分配
+        static Buffer &LocalFormatBuffer() {
+            static thread_local Buffer buf(kFormatBufferSize);
+            return buf;
+        }
+
+        // 合并重复日志时先写入日志内容的线程本地缓冲区
+        static Buffer &LocalContentBuffer() {
+            static thread_local Buffer buf(kFormatBufferSize);
+            return buf;
+        }
+
+        // 写给一个路由组的数据
+        struct RouteOutput {
+            struct iovec iov[2];
+            int iovcnt = 0;
+            size_t len = 0;
+            std::string routed;     // 启用路由时分到该组的记录(已去掉帧头), 复用容量
+            std::string rendered;   // 二进制渲染模式下的渲染结果, 复用容量
+            SharedBlock block;      // 组内有带独立队列的输出策略时的共享数据块
+        };
+
+        // 分片消费者线程的私有状态
+        struct ShardState {
+            explicit ShardState(size_t summary_size) : summary(summary_size) {}
+            Binary::SiteTable render_sites;              // 调用点快照
+            std::vector<RouteOutput> outputs;            // 各路由组的待写数据, 未启用路由时只有一组
+            Buffer summary;                              // 输出丢弃汇总时使用的缓冲区
+        };
+
+        // 限定源文件前缀的路由组
+        struct FileRoute {
+            uint32_t bit;                               // 路由组在帧头位图中的位
+            int min_level;
+            std::vector<std::string> prefixes;
+            bool Match(const char *file) const {
+                for (auto &p : prefixes){
+                    if (strncmp(file, p.data(), p.size()) == 0){
+                        return true;
+                    }
+                }
+                return false;
+            }
+        };
+
+        // 按路由规则把输出策略分组, 规则相同的输出策略共用一份分发结果, 帧头位图最多表示kMaxRouteGroups组
+        // 日志器名称不匹配的路由组不接收任何日志
+        void SetupRoutes(const std::vector<FlushRoute> &routes) {
+            std::vector<FlushRoute> groups;
+            for (size_t i = 0; i < _m_flushs.size(); ++i){
+                FlushRoute route = i < routes.size() ? routes[i] : FlushRoute();
+                size_t g = std::find(groups.begin(), groups.end(), route) - groups.begin();
+                if (g == groups.size()){
+                    groups.push_back(route);
+                    _m_group_shared.push_back(false);
+                }
+                _m_sink_group.push_back(g);
+                _m_group_shared[g] = _m_group_shared[g] || _m_flushs[i]->WantsShared();
+                _m_routed = _m_routed || route.Enabled();
+            }
+            assert(groups.size() <= kMaxRouteGroups);
+            std::fill(_m_level_groups, _m_level_groups + LogLevel::kCount, 0);
+            for (size_t g = 0; g < groups.size() && g < kMaxRouteGroups; ++g){
+                const FlushRoute &route = groups[g];
+                if (!route.loggers.empty() &&
+                    std::find(route.loggers.begin(), route.loggers.end(), _m_logger_name) == route.loggers.end()){
+                    continue;
+                }
+                uint32_t bit = 1u << g;
+                if (!route.file_prefixes.empty()){
+                    _m_file_routes.push_back(FileRoute{ bit, static_cast<int>(route.min_level), route.file_prefixes });
+                    continue;
+                }
+                for (int level = static_cast<int>(route.min_level); level < LogLevel::kCount; ++level){
+                    _m_level_groups[level] |= bit;
+                }
+            }
         }
 
         // 日志数据的回调函数, AsyncWorker._m_callback_func
-        // 由异步线程进行实际写文件
-        void RealFlush(Buffer &buffer) {
+        // 由异步线程进行实际写文件, shard为该消费者线程所属的分片
+        void RealFlush(Buffer &buffer, size_t shard) {
             if (_m_flushs.empty()){
                 return;
             }
-            // 遍历所有输出策略并执行刷盘
+            ShardState &state = *_m_shard_states[shard];
+            bool urgent = shard < _m_workers.size() && _m_workers[shard]->BatchUrgent();
+            Buffer *blocks[2] = { &buffer, nullptr };
+            size_t count = 1;
+            // 缓冲池恢复可写后, 汇总输出一条此前按溢出策略丢弃的数量, 与本批数据一起写入
+            // 启用路由时发给所有接收WARN的路由组, 不检查源文件前缀
+            size_t records = 0, bytes = 0;
+            if (shard < _m_workers.size() && _m_workers[shard]->TakeDropped(&records, &bytes)){
+                state.summary.Reset();
+                size_t begin = BeginRecord(state.summary);
+                WriteRecord(state.summary, LogLevel::value::WARN, __FILE__, __LINE__, [&](Buffer &buf) {
+                    char *p = buf.Reserve(kSummaryBufferSize / 2);
+                    int n = snprintf(p, kSummaryBufferSize / 2, "%zu records dropped (%zu bytes) by overflow policy",
+                                     records, bytes);
+                    buf.Commit(n > 0 ? static_cast<size_t>(n) : 0);
+                });
+                EndRecord(state.summary, begin, RouteOf(LogLevel::value::WARN, nullptr));
+                blocks[count++] = &state.summary;
+            }
+            FlushToSinks(state, blocks, count, urgent);
+        }
+
+        // 把count块数据按顺序写入所有输出策略, 文件输出策略用一次writev提交, 不再拷贝
+        // 启用路由时先按帧头把记录分发到各路由组(每组复制一次), 每个输出策略只收到本组的记录
+        // urgent: 本批包含ERROR/FATAL, 用于持久化策略的on_error
+        void FlushToSinks(ShardState &state, Buffer *const *blocks, size_t count, bool urgent) {
+            size_t groups = _m_group_shared.size();
+            state.outputs.resize(groups);
+            if (_m_routed){
+                SplitRoutes(state, blocks, count);
+            }
+            else {
+                RouteOutput &out = state.outputs[0];
+                out.iovcnt = 0;
+                for (size_t i = 0; i < count; ++i){
+                    out.iov[out.iovcnt++] = { const_cast<char *>(blocks[i]->Begin()), blocks[i]->ReadableSize() };
+                }
+            }
+            // 二进制模式下由消费者线程渲染为文本, 生产者线程不承担格式化开销
+            if (_m_binary && _m_binary_render){
+                Binary::Registry::GetInstance().Snapshot(state.render_sites);
+            }
+            size_t len = 0;
+            for (size_t g = 0; g < groups; ++g){
+                RouteOutput &out = state.outputs[g];
+                if (_m_binary && _m_binary_render){
+                    out.rendered.clear();
+                    for (int i = 0; i < out.iovcnt; ++i){
+                        Binary::Render(out.rendered, static_cast<const char *>(out.iov[i].iov_base), out.iov[i].iov_len,
+                                       [&state](uint32_t id) -> const Binary::SiteInfo * {
+                            return state.render_sites.Find(id);
+                        }, _m_logger_name, _m_time_format, _m_time_precision);
+                    }
+                    out.iov[0] = { const_cast<char *>(out.rendered.data()), out.rendered.size() };
+                    out.iovcnt = 1;
+                }
+                out.len = 0;
+                for (int i = 0; i < out.iovcnt; ++i){
+                    out.len += out.iov[i].iov_len;
+                }
+                // 有带独立队列的输出策略时复制一次到共享数据块, 各队列只保存引用
+                out.block.reset();
+                if (_m_group_shared[g] && out.len > 0){
+                    std::string copy;
+                    copy.reserve(out.len);
+                    for (int i = 0; i < out.iovcnt; ++i){
+                        copy.append(static_cast<const char *>(out.iov[i].iov_base), out.iov[i].iov_len);
+                    }
+                    out.block = std::make_shared<const std::string>(std::move(copy));
+                }
+                len += out.len;
+            }
+            // 遍历所有输出策略并执行刷盘, 多个分片的消费者线程在这里串行, 每次写入一整批
+            std::unique_lock<std::mutex> lock(_m_sink_mtx);
+            for (size_t i = 0; i < _m_flushs.size(); ++i){
+                const RouteOutput &out = state.outputs[_m_sink_group[i]];
+                if (out.len == 0){
+                    continue;
+                }
+                if (_m_flushs[i]->WantsShared()){
+                    _m_flushs[i]->FlushShared(out.block);
+                }
+                else {
+                    _m_flushs[i]->FlushV(out.iov, out.iovcnt);
+                }
+            }
+            _m_unsynced += len;
+            if (_m_durability.Enabled() && SyncDueLocked(urgent)){
+                SyncSinks(lock, _m_durability.level);
+            }
+        }
+
+        // 按帧头把记录复制到接收它的各路由组, 去掉帧头
+        void SplitRoutes(ShardState &state, Buffer *const *blocks, size_t count) {
+            for (auto &out : state.outputs){
+                out.routed.clear();
+            }
+            for (size_t i = 0; i < count; ++i){
+                const char *p = blocks[i]->Begin();
+                const char *end = p + blocks[i]->ReadableSize();
+                while (static_cast<size_t>(end - p) >= sizeof(RouteHeader)){
+                    RouteHeader header;
+                    memcpy(&header, p, sizeof(RouteHeader));
+                    p += sizeof(RouteHeader);
+                    if (header.len > static_cast<size_t>(end - p)){
+                        break;
+                    }
+                    for (uint32_t bits = header.groups; bits != 0; bits &= bits - 1){
+                        state.outputs[__builtin_ctz(bits)].routed.append(p, header.len);
+                    }
+                    p += header.len;
+                }
+            }
+            for (auto &out : state.outputs){
+                out.iov[0] = { const_cast<char *>(out.routed.data()), out.routed.size() };
+                out.iovcnt = out.routed.empty() ? 0 : 1;
+            }
+        }
+
+        // 本批写入后是否需要同步, 调用时持有_m_sink_mtx
+        bool SyncDueLocked(bool urgent) {
+            const DurabilityPolicy &p = _m_durability;
+            if (p.every_batch || (p.on_error && urgent) || (p.bytes > 0 && _m_unsynced >= p.bytes)){
+                return true;
+            }
+            return p.interval_ms > 0 &&
+                   std::chrono::steady_clock::now() - _m_last_sync >= std::chrono::milliseconds(p.interval_ms);
+        }
+
+        // 同步所有输出策略, 调用时lock持有_m_sink_mtx, 返回时已释放; 上次同步后没有新数据时跳过
+        // 能提供文件描述符副本(DupFd)的输出策略在释放锁之后再同步, fsync期间其他分片可以继续写入;
+        // 副本与原描述符指向同一个打开的文件, 加锁期间已写入的数据都在同步范围内
+        void SyncSinks(std::unique_lock<std::mutex> &lock, SyncLevel level) {
+            if (_m_unsynced == 0){
+                lock.unlock();
+                return;
+            }
+            std::vector<int> fds;
             for (auto &e : _m_flushs){
-                e->Flush(buffer.Begin(), buffer.ReadableSize());
+                int fd = level == SyncLevel::FLUSH ? -1 : e->DupFd();
+                if (fd == -1){
+                    e->Sync(level);
+                }
+                else {
+                    fds.push_back(fd);
+                }
+            }
+            _m_unsynced = 0;
+            _m_last_sync = std::chrono::steady_clock::now();
+            _m_sync_count.fetch_add(1, std::memory_order_relaxed);
+            lock.unlock();
+            for (int fd : fds){
+                LogFlush::SyncFd(fd, level);
+                close(fd);
+            }
+        }
+
+        // 按时间同步的后台线程: 日志停止写入后, 最后一批数据最多延迟interval_ms同步
+        void SyncThreadEntry() {
+            std::chrono::milliseconds interval(_m_durability.interval_ms);
+            std::unique_lock<std::mutex> lock(_m_sink_mtx);
+            while (!_m_sync_stop){
+                _m_sync_cond.wait_until(lock, _m_last_sync + interval);
+                if (!_m_sync_stop && std::chrono::steady_clock::now() - _m_last_sync >= interval){
+                    SyncSinks(lock, _m_durability.level);
+                    lock.lock();
+                    // 没有新数据时同样推迟下一次检查
+                    _m_last_sync = std::chrono::steady_clock::now();
+                }
             }
         }
 
+        static bool IsUrgent(int level) {
+            return level >= static_cast<int>(LogLevel::value::ERROR);
+        }
+
+        // 消费者停止前等待输出策略的异步写入完成
+        void DrainSinks() {
+            {
+                std::lock_guard<std::mutex> lock(_m_sink_mtx);
+                DrainSinksLocked();
+            }
+            DrainQueuedSinks();
+        }
+
+        // 等待没有独立队列的输出策略的异步写入(io_uring)完成, 调用时持有_m_sink_mtx, 与其他分片的写入互斥
+        void DrainSinksLocked() {
+            for (auto &e : _m_flushs){
+                if (!e->Queued()){
+                    e->Drain();
+                }
+            }
+        }
+
+        // 等待带独立队列的输出策略写完, 不持有_m_sink_mtx, 每个最多等待其drain_timeout_ms
+        void DrainQueuedSinks() {
+            for (auto &e : _m_flushs){
+                if (e->Queued()){
+                    e->Drain();
+                }
+            }
+        }
+
+        // 当前线程所属的分片: 线程首次写日志时按到达顺序轮流分配, 之后固定不变, 同一线程的日志始终有序
+        AsyncWorker &LocalWorker() {
+            return *_m_workers[LocalShard() % _m_workers.size()];
+        }
+        static size_t LocalShard() {
+            static std::atomic<size_t> next(0);
+            static thread_local size_t shard = next.fetch_add(1, std::memory_order_relaxed);
+            return shard;
+        }
+
+        // 线程本地暂存缓冲区, 由所属线程写入, 后台发布线程定时将其整批写入异步工作器
+        struct StagingBuffer {
+            using ptr = std::shared_ptr<StagingBuffer>;
+            StagingBuffer(size_t size, AsyncWorker &w) : buffer(size), records(0), max_level(0), worker(w) {}
+            void Add(LogLevel::value level) {
+                ++records;
+                max_level = std::max(max_level, static_cast<int>(level));
+            }
+            std::mutex mtx;
+            Buffer buffer;
+            std::chrono::steady_clock::time_point first;  // 本批第一条记录的写入时间
+            size_t records;                               // 本批记录条数
+            int max_level;                                // 本批最高日志等级, 整批按该等级的溢出策略写入
+            AsyncWorker &worker;                          // 所属线程的分片, 由后台发布线程发布时同样写入该分片
+        };
+
+
+        // 线程本地表中的一项, owner在日志器销毁后失效
+        struct LocalStagingEntry {
+            std::weak_ptr<void> owner;
+            StagingBuffer::ptr staging;
+        };
+
+        // 获取当前线程在本日志器下的暂存缓冲区, 首次使用时创建并登记
+        // 以日志器id而非地址作为key, 日志器销毁后残留的条目不会被新日志器误用;
+        // 残留条目的缓冲区内存在日志器析构时已释放, 条目本身在本线程下次创建暂存缓冲区时清理
+        StagingBuffer &LocalStaging() {
+            static thread_local std::unordered_map<uint64_t, LocalStagingEntry> local;
+            auto it = local.find(_m_id);
+            if (it != local.end()){
+                return *it->second.staging;
+            }
+            for (auto e = local.begin(); e != local.end();){
+                if (e->second.owner.expired()){
+                    e = local.erase(e);
+                }
+                else {
+                    ++e;
+                }
+            }
+            LocalStagingEntry &entry = local[_m_id];
+            entry.owner = _m_alive;
+            // 多预留一行的空间, 格式化时不必先判断剩余容量
+            entry.staging = std::make_shared<StagingBuffer>(_m_staging_size + kFormatBufferSize, LocalWorker());
+            std::unique_lock<std::mutex> lock(_m_staging_mtx);
+            _m_stagings.push_back(entry.staging);
+            return *entry.staging;
+        }
+
+        // 将暂存数据作为一个整体写入异步工作器, 调用前需持有staging.mtx
+        void PublishLocked(StagingBuffer &staging) {
+            if (staging.buffer.IsEmpty()){
+                return;
+            }
+            staging.worker.Push(staging.buffer.Begin(), staging.buffer.ReadableSize(),
+                                _m_overflow[staging.max_level], staging.records, IsUrgent(staging.max_level));
+            staging.buffer.Reset();
+            staging.records = 0;
+            staging.max_level = 0;
+        }
+
+        // 暂存缓冲区中从start开始是一条不小于暂存缓冲区的记录: 先发布之前暂存的记录, 再单独写入这条记录,
+        // 最后收回格式化这条记录时扩容占用的内存, 调用前需持有staging.mtx
+        void PublishOversizedLocked(StagingBuffer &staging, size_t start, LogLevel::value level) {
+            Buffer &buf = staging.buffer;
+            if (start > 0){
+                staging.worker.Push(buf.Begin(), start, _m_overflow[staging.max_level], staging.records,
+                                    IsUrgent(staging.max_level));
+            }
+            staging.worker.Push(buf.Begin() + start, buf.ReadableSize() - start, _m_overflow[static_cast<int>(level)], 1,
+                                IsUrgent(static_cast<int>(level)));
+            buf.Reset();
+            staging.records = 0;
+            staging.max_level = 0;
+            buf.Shrink(_m_staging_size + kFormatBufferSize);
+        }
+
+        // 发布所有线程的暂存数据, 按每批第一条记录的时间先后写入, 使不同线程的批次大致有序
+        void PublishAllStaging() {
+            std::vector<StagingBuffer::ptr> stagings;
+            {
+                std::unique_lock<std::mutex> lock(_m_staging_mtx);
+                // 线程已退出且数据已发布的暂存缓冲区不再需要登记
+                _m_stagings.erase(std::remove_if(_m_stagings.begin(), _m_stagings.end(),
+                    [](const StagingBuffer::ptr &st) {
+                        std::lock_guard<std::mutex> st_lock(st->mtx);
+                        return st.use_count() == 1 && st->buffer.IsEmpty();
+                    }), _m_stagings.end());
+                stagings = _m_stagings;
+            }
+            std::vector<std::pair<std::chrono::steady_clock::time_point, StagingBuffer*>> ready;
+            for (auto &st : stagings){
+                std::lock_guard<std::mutex> st_lock(st->mtx);
+                if (!st->buffer.IsEmpty()){
+                    ready.emplace_back(st->first, st.get());
+                }
+            }
+            std::sort(ready.begin(), ready.end(),
+                [](const std::pair<std::chrono::steady_clock::time_point, StagingBuffer*> &a,
+                   const std::pair<std::chrono::steady_clock::time_point, StagingBuffer*> &b) {
+                    return a.first < b.first;
+                });
+            for (auto &e : ready){
+                std::lock_guard<std::mutex> st_lock(e.second->mtx);
+                PublishLocked(*e.second);
+            }
+        }
+
+        // 后台发布线程, 保证暂存数据最多延迟_m_staging_interval_ms
+        void StagingThreadEntry() {
+            std::unique_lock<std::mutex> lock(_m_staging_mtx);
+            while (!_m_staging_stop){
+                _m_staging_cond.wait_for(lock, std::chrono::milliseconds(_m_staging_interval_ms));
+                lock.unlock();
+                PublishAllStaging();
+                lock.lock();
+            }
+        }
+
+        static const size_t kFormatBufferSize = 4096;   // 单行日志不超过该长度时格式化不产生堆分配
+        static const size_t kSummaryBufferSize = 512;   // 丢弃汇总日志的缓冲区大小
+        static const size_t kMaxRouteGroups = 32;       // 路由组个数上限, 即帧头位图的位数
+
+        static uint64_t NextId() {
+            static std::atomic<uint64_t> id(0);
+            return ++id;
+        }
+
     protected:
         std::mutex _m_mtx;
         std::string _m_logger_name;
         std::vector<LogFlush::ptr> _m_flushs;   //用LogFlush子类实例化
         // std::vector<LogFlush> flush_;不能使用logflush作为元素类型，logflush是纯虚类，不能实例化
-        Chronicle::AsyncWorker::ptr _m_asyncworker;
+        std::vector<Chronicle::AsyncWorker::ptr> _m_workers;            // 异步工作器分片
+        std::vector<std::unique_ptr<ShardState>> _m_shard_states;       // 与_m_workers一一对应
+        std::mutex _m_sink_mtx;                                         // 串行化多个分片对输出策略的写入, 所有分片共用
+
+        // 线程本地暂存缓冲区
+        uint64_t _m_id;                             // 日志器唯一id, 用于索引线程本地暂存缓冲区
+        std::shared_ptr<void> _m_alive;             // 日志器存活标记, 线程本地表据此清理已销毁日志器的条目
+        size_t _m_staging_size;                     // 单个暂存缓冲区大小, 0表示不启用
+        size_t _m_staging_interval_ms;              // 暂存数据的最长停留时间
+        bool _m_staging_stop;
+        std::mutex _m_staging_mtx;                  // 保护_m_stagings和_m_staging_stop
+        std::condition_variable _m_staging_cond;
+        std::vector<StagingBuffer::ptr> _m_stagings;  // 所有线程的暂存缓冲区
+        std::thread _m_staging_thread;
+
+        std::atomic<int> _m_min_level;              // 运行期日志等级阈值
+        TimeFormat _m_time_format;                  // 日志时间格式
+        TimePrecision _m_time_precision;            // 日志时间精度
+        LogFormat _m_format;                        // 文本记录的编码格式
+
+        // 二进制延迟格式化
+        bool _m_binary;                             // 是否启用二进制模式
+        bool _m_binary_render;                      // 是否由消费者线程渲染为文本
+        FILE *_m_registry_file;                     // 调用点登记表文件
+
+        // 远程备份队列, 在构造时获取, 保证其析构晚于LoggerManager管理的日志器
+        BackupShipper &_m_backup;
+
+        // ASYNC_SAFE缓冲池写满时各等级的处理策略
+        OverflowRule _m_overflow[LogLevel::kCount];
+
+        // 文本记录的全局序号, 多分片时排序后可恢复全局顺序
+        bool _m_sequence;
+        std::atomic<uint64_t> _m_next_seq;
+
+        // 持久化策略, 以下状态由_m_sink_mtx保护
+        DurabilityPolicy _m_durability;
+        size_t _m_unsynced;                                 // 上次同步后写入输出策略的字节数
+        std::chrono::steady_clock::time_point _m_last_sync;
+        std::atomic<size_t> _m_sync_count;
+        bool _m_sync_stop;
+        std::condition_variable _m_sync_cond;
+        std::thread _m_sync_thread;                         // interval_ms > 0 时按时间同步
+
+        // 路由, 构造后只读; 路由规则相同的输出策略为一个路由组, 未设置路由时所有输出策略同属一组
+        bool _m_routed;                                     // 是否有输出策略设置了路由规则, 为false时记录不带帧头
+        std::vector<size_t> _m_sink_group;                  // 各输出策略所属的路由组
+        std::vector<bool> _m_group_shared;                  // 各路由组中是否有接收共享数据块的输出策略
+        uint32_t _m_level_groups[LogLevel::kCount];         // 各等级的日志去往的路由组(不限源文件的路由组)
+        std::vector<FileRoute> _m_file_routes;              // 限定源文件前缀的路由组
+
+        std::unique_ptr<StormGuard> _m_storm;               // 日志风暴抑制, 未启用时为空
     };
 
     // 日志器建造
@@ -176,7 +1235,78 @@ namespace Chronicle {
         void SetLoggerName(const std::string &name) { _m_logger_name = name; }
         // 缓冲区增长方式: 不增长(ASYNC_SAFE)、增长(UNSAFE, for debug)
         void SetLopperType(AsyncType type) { _m_async_type = type; }
+        // 启用线程本地暂存缓冲区: 每个线程的日志先写入size字节的本地缓冲区,
+        // 写满、超过interval_ms或遇到ERROR/FATAL时整批发布到异步工作器
+        void SetStagingBuffer(size_t size, size_t interval_ms = 5) {
+            _m_options.staging_size = size;
+            _m_options.staging_interval_ms = interval_ms;
+        }
         
+        // 日志等级阈值, 低于该等级的日志不做格式化, 构建后可通过AsyncLogger::SetLevel修改
+        void SetLevel(LogLevel::value level) { _m_options.min_level = level; }
+        // 日志时间格式与精度, 默认 TIME + MILLI, 如 20:12:26.123
+        void SetTimeFormat(TimeFormat format, TimePrecision precision = TimePrecision::MILLI) {
+            _m_options.time_format = format;
+            _m_options.time_precision = precision;
+        }
+
+        // 二进制延迟格式化: XxxFmt接口只写入调用点id、时间戳和原始参数, 文件体积与生产者开销都更小
+        //  registry_path: 调用点登记表文件, 用chronicle-decode离线解码时需要
+        //  render_on_consumer: 为true时由消费者线程渲染为文本后再交给输出策略
+        void SetBinaryMode(const std::string &registry_path, bool render_on_consumer = false) {
+            _m_options.binary = true;
+            _m_options.binary_registry = registry_path;
+            _m_options.binary_render = render_on_consumer;
+        }
+
+        // ASYNC_SAFE缓冲池写满时的处理策略, 可按等级分别设置, 例如DEBUG丢弃而ERROR始终阻塞:
+        //  SetOverflowPolicy(LogLevel::value::DEBUG, OverflowPolicy::DROP_NEWEST);
+        //  timeout_ms用于BLOCK_TIMEOUT和SAMPLE, sample_rate用于SAMPLE
+        void SetOverflowPolicy(LogLevel::value level, OverflowPolicy policy,
+                               uint32_t timeout_ms = 0, uint32_t sample_rate = 0) {
+            _m_options.overflow[static_cast<int>(level)] = OverflowRule(policy, timeout_ms, sample_rate);
+        }
+        // 为所有等级设置相同的处理策略
+        void SetOverflowPolicy(OverflowPolicy policy, uint32_t timeout_ms = 0, uint32_t sample_rate = 0) {
+            for (int i = 0; i < LogLevel::kCount; ++i){
+                _m_options.overflow[i] = OverflowRule(policy, timeout_ms, sample_rate);
+            }
+        }
+
+        // 异步工作器分片: 创建shards个独立的缓冲池和消费者线程, 生产者线程固定分配到其中一个,
+        // 减少多线程写日志时对同一缓冲池的锁竞争, 渲染、路由分发等消费者线程的计算也按分片并行;
+        // 各分片共用同一组输出策略, 写入在一把锁下串行(每次写入一个分片的整块数据), 分片不能提高输出的吞吐,
+        // 瓶颈在磁盘或输出策略时应让不同的日志器写不同的文件
+        //  with_sequence: 为true时在每条记录头部写入全局序号[#N](JSON/logfmt为seq字段), 序号唯一且按格式化的先后递增
+        //                 序号在格式化时分配, 之后才写入分片: 同一分片内先取得序号的线程可能后写入, 启用暂存缓冲区时
+        //                 按线程整批发布, 各分片的整块数据在输出中也是交错的, 所以输出既不按序号排列,
+        //                 也不是几个可以直接归并的有序序列; 需要全局顺序时按序号对全部记录排序
+        void SetShards(size_t shards, bool with_sequence = false) {
+            _m_options.shards = shards;
+            _m_options.sequence = with_sequence;
+        }
+
+        // 指定落盘调度器, 传入空指针时使用独立的消费者线程
+        // 未调用时使用LoggerManager::SetSharedFlush配置的共享调度器(未配置时为独立线程)
+        void SetFlushScheduler(const FlushScheduler::ptr &scheduler) {
+            _m_options.scheduler = scheduler;
+            _m_scheduler_set = true;
+        }
+
+        // 记录编码格式, 默认TEXT; JSON/LOGFMT每条记录一行, 便于日志管道直接解析, 见LogFormat
+        // 二进制模式不受影响, 渲染结果始终为TEXT格式
+        void SetFormat(LogFormat format) { _m_options.format = format; }
+
+        // 日志风暴抑制, 见StormPolicy, 例如每个调用点每秒最多100条并合并连续重复的日志:
+        //  StormPolicy storm;
+        //  storm.rate = 100;
+        //  storm.collapse_repeats = true;
+        //  builder.SetStormPolicy(storm);
+        void SetStormPolicy(const StormPolicy &policy) { _m_options.storm = policy; }
+
+        // 持久化策略, 见DurabilityPolicy; 启用后输出策略不再按flush_log == 2每批fsync
+        void SetDurability(const DurabilityPolicy &policy) { _m_options.durability = policy; }
+
         //添加写日志方式(可添加多种)
         template <typename FlushType, typename... Args>
         void BuildLoggerFlush(Args &&...args) {
@@ -184,6 +1314,25 @@ namespace Chronicle {
                 LogFlushFactory::CreateLog<FlushType>(std::forward<Args>(args)...));
         }
 
+        //为最近一次BuildLoggerFlush添加的输出策略设置独立的有界队列和写入线程, 见QueuedFlush
+        //  该输出策略写入缓慢或阻塞时只影响自己(按options.overflow阻塞或丢弃), 不拖慢其他输出策略
+        void SetFlushQueue(const SinkQueueOptions &options = SinkQueueOptions()) {
+            assert(!_m_flushs.empty());
+            _m_flushs.back() = std::make_shared<QueuedFlush>(_m_flushs.back(), options);
+        }
+
+        //为最近一次BuildLoggerFlush添加的输出策略设置路由规则, 见FlushRoute, 例如只接收ERROR及以上:
+        //  FlushRoute route;
+        //  route.min_level = LogLevel::value::ERROR;
+        //  builder.BuildLoggerFlush<FileFlush>("./logfile/error.log");
+        //  builder.SetFlushRoute(route);
+        //所有输出策略都不接收的日志不再格式化; 不同的路由规则最多32种
+        void SetFlushRoute(const FlushRoute &route) {
+            assert(!_m_flushs.empty());
+            _m_options.routes.resize(_m_flushs.size());
+            _m_options.routes.back() = route;
+        }
+
         //根据LoggerBuilder生成一个Logger
         AsyncLogger::ptr BuildLogger() {
             // 必须有日志器名称
@@ -193,13 +1342,18 @@ namespace Chronicle {
             if (_m_flushs.empty()){
                 _m_flushs.emplace_back(std::make_shared<StdoutFlush>());
             }
+            if (!_m_scheduler_set){
+                _m_options.scheduler = FlushScheduler::Shared();
+            }
             return std::make_shared<AsyncLogger>(
-                _m_logger_name, _m_flushs, _m_async_type);
+                _m_logger_name, _m_flushs, _m_async_type, _m_options);
         }
 
     protected:
         std::string _m_logger_name = "async_logger";        // 日志器名称
         std::vector<Chronicle::LogFlush::ptr> _m_flushs;    // 写日志方式
         AsyncType _m_async_type = AsyncType::ASYNC_SAFE;      // 用于控制缓冲区是否增长
+        LoggerOptions _m_options;                           // 其余可选配置
+        bool _m_scheduler_set = false;                      // 是否显式指定了落盘调度器
     };
 } // namespace Chronicle
\ No newline at end of file
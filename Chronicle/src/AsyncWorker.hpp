@@ -1,98 +1,584 @@
 #pragma once
+#include <algorithm>
 #include <atomic>
+#include <chrono>
 #include <condition_variable>
+#include <deque>
 #include <functional>
 #include <iostream>
 #include <mutex>
 #include <thread>
+#include <vector>
 
 #include "AsyncBuffer.hpp"
+#include "FlushScheduler.hpp"
+#include "RingBuffer.hpp"
+#include "SpillFile.hpp"
 
 namespace Chronicle {
-    //两种工作模式:
-    //  async_safe: 安全模式, 固定大小缓冲区(缓冲区不增长), 写满阻塞生产者, buffer不扩容
-    //  async_unsafe: 不安全模式, 动态扩容缓冲区(缓冲区增长), 写满不阻塞生产者, 可能会超出内吞
-    enum class AsyncType { ASYNC_SAFE, ASYNC_UNSAFE };
+    //三种工作模式:
+    //  async_safe: 安全模式, 固定大小缓冲区(缓冲区不增长), 所有缓冲区都在等待消费时阻塞生产者, buffer不扩容
+    //  async_unsafe: 不安全模式, 没有空闲缓冲区时当前缓冲区动态扩容, 不阻塞生产者;
+    //                缓冲池内存达到unsafe_memory_limit后, 新数据按顺序写入磁盘溢出段, 由消费者按顺序读回
+    //  async_lockfree: 无锁模式(实验性), 固定大小的MPSC环形缓冲区, 生产者原子预留空间后在锁外拷贝, 写满时让出CPU等待;
+    //                  消费者还要把记录逐条拷贝到缓冲区再落地, 比async_safe多一次拷贝, 不作为性能选项使用
+    enum class AsyncType { ASYNC_SAFE, ASYNC_UNSAFE, ASYNC_LOCKFREE };
+
+    //ASYNC_SAFE模式下缓冲池全部写满(没有空闲缓冲区)时的处理策略
+    enum class OverflowPolicy {
+        BLOCK,          // 阻塞直到有空闲缓冲区(默认)
+        BLOCK_TIMEOUT,  // 最多阻塞timeout_ms, 超时后丢弃本条
+        DROP_NEWEST,    // 立即丢弃本条
+        DROP_OLDEST,    // 丢弃最早写满且只包含可丢弃记录的缓冲区, 没有这样的缓冲区时丢弃本条
+        SAMPLE          // 每sample_rate条保留1条, 保留的记录按BLOCK_TIMEOUT等待(timeout_ms为0时按BLOCK), 其余丢弃
+    };
+    struct OverflowRule {
+        OverflowRule(OverflowPolicy p = OverflowPolicy::BLOCK, uint32_t timeout = 0, uint32_t rate = 0)
+            : policy(p), timeout_ms(timeout), sample_rate(rate) {}
+        //按此策略写入的记录是否允许被丢弃
+        bool Lossy() const { return policy != OverflowPolicy::BLOCK && policy != OverflowPolicy::BLOCK_TIMEOUT; }
+
+        OverflowPolicy policy;
+        uint32_t timeout_ms;
+        uint32_t sample_rate;
+    };
     using CallBackFunc = std::function<void(Buffer&)>;
-    //异步日志生产者消费者模型
-    //  Push(): 多个外部任务会调用push, 向生产者写入
-    //  ConsumerThreadEntry(): 唯一消费者线程, 负责处理双缓冲区swap以及调用读缓冲区回调函数
+    //异步日志生产者消费者模型, 使用K个预分配缓冲区组成的缓冲池(K=2时即为双缓冲)
+    //  Push(): 多个外部任务会调用push, 向当前生产者缓冲区写入, 写满后放入待消费队列并换用空闲缓冲区
+    //  ConsumerThreadEntry(): 唯一消费者线程, 依次处理待消费队列中的缓冲区, 处理完归还空闲列表
     //  Stop(): 结束该模型, 处理被阻塞的读写任务
+    //消费者落盘较慢(如fsync)时, 生产者只有在K个缓冲区全部写满等待消费时才会阻塞(或按OverflowRule丢弃)
+    //指定FlushScheduler时不创建消费者线程, 由调度器的共享I/O线程调用ConsumeOnce()处理(无锁模式除外)
+    //Barrier(): 等待调用前写入的数据全部交给回调函数处理完成
     class AsyncWorker {
     public:
         using ptr = std::shared_ptr<AsyncWorker>;
 
-        AsyncWorker(const CallBackFunc& cb, AsyncType async_type = AsyncType::ASYNC_SAFE):
+        //buffer_count: 缓冲池中的缓冲区个数, 为0时使用config.conf中的buffer_count(至少为2)
+        //scheduler: 共享落盘调度器, 为空时使用独立的消费者线程; device: 输出所在设备, 供调度器合并同一设备的写入
+        AsyncWorker(const CallBackFunc& cb, AsyncType async_type = AsyncType::ASYNC_SAFE, size_t buffer_count = 0,
+                    const FlushScheduler::ptr& scheduler = FlushScheduler::ptr(), uint64_t device = 0):
             _m_async_type(async_type),
             _m_isStop(false),
-            _m_thread(std::thread(&AsyncWorker::ConsumerThreadEntry, this)),
-            _m_callback_func(cb) {}
+            _m_consumer_idle(false),
+            _m_max_stall_us(0),
+            _m_stall_count(0),
+            _m_dropped_records(0),
+            _m_dropped_bytes(0),
+            _m_reported_records(0),
+            _m_reported_bytes(0),
+            _m_sample_seq(0),
+            _m_spilling(false),
+            _m_spilled_bytes(0),
+            _m_memory_limit(g_conf_data->unsafe_memory_limit),
+            _m_consumer_capacity(0),
+            _m_task(nullptr),
+            _m_scheduled(false),
+            _m_pushed(0),
+            _m_done(0),
+            _m_spill_seq(0),
+            _m_spill_urgent(false),
+            _m_batch_urgent(false),
+            _m_barrier_waiters(0),
+            _m_callback_func(cb) {
+            if (_m_async_type == AsyncType::ASYNC_LOCKFREE){
+                _m_ring.reset(new RingBuffer(g_conf_data->buffer_size));
+                buffer_count = 1;   // 只需要一个消费者缓冲区
+            }
+            else if (buffer_count == 0){
+                buffer_count = g_conf_data->buffer_count;
+            }
+            buffer_count = std::max<size_t>(buffer_count, _m_ring ? 1 : 2);
+            for (size_t i = 0; i < buffer_count; ++i){
+                _m_buffers.emplace_back(new PoolBuffer());
+                _m_free.push_back(_m_buffers.back().get());
+            }
+            _m_productor = _m_free.back();
+            _m_free.pop_back();
+            //所有成员初始化完成后再启动消费者线程, 或登记到共享调度器
+            if (scheduler && !_m_ring){
+                _m_scheduler = scheduler;
+                _m_task = _m_scheduler->Attach([this]() { return RunScheduled(); }, device);
+            }
+            else{
+                _m_thread = std::thread(&AsyncWorker::ConsumerThreadEntry, this);
+            }
+        }
         ~AsyncWorker() { Stop(); }
         AsyncWorker(const AsyncWorker&) = delete;
         AsyncWorker& operator=(const AsyncWorker&) = delete;
 
         //向生产者缓冲区写入数据
-        void Push(const char* data, size_t len) {
-            // 如果生产者队列不足以写下len长度数据，并且缓冲区是固定大小(SAFE mode)，那么阻塞
+        //  rule: 安全模式下缓冲池写满时的处理策略; records: 本次写入包含的记录条数, 用于丢弃计数
+        //  urgent: 本次写入包含需要尽快持久化的记录(ERROR/FATAL), 回调函数中通过BatchUrgent()查询
+        //  返回false表示数据按策略被丢弃
+        bool Push(const char* data, size_t len, const OverflowRule& rule = OverflowRule(), size_t records = 1,
+                  bool urgent = false) {
+            if (_m_async_type == AsyncType::ASYNC_LOCKFREE) {
+                PushLockFree(data, len);
+                return true;
+            }
             std::unique_lock<std::mutex> lock(_m_mtx);
-            if (_m_async_type == AsyncType::ASYNC_SAFE) {
-                _m_cond_productor.wait(lock, [&]() {
-                    // _m_isStop 或 可写容量足够 就继续运行
-                    return _m_isStop || len <= _m_buffer_productor.WriteableSize();
-                });
-                if(_m_isStop) return;
-            }
-            _m_buffer_productor.Push(data, len);
-            _m_cond_consumer.notify_one();
+            if (len > _m_productor->WriteableSize() && !_m_productor->IsEmpty()) {
+                // 当前缓冲区写不下, 交给消费者并换用空闲缓冲区
+                // 安全模式下没有空闲缓冲区时按策略阻塞或丢弃, 不安全模式下继续写入当前缓冲区(扩容)
+                if (_m_async_type == AsyncType::ASYNC_SAFE && _m_free.empty()) {
+                    if (!HandleOverflow(lock, len, rule, records)) {
+                        return false;
+                    }
+                    if(_m_isStop) return false;
+                }
+                if (len > _m_productor->WriteableSize() && !_m_free.empty()) {
+                    _m_full.push_back(_m_productor);
+                    _m_productor = _m_free.back();
+                    _m_free.pop_back();
+                }
+            }
+            // 不安全模式下扩容会超过内存上限时写入磁盘溢出段; 开始溢出后在消费者读回全部溢出数据之前
+            // 所有新数据都写入溢出段, 保证顺序. 写文件失败时退回内存, 不丢日志
+            if (_m_async_type == AsyncType::ASYNC_UNSAFE && (_m_spilling || OverMemoryLimit(len))) {
+                if (_m_spill.Append(data, len)) {
+                    _m_spilling = true;
+                    _m_spilled_bytes += len;
+                    _m_spill_seq = ++_m_pushed;
+                    _m_spill_urgent = _m_spill_urgent || urgent;
+                    NotifyConsumer();
+                    return true;
+                }
+                // 溢出段中还有未读回的数据时, 写入内存会越过这些较早的数据, 先等待消费者全部读回
+                if (_m_spilling) {
+                    WaitSpillDrained(lock);
+                }
+            }
+            // 单条数据超过一个缓冲区的容量时直接写入空缓冲区(扩容), 避免永远等不到足够的空间
+            _m_productor->Push(data, len);
+            _m_productor->records += records;
+            _m_productor->lossy = _m_productor->lossy && rule.Lossy();
+            _m_productor->urgent = _m_productor->urgent || urgent;
+            _m_productor->seq = ++_m_pushed;
+            NotifyConsumer();
+            return true;
+        }
+
+        //消费者处理完全部数据、即将停止时调用, 在停止前设置
+        //由消费者线程退出前(使用共享调度器时由调用Stop()的线程)调用, 用于等待输出策略的异步写入完成
+        void SetDrainFunc(const std::function<void()>& drain) {
+            std::unique_lock<std::mutex> lock(_m_mtx);
+            _m_drain_func = drain;
+        }
+
+        //阻塞直到调用前写入的数据都已交给回调函数处理完成(被丢弃的数据除外), 已停止时直接返回
+        //不能在回调函数中调用
+        void Barrier() {
+            std::unique_lock<std::mutex> lock(_m_mtx);
+            uint64_t target = _m_ring ? _m_ring->Head() : _m_pushed;
+            ++_m_barrier_waiters;
+            _m_cond_done.wait(lock, [&]() { return _m_done >= target || _m_isStop; });
+            --_m_barrier_waiters;
+        }
+
+        //当前交给回调函数的数据中是否包含urgent写入, 只能在回调函数中调用
+        //无锁模式的环形缓冲区不记录该标记, 始终返回true
+        bool BatchUrgent() const { return _m_batch_urgent; }
+
+        //不安全模式下写入磁盘溢出段的字节数(累计)
+        size_t SpilledBytes() const { return _m_spilled_bytes.load(); }
+
+        //按策略丢弃的记录条数和字节数(累计)
+        size_t DroppedRecords() const { return _m_dropped_records.load(); }
+        size_t DroppedBytes() const { return _m_dropped_bytes.load(); }
+
+        //取出上次调用以来新增的丢弃数量, 只由消费者线程调用, 用于在恢复后输出一条汇总日志
+        bool TakeDropped(size_t *records, size_t *bytes) {
+            size_t r = _m_dropped_records.load();
+            size_t b = _m_dropped_bytes.load();
+            if (r == _m_reported_records) {
+                return false;
+            }
+            *records = r - _m_reported_records;
+            *bytes = b - _m_reported_bytes;
+            _m_reported_records = r;
+            _m_reported_bytes = b;
+            return true;
         }
+
+        //生产者阻塞的最长时间(微秒)和次数: 安全模式下没有空闲缓冲区, 或不安全模式下写溢出段失败后等待溢出数据读回
+        int64_t MaxStallMicros() const { return _m_max_stall_us.load(); }
+        size_t StallCount() const { return _m_stall_count.load(); }
+
         void Stop() {
             _m_isStop = true;
-            //调用消费者处理未处理的数据, 消费者还会按需唤醒生产者(safe mode), 生产者写入完成后还会唤醒消费者处理
-            _m_cond_consumer.notify_all();
-            //_m_cond_productor.notify_all();
-            if(_m_thread.joinable()) {
-                _m_thread.join();
+            if (_m_scheduler){
+                //注销后由调用线程处理剩余数据
+                FlushScheduler::Task *task = nullptr;
+                {
+                    std::unique_lock<std::mutex> lock(_m_mtx);
+                    std::swap(task, _m_task);
+                }
+                if (task != nullptr){
+                    _m_scheduler->Detach(task);
+                }
+                while (ConsumeOnce()) {}
+                RunDrain();
+                _m_cond_productor.notify_all();
+            }
+            else {
+                //调用消费者处理未处理的数据, 消费者还会按需唤醒生产者(safe mode), 生产者写入完成后还会唤醒消费者处理
+                _m_cond_consumer.notify_all();
+                //_m_cond_productor.notify_all();
+                if(_m_thread.joinable()) {
+                    _m_thread.join();
+                }
             }
+            //剩余数据已处理完, 唤醒等待的Barrier()
+            std::unique_lock<std::mutex> lock(_m_mtx);
+            _m_cond_done.notify_all();
         }
 
     private:
-        void ConsumerThreadEntry() {
-            while(1) {
-                {  
-                    // 锁用于处理缓冲区swap, 交换后生产者继续写入数据
-                    std::unique_lock<std::mutex> lock(_m_mtx);
-                    // 有数据时继续, 无数据时阻塞, 等待被生产者唤醒
-                    _m_cond_consumer.wait(lock, [&]() {
-                        return _m_isStop || !_m_buffer_productor.IsEmpty();
-                    });
+        //缓冲池中的缓冲区, 额外记录丢弃整块缓冲区时需要的信息
+        struct PoolBuffer : public Buffer {
+            PoolBuffer() : records(0), lossy(true), urgent(false), seq(0) {}
+            void Recycle() {
+                Reset();
+                records = 0;
+                lossy = true;
+                urgent = false;
+            }
+            size_t records;     // 缓冲区中的记录条数
+            bool lossy;         // 是否只包含允许丢弃的记录, DROP_OLDEST只丢弃这样的缓冲区
+            bool urgent;        // 是否包含urgent写入
+            uint64_t seq;       // 最后一次写入的序号, 处理完成后Barrier()据此判断
+        };
+
+        //安全模式下缓冲池写满时按rule处理, 调用时持有_m_mtx
+        //返回true表示已经可以写入(有空闲缓冲区或当前缓冲区已被换走), false表示本条已被丢弃
+        bool HandleOverflow(std::unique_lock<std::mutex>& lock, size_t len, const OverflowRule& rule, size_t records) {
+            uint32_t timeout_ms = rule.timeout_ms;
+            switch (rule.policy) {
+                case OverflowPolicy::BLOCK:
+                    return WaitForSpace(lock, len, 0);
+                case OverflowPolicy::BLOCK_TIMEOUT:
+                    if (timeout_ms > 0 && WaitForSpace(lock, len, timeout_ms)) {
+                        return true;
+                    }
+                    break;
+                case OverflowPolicy::DROP_NEWEST:
+                    break;
+                case OverflowPolicy::DROP_OLDEST:
+                    for (auto it = _m_full.begin(); it != _m_full.end(); ++it) {
+                        if ((*it)->lossy) {
+                            Drop((*it)->records, (*it)->ReadableSize());
+                            (*it)->Recycle();
+                            _m_free.push_back(*it);
+                            _m_full.erase(it);
+                            return true;
+                        }
+                    }
+                    break;
+                case OverflowPolicy::SAMPLE:
+                    if (rule.sample_rate > 0 && ++_m_sample_seq % rule.sample_rate == 0) {
+                        return WaitForSpace(lock, len, timeout_ms);
+                    }
+                    break;
+            }
+            Drop(records, len);
+            return false;
+        }
+
+        //等待有空闲缓冲区或当前缓冲区足够写入len字节, timeout_ms为0时一直等待, 返回是否等到
+        bool WaitForSpace(std::unique_lock<std::mutex>& lock, size_t len, uint32_t timeout_ms) {
+            auto start = std::chrono::steady_clock::now();
+            auto ready = [&]() {
+                // _m_isStop 或 有空闲缓冲区 或 其他生产者已经换过缓冲区 就继续运行
+                return _m_isStop || !_m_free.empty() || len <= _m_productor->WriteableSize();
+            };
+            bool ok = true;
+            if (timeout_ms == 0) {
+                _m_cond_productor.wait(lock, ready);
+            }
+            else {
+                ok = _m_cond_productor.wait_for(lock, std::chrono::milliseconds(timeout_ms), ready);
+            }
+            RecordStall(std::chrono::steady_clock::now() - start);
+            return ok;
+        }
+
+        //溢出段写入失败时等待消费者读回全部溢出数据(或已停止), 计入生产者阻塞
+        void WaitSpillDrained(std::unique_lock<std::mutex>& lock) {
+            auto start = std::chrono::steady_clock::now();
+            NotifyConsumer();
+            _m_cond_productor.wait(lock, [&]() { return _m_isStop || !_m_spilling; });
+            RecordStall(std::chrono::steady_clock::now() - start);
+        }
+
+        void Drop(size_t records, size_t bytes) {
+            _m_dropped_records += records;
+            _m_dropped_bytes += bytes;
+        }
+
+        //写入len字节是否会使缓冲池占用的内存超过上限, 调用时持有_m_mtx
+        bool OverMemoryLimit(size_t len) {
+            if (_m_memory_limit == 0 || len <= _m_productor->WriteableSize()) {
+                return false;
+            }
+            size_t used = _m_consumer_capacity + _m_productor->CapacityAfter(len);
+            for (auto e : _m_full) {
+                used += e->Capacity();
+            }
+            for (auto e : _m_free) {
+                used += e->Capacity();
+            }
+            return used > _m_memory_limit;
+        }
+
+        void RunDrain() {
+            std::function<void()> drain;
+            {
+                std::unique_lock<std::mutex> lock(_m_mtx);
+                drain = _m_drain_func;
+            }
+            if (drain) {
+                drain();
+            }
+        }
+
+        //通知消费者有新数据, 调用时持有_m_mtx
+        //使用共享调度器时, 只在没有待处理的通知时通知调度器, 避免每次写入都获取调度器的锁
+        void NotifyConsumer() {
+            if (_m_task == nullptr){
+                _m_cond_consumer.notify_one();
+            }
+            else if (!_m_scheduled){
+                _m_scheduled = true;
+                _m_scheduler->Notify(_m_task);
+            }
+        }
+
+        //调度器的I/O线程调用: 处理一块数据, 返回是否还有待处理的数据
+        //没有剩余数据时清除_m_scheduled, 之后的写入会重新通知调度器
+        bool RunScheduled() {
+            ConsumeOnce();
+            std::unique_lock<std::mutex> lock(_m_mtx);
+            if (HasPending()){
+                return true;
+            }
+            _m_scheduled = false;
+            return false;
+        }
+
+        //记录一次生产者阻塞, 调用时持有_m_mtx
+        void RecordStall(std::chrono::steady_clock::duration d) {
+            int64_t us = std::chrono::duration_cast<std::chrono::microseconds>(d).count();
+            if (us > _m_max_stall_us.load()) {
+                _m_max_stall_us.store(us);
+            }
+            ++_m_stall_count;
+        }
+
+        //无锁模式写入: 不获取_m_mtx, 仅在消费者空闲等待时才唤醒它
+        void PushLockFree(const char* data, size_t len) {
+            while (len > 0) {
+                // 超过环形缓冲区单条上限的数据分片写入
+                size_t n = std::min(len, _m_ring->MaxRecord());
+                while (!_m_ring->TryPush(data, n)) {
+                    if (_m_isStop) return;
+                    // 环形缓冲区已满, 唤醒可能在休眠的消费者后让出CPU重试
+                    if (_m_consumer_idle.load(std::memory_order_relaxed)) {
+                        WakeConsumer();
+                    }
+                    std::this_thread::yield();
+                }
+                data += n;
+                len -= n;
+            }
+            // 与消费者置位_m_consumer_idle后的检查配对, 防止丢失唤醒
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            if (_m_consumer_idle.load(std::memory_order_relaxed)) {
+                WakeConsumer();
+            }
+        }
+
+        void WakeConsumer() {
+            std::lock_guard<std::mutex> lock(_m_mtx);
+            _m_cond_consumer.notify_one();
+        }
+
+        //回调函数处理完序号done之前的数据, 唤醒等待的Barrier()
+        void MarkDone(uint64_t done) {
+            std::unique_lock<std::mutex> lock(_m_mtx);
+            _m_done = std::max(_m_done, done);
+            if (_m_barrier_waiters > 0) {
+                _m_cond_done.notify_all();
+            }
+        }
 
-                    //生产者线程空, 且已经停止, 直接结束
-                    if(_m_isStop && _m_buffer_productor.IsEmpty()){
+        //无锁模式消费者: 按顺序取出已提交的记录, 无数据时短暂休眠
+        void ConsumeRing() {
+            Buffer &consumer = *_m_productor;
+            _m_batch_urgent = true;
+            while(1) {
+                if (_m_ring->Drain(consumer) == 0) {
+                    // 停止且所有预留的数据都已消费, 直接结束
+                    if (_m_isStop && _m_ring->IsEmpty()) {
+                        RunDrain();
                         return;
                     }
+                    std::unique_lock<std::mutex> lock(_m_mtx);
+                    _m_consumer_idle.store(true, std::memory_order_relaxed);
+                    std::atomic_thread_fence(std::memory_order_seq_cst);
+                    if (!_m_isStop && !_m_ring->Readable()) {
+                        // 生产者提交后发现消费者空闲会唤醒它, 超时仅作兜底
+                        _m_cond_consumer.wait_for(lock, std::chrono::milliseconds(kIdleWaitMs));
+                    }
+                    _m_consumer_idle.store(false, std::memory_order_relaxed);
+                    continue;
+                }
+                uint64_t done = _m_ring->Tail();
+                _m_callback_func(consumer);
+                consumer.Reset();
+                MarkDone(done);
+            }
+        }
 
-                    _m_buffer_productor.Swap(_m_buffer_consumer);
-                    // 固定容量的缓冲区会阻塞生产者, 现在空间足够, 唤醒生产者继续执行
-                    if (_m_async_type == AsyncType::ASYNC_SAFE){
-                        _m_cond_productor.notify_one();
+        //是否有待消费的数据, 调用时持有_m_mtx
+        bool HasPending() const {
+            return !_m_full.empty() || !_m_productor->IsEmpty() || _m_spilling;
+        }
+
+        //取出一个缓冲区(或一段溢出数据)交给回调函数处理, 调用时不持有_m_mtx, 没有待消费的数据时返回false
+        //同一时刻只有一个调用者: 独立的消费者线程, 调度器的I/O线程或Stop()
+        bool ConsumeOnce() {
+            PoolBuffer *consumer = nullptr;
+            uint64_t spill_end = 0;     // 本次从溢出段读取的终点, 0表示不读取溢出段
+            uint64_t spill_seq = 0;     // 溢出段写到spill_end时的写入序号
+            {
+                // 锁用于取出待消费的缓冲区, 取出后生产者继续写入其他缓冲区
+                std::unique_lock<std::mutex> lock(_m_mtx);
+                if (!HasPending()) {
+                    return false;
+                }
+                // 按写入顺序处理: 写满的缓冲区 -> 当前生产者缓冲区 -> 溢出段
+                // 开始溢出后生产者不再写入缓冲区, 所以缓冲区中的数据都早于溢出段
+                if (!_m_full.empty()) {
+                    consumer = _m_full.front();
+                    _m_full.pop_front();
+                }
+                else if (!_m_productor->IsEmpty()) {
+                    // 没有写满的缓冲区时取走当前生产者缓冲区, 消费者此时未持有缓冲区, 空闲列表一定非空
+                    consumer = _m_productor;
+                    _m_productor = _m_free.back();
+                    _m_free.pop_back();
+                }
+                else {
+                    consumer = _m_free.back();
+                    _m_free.pop_back();
+                    spill_end = _m_spill.WriteOffset();
+                    spill_seq = _m_spill_seq;
+                    consumer->urgent = _m_spill_urgent;
+                }
+                _m_consumer_capacity = consumer->Capacity();
+            }
+            uint64_t done = consumer->seq;
+            if (spill_end > 0) {
+                // 溢出段只读取已完整写入的部分, 不需要持有锁; 读到spill_end后才算完成了spill_seq之前的写入
+                _m_spill.ReadInto(*consumer, spill_end, consumer->WriteableSize());
+                done = _m_spill.ReadOffset() == spill_end ? spill_seq : 0;
+            }
+            if (!consumer->IsEmpty()) {
+                _m_batch_urgent = consumer->urgent;
+                _m_callback_func(*consumer);  // 调用回调函数对消费者缓冲区中数据进行处理
+            }
+            consumer->Recycle();
+            // 不安全模式下扩容过的缓冲区归还内存
+            consumer->Shrink(g_conf_data->buffer_size);
+            bool spill_cleared = false;
+            {
+                std::unique_lock<std::mutex> lock(_m_mtx);
+                _m_free.push_back(consumer);
+                _m_consumer_capacity = 0;
+                if (spill_end > 0 && _m_spill.Drained()) {
+                    _m_spill.Clear();
+                    _m_spilling = false;
+                    _m_spill_urgent = false;
+                    spill_cleared = true;
+                }
+                _m_done = std::max(_m_done, done);
+                if (_m_barrier_waiters > 0) {
+                    _m_cond_done.notify_all();
+                }
+            }
+            // 固定容量的缓冲区会阻塞生产者, 现在有空闲缓冲区, 唤醒生产者继续执行
+            // 不安全模式下溢出段已全部读回, 唤醒因写溢出段失败而等待的生产者
+            if (_m_async_type == AsyncType::ASYNC_SAFE || spill_cleared){
+                _m_cond_productor.notify_all();
+            }
+            return true;
+        }
+
+        void ConsumerThreadEntry() {
+            if (_m_async_type == AsyncType::ASYNC_LOCKFREE) {
+                ConsumeRing();
+                return;
+            }
+            while(1) {
+                {
+                    // 有数据时继续, 无数据时阻塞, 等待被生产者唤醒
+                    std::unique_lock<std::mutex> lock(_m_mtx);
+                    _m_cond_consumer.wait(lock, [&]() { return _m_isStop || HasPending(); });
+                    //生产者缓冲区和溢出段都为空, 且已经停止, 直接结束
+                    if (_m_isStop && !HasPending()) {
+                        break;
                     }
                 }
-                _m_callback_func(_m_buffer_consumer);  // 调用回调函数对消费者缓冲区中数据进行处理
-                _m_buffer_consumer.Reset();
+                ConsumeOnce();
             }
+            RunDrain();
         }
 
     private:
+        enum { kIdleWaitMs = 10 };  // 无锁模式消费者空闲时的最长休眠时间(ms)
+
         AsyncType _m_async_type;
         std::atomic<bool> _m_isStop;  // 用于控制异步工作器的启动
+        std::atomic<bool> _m_consumer_idle;  // 无锁模式下消费者是否处于休眠等待
+        std::atomic<int64_t> _m_max_stall_us;  // 生产者最长阻塞时间(微秒)
+        std::atomic<size_t> _m_stall_count;    // 生产者阻塞次数
+        std::atomic<size_t> _m_dropped_records;  // 按溢出策略丢弃的记录条数
+        std::atomic<size_t> _m_dropped_bytes;    // 按溢出策略丢弃的字节数
+        size_t _m_reported_records;     // 已汇总输出的丢弃条数, 仅消费者线程访问
+        size_t _m_reported_bytes;
+        size_t _m_sample_seq;           // SAMPLE策略的计数, 由_m_mtx保护
         std::mutex _m_mtx;
-        //双缓冲区
-        Chronicle::Buffer _m_buffer_productor;  //生产者缓冲区, 接收外部写入的数据
-        Chronicle::Buffer _m_buffer_consumer;  //消费者缓冲区, 后台线程处理数据
+        //缓冲池, 以下指针都指向_m_buffers中的缓冲区, 由_m_mtx保护
+        std::vector<std::unique_ptr<PoolBuffer>> _m_buffers;
+        PoolBuffer *_m_productor;           //生产者缓冲区, 接收外部写入的数据(无锁模式下作为消费者缓冲区)
+        std::deque<PoolBuffer *> _m_full;   //已写满等待消费者处理的缓冲区
+        std::vector<PoolBuffer *> _m_free;  //空闲缓冲区
         std::condition_variable _m_cond_productor;
         std::condition_variable _m_cond_consumer;
+        //不安全模式的内存上限与磁盘溢出段
+        SpillFile _m_spill;
+        bool _m_spilling;               // 溢出段中是否有尚未读回的数据, 由_m_mtx保护
+        std::atomic<size_t> _m_spilled_bytes;
+        size_t _m_memory_limit;         // 缓冲池内存上限(字节), 0表示不限制
+        size_t _m_consumer_capacity;    // 消费者持有的缓冲区容量, 由_m_mtx保护
+        std::unique_ptr<RingBuffer> _m_ring;  // 无锁模式的环形缓冲区, 其他模式为空
         std::thread _m_thread;
+        //共享调度器, 为空时使用_m_thread
+        FlushScheduler::ptr _m_scheduler;
+        FlushScheduler::Task *_m_task;  // 在调度器中登记的任务, Stop()后为空, 由_m_mtx保护
+        bool _m_scheduled;              // 已通知调度器且尚未处理完, 由_m_mtx保护
+        //Barrier()使用的写入序号, 由_m_mtx保护; 无锁模式下为环形缓冲区的位置
+        uint64_t _m_pushed;             // 最后一次写入的序号
+        uint64_t _m_done;               // 已处理完成的序号
+        uint64_t _m_spill_seq;          // 最后一次写入溢出段的序号
+        bool _m_spill_urgent;           // 溢出段中是否有urgent写入
+        bool _m_batch_urgent;           // 当前批次是否urgent, 仅消费者访问
+        size_t _m_barrier_waiters;      // 正在等待的Barrier()个数
+        std::condition_variable _m_cond_done;
 
         CallBackFunc _m_callback_func;  // 回调函数，用来告知工作器如何落地
+        std::function<void()> _m_drain_func;  // 停止前等待异步写入完成, 由_m_mtx保护
 };
 }  // namespace Chronicle
\ No newline at end of file
@@ -0,0 +1,604 @@
+/*二进制延迟格式化日志: 记录编码、调用点登记表与解码渲染*/
+#pragma once
+#include <cinttypes>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <mutex>
+#include <string>
+#include <type_traits>
+#include <unordered_map>
+#include <vector>
+#include <sys/stat.h>
+
+#include "AsyncBuffer.hpp"
+#include "Format.hpp"
+#include "Level.hpp"
+#include "Message.hpp"
+
+namespace Chronicle {
+    namespace Binary {
+        //二进制记录布局(小端, 与生产者所在机器一致):
+        //  [u32 记录总长度][u32 调用点id][u64 时间戳(微秒)][u64 线程id]
+        //  调用点id != 0: 之后依次为各参数, 类型由登记表中的参数签名给出
+        //      i/u: 8字节整数  d: 8字节double  b/c: 1字节  p: 8字节指针  s: [u32 长度][字节]
+        //  调用点id == 0: printf风格接口产生的文本记录
+        //      [u8 等级][u32 行号][u32 文件名长度][文件名][u32 内容长度][内容]
+        static const size_t kRecordHeader = 24;
+
+        //参数类型标记, 未列出的类型在编译期报错
+        template <typename T, typename Enable = void>
+        struct ArgTag;
+        template <> struct ArgTag<bool> { static const char value = 'b'; };
+        template <> struct ArgTag<char> { static const char value = 'c'; };
+        template <> struct ArgTag<char *> { static const char value = 's'; };
+        template <> struct ArgTag<const char *> { static const char value = 's'; };
+        template <> struct ArgTag<std::string> { static const char value = 's'; };
+        template <typename T>
+        struct ArgTag<T, typename std::enable_if<std::is_integral<T>::value && std::is_signed<T>::value>::type> {
+            static const char value = 'i';
+        };
+        template <typename T>
+        struct ArgTag<T, typename std::enable_if<std::is_integral<T>::value && std::is_unsigned<T>::value>::type> {
+            static const char value = 'u';
+        };
+        template <> struct ArgTag<float> { static const char value = 'f'; };
+        template <typename T>
+        struct ArgTag<T, typename std::enable_if<std::is_floating_point<T>::value && !std::is_same<T, float>::value>::type> {
+            static const char value = 'd';
+        };
+        template <typename T>
+        struct ArgTag<T *> { static const char value = 'p'; };
+        template <typename T>
+        struct ArgTag<const T *> { static const char value = 'p'; };
+
+        //参数签名, 每个参数一个类型标记
+        template <typename... Args>
+        std::string Signature() {
+            const char tags[] = {ArgTag<typename std::decay<Args>::type>::value..., '\0'};
+            return tags;
+        }
+
+        template <typename T>
+        void PutValue(Buffer &buf, T v) {
+            buf.Push(reinterpret_cast<const char *>(&v), sizeof(v));
+        }
+
+        inline void PutString(Buffer &buf, const char *v, size_t len) {
+            PutValue<uint32_t>(buf, static_cast<uint32_t>(len));
+            buf.Push(v, len);
+        }
+
+        //参数编码, 与ArgTag的分类一一对应
+        inline void EncodeArg(Buffer &buf, bool v) { PutValue<uint8_t>(buf, v ? 1 : 0); }
+        inline void EncodeArg(Buffer &buf, char v) { PutValue<char>(buf, v); }
+        inline void EncodeArg(Buffer &buf, const char *v) {
+            if (v == nullptr){
+                v = "(null)";
+            }
+            PutString(buf, v, strlen(v));
+        }
+        inline void EncodeArg(Buffer &buf, char *v) { EncodeArg(buf, static_cast<const char *>(v)); }
+        inline void EncodeArg(Buffer &buf, const std::string &v) { PutString(buf, v.data(), v.size()); }
+        inline void EncodeArg(Buffer &buf, const void *v) {
+            PutValue<uint64_t>(buf, static_cast<uint64_t>(reinterpret_cast<uintptr_t>(v)));
+        }
+        template <typename T>
+        typename std::enable_if<std::is_integral<T>::value && std::is_signed<T>::value>::type
+        EncodeArg(Buffer &buf, T v) { PutValue<int64_t>(buf, static_cast<int64_t>(v)); }
+        template <typename T>
+        typename std::enable_if<std::is_integral<T>::value && std::is_unsigned<T>::value>::type
+        EncodeArg(Buffer &buf, T v) { PutValue<uint64_t>(buf, static_cast<uint64_t>(v)); }
+        template <typename T>
+        typename std::enable_if<std::is_floating_point<T>::value>::type
+        EncodeArg(Buffer &buf, T v) { PutValue<double>(buf, static_cast<double>(v)); }
+        inline void EncodeArg(Buffer &buf, float v) { PutValue<float>(buf, v); }
+
+        inline void EncodeArgs(Buffer &) {}
+        template <typename T, typename... Rest>
+        void EncodeArgs(Buffer &buf, const T &v, const Rest &...rest) {
+            EncodeArg(buf, v);
+            EncodeArgs(buf, rest...);
+        }
+
+        //写入记录头部, 总长度先填0, 由FinishRecord回填
+        inline size_t BeginRecord(Buffer &buf, uint32_t site_id) {
+            size_t start = buf.ReadableSize();
+            PutValue<uint32_t>(buf, 0);
+            PutValue<uint32_t>(buf, site_id);
+            PutValue<int64_t>(buf, Util::Date::NowMicros());
+            PutValue<uint64_t>(buf, LogMessage::ThreadIdHash());
+            return start;
+        }
+
+        //回填从start开始的记录总长度
+        inline void FinishRecord(Buffer &buf, size_t start) {
+            size_t end = buf.ReadableSize();
+            uint32_t len = static_cast<uint32_t>(end - start);
+            memcpy(buf.ReadBegin(end) + start, &len, sizeof(len));
+        }
+
+        //编码一条{}风格的日志, 只写入调用点id、时间戳、线程id和原始参数
+        template <typename... Args>
+        void Encode(Buffer &buf, uint32_t site_id, const Args &...args) {
+            size_t start = BeginRecord(buf, site_id);
+            EncodeArgs(buf, args...);
+            FinishRecord(buf, start);
+        }
+
+        //编码一条printf风格的日志, 内容已在生产者线程格式化为文本
+        template <typename PayloadWriter>
+        void EncodeText(Buffer &buf, LogLevel::value level, const char *file, size_t line,
+                        const PayloadWriter &write_payload) {
+            size_t start = BeginRecord(buf, 0);
+            PutValue<uint8_t>(buf, static_cast<uint8_t>(level));
+            PutValue<uint32_t>(buf, static_cast<uint32_t>(line));
+            PutString(buf, file, strlen(file));
+            size_t text_pos = buf.ReadableSize();
+            PutValue<uint32_t>(buf, 0);
+            write_payload(buf);
+            size_t end = buf.ReadableSize();
+            uint32_t text_len = static_cast<uint32_t>(end - text_pos - sizeof(uint32_t));
+            memcpy(buf.ReadBegin(end) + text_pos, &text_len, sizeof(text_len));
+            FinishRecord(buf, start);
+        }
+
+        //调用点的静态信息
+        struct SiteInfo {
+            LogLevel::value level = LogLevel::value::DEBUG;
+            std::string file;
+            size_t line = 0;
+            std::string format;
+            std::string signature;  // 参数签名, 见ArgTag
+        };
+
+        //调用点表: id -> 调用点信息, 供渲染和解码时查找
+        struct SiteTable {
+            std::unordered_map<uint32_t, SiteInfo> sites;
+            size_t synced = 0;      // 已从登记表同步的调用点个数, 用于增量快照
+            const SiteInfo *Find(uint32_t id) const {
+                auto it = sites.find(id);
+                return it == sites.end() ? nullptr : &it->second;
+            }
+        };
+
+        //进程内调用点登记表(单例)
+        //  调用点首次以二进制模式记录日志时登记, 同时追加写入所有已打开的登记表文件
+        //  id由调用点的等级、文件名、行号、格式串和参数签名哈希得到, 与登记顺序无关, 各次运行保持一致;
+        //  文件输出策略跨运行追加写入, 之前运行写入的二进制记录仍按同一登记表解码
+        //  登记表文件只追加, 不截断; 与文件中已有的不同调用点哈希冲突时顺延到下一个未使用的id
+        //  登记表文件格式(按行, 字符串以"长度:内容"表示):
+        //      CHRONICLE-REGISTRY 1
+        //      logger <len>:<name>
+        //      site <id> <level> <line> <signature|-> <len>:<file> <len>:<format>
+        class Registry {
+        public:
+            static Registry &GetInstance() {
+                static Registry registry;
+                return registry;
+            }
+
+            //登记调用点, 返回其id(非0); 已登记过的调用点直接返回原id
+            uint32_t Register(Fmt::CallSite &site, const std::string &signature) {
+                std::unique_lock<std::mutex> lock(_m_mtx);
+                uint32_t id = site.id.load(std::memory_order_acquire);
+                if (id != 0){
+                    return id;
+                }
+                SiteInfo info;
+                info.level = site.level;
+                info.file = site.file;
+                info.line = site.line;
+                info.format = site.format;
+                info.signature = signature;
+                id = SiteId(info);
+                // 同一调用点可能被多个CallSite对象引用(如头文件中的内联函数), 相同信息复用同一id
+                while (Conflicts(id, info)){
+                    id = id + 1 == 0 ? 1 : id + 1;
+                }
+                if (_m_sites.find(id) == _m_sites.end()){
+                    _m_sites[id] = info;
+                    _m_order.push_back(id);
+                }
+                // 先写入登记表文件, 再发布id, 保证引用该id的记录落盘前登记信息已经落盘
+                for (auto &e : _m_files){
+                    if (e.known.find(id) == e.known.end()){
+                        WriteSite(e.fp, id, info);
+                        fflush(e.fp);
+                        e.known[id] = info;
+                    }
+                }
+                site.id.store(id, std::memory_order_release);
+                return id;
+            }
+
+            //以追加方式打开登记表文件, 写入尚未记录的调用点, 之后新登记的调用点也会追加到该文件
+            //文件已存在时先读取其中的调用点, 不会截断之前运行的登记信息
+            FILE *Attach(const std::string &path, const std::string &logger_name) {
+                Util::File::CreateDirectory(Util::File::Path(path));
+                std::string old_logger;
+                SiteTable old;
+                bool exists = Util::File::Exists(path) && FileSize(path) > 0;
+                if (exists && !Load(path, &old_logger, &old.sites)){
+                    std::cout << __FILE__ << " " << __LINE__ << " registry file " << path
+                              << " is not a chronicle registry, not attached" << std::endl;
+                    return NULL;
+                }
+                FILE *fp = fopen(path.c_str(), "ab");
+                if (fp == NULL){
+                    std::cout << __FILE__ << " " << __LINE__ << " open registry file failed" << std::endl;
+                    perror(NULL);
+                    return NULL;
+                }
+                std::unique_lock<std::mutex> lock(_m_mtx);
+                if (!exists){
+                    fprintf(fp, "CHRONICLE-REGISTRY 1\n");
+                }
+                else if (!EndsWithNewline(path)){
+                    // 上次运行在写入一行时退出, 从新的一行开始
+                    fputc('\n', fp);
+                }
+                if (!exists || old_logger != logger_name){
+                    fprintf(fp, "logger %zu:", logger_name.size());
+                    fwrite(logger_name.data(), 1, logger_name.size(), fp);
+                    fputc('\n', fp);
+                }
+                for (uint32_t id : _m_order){
+                    if (old.sites.find(id) == old.sites.end()){
+                        WriteSite(fp, id, _m_sites[id]);
+                        old.sites[id] = _m_sites[id];
+                    }
+                }
+                fflush(fp);
+                AttachedFile file;
+                file.fp = fp;
+                file.known.swap(old.sites);
+                _m_files.push_back(std::move(file));
+                return fp;
+            }
+
+            void Detach(FILE *fp) {
+                std::unique_lock<std::mutex> lock(_m_mtx);
+                for (auto it = _m_files.begin(); it != _m_files.end(); ++it){
+                    if (it->fp == fp){
+                        fclose(fp);
+                        _m_files.erase(it);
+                        return;
+                    }
+                }
+            }
+
+            //将上次快照之后新登记的调用点加入table
+            void Snapshot(SiteTable &table) {
+                std::unique_lock<std::mutex> lock(_m_mtx);
+                for (size_t i = table.synced; i < _m_order.size(); ++i){
+                    table.sites[_m_order[i]] = _m_sites[_m_order[i]];
+                }
+                table.synced = _m_order.size();
+            }
+
+            //查找单个调用点, 未登记时返回false
+            bool Lookup(uint32_t id, SiteInfo *info) {
+                std::unique_lock<std::mutex> lock(_m_mtx);
+                auto it = _m_sites.find(id);
+                if (it == _m_sites.end()){
+                    return false;
+                }
+                *info = it->second;
+                return true;
+            }
+
+            //读取登记表文件, 用于离线解码和追加前的检查
+            //文件头非法时返回false; 之后无法解析的行(如进程退出时写了一半的行)被跳过
+            static bool Load(const std::string &path, std::string *logger_name,
+                             std::unordered_map<uint32_t, SiteInfo> *sites) {
+                std::string content;
+                Util::File file;
+                if (!Util::File::Exists(path) || !file.GetContent(&content, path)){
+                    return false;
+                }
+                const char *p = content.c_str();
+                const char *end = p + content.size();
+                if (strncmp(p, "CHRONICLE-REGISTRY 1\n", 21) != 0){
+                    return false;
+                }
+                p += 21;
+                while (p < end){
+                    if (!ParseLine(&p, end, logger_name, sites)){
+                        // 跳到下一个以site或logger开头的行
+                        const char *next = p;
+                        while ((next = static_cast<const char *>(memchr(next, '\n', end - next))) != nullptr){
+                            ++next;
+                            if (strncmp(next, "site ", 5) == 0 || strncmp(next, "logger ", 7) == 0){
+                                break;
+                            }
+                        }
+                        p = next == nullptr ? end : next;
+                        continue;
+                    }
+                    // 跳过行尾
+                    if (p < end && *p == '\n'){
+                        ++p;
+                    }
+                }
+                return true;
+            }
+
+        private:
+            Registry() = default;
+
+            //已打开的登记表文件及其中已有的调用点
+            struct AttachedFile {
+                FILE *fp;
+                std::unordered_map<uint32_t, SiteInfo> known;
+            };
+
+            static bool SameSite(const SiteInfo &a, const SiteInfo &b) {
+                return a.level == b.level && a.line == b.line && a.file == b.file && a.format == b.format &&
+                       a.signature == b.signature;
+            }
+
+            //id已被进程内或任一登记表文件中的其他调用点占用
+            bool Conflicts(uint32_t id, const SiteInfo &info) const {
+                auto it = _m_sites.find(id);
+                if (it != _m_sites.end() && !SameSite(it->second, info)){
+                    return true;
+                }
+                for (auto &e : _m_files){
+                    auto k = e.known.find(id);
+                    if (k != e.known.end() && !SameSite(k->second, info)){
+                        return true;
+                    }
+                }
+                return false;
+            }
+
+            //调用点静态信息的FNV-1a哈希, 0保留给printf风格的文本记录
+            static uint32_t SiteId(const SiteInfo &info) {
+                uint32_t h = 2166136261u;
+                auto mix = [&h](const char *data, size_t len) {
+                    for (size_t i = 0; i < len; ++i){
+                        h = (h ^ static_cast<unsigned char>(data[i])) * 16777619u;
+                    }
+                    h = (h ^ 0xFF) * 16777619u;    // 字段分隔
+                };
+                char tmp[32];
+                mix(tmp, snprintf(tmp, sizeof(tmp), "%d:%zu", static_cast<int>(info.level), info.line));
+                mix(info.file.data(), info.file.size());
+                mix(info.format.data(), info.format.size());
+                mix(info.signature.data(), info.signature.size());
+                return h == 0 ? 1 : h;
+            }
+
+            static long FileSize(const std::string &path) {
+                struct stat st;
+                return stat(path.c_str(), &st) == 0 ? static_cast<long>(st.st_size) : 0;
+            }
+
+            static bool EndsWithNewline(const std::string &path) {
+                FILE *fp = fopen(path.c_str(), "rb");
+                if (fp == NULL){
+                    return true;
+                }
+                int c = '\n';
+                if (fseek(fp, -1, SEEK_END) == 0){
+                    c = fgetc(fp);
+                }
+                fclose(fp);
+                return c == '\n';
+            }
+
+            //解析一行logger或site
+            static bool ParseLine(const char **pp, const char *end, std::string *logger_name,
+                                  std::unordered_map<uint32_t, SiteInfo> *sites) {
+                const char *p = *pp;
+                if (strncmp(p, "logger ", 7) == 0){
+                    p += 7;
+                    if (!ReadString(&p, end, logger_name)){
+                        return false;
+                    }
+                }
+                else if (strncmp(p, "site ", 5) == 0){
+                    unsigned id = 0, level = 0;
+                    size_t line = 0;
+                    char sig[256];
+                    int consumed = 0;
+                    if (sscanf(p, "site %u %u %zu %255s %n", &id, &level, &line, sig, &consumed) < 4 || id == 0 ||
+                        consumed == 0){
+                        return false;
+                    }
+                    p += consumed;
+                    SiteInfo info;
+                    info.level = static_cast<LogLevel::value>(level);
+                    info.line = line;
+                    info.signature = (strcmp(sig, "-") == 0) ? "" : sig;
+                    if (!ReadString(&p, end, &info.file) || p >= end || *p++ != ' ' ||
+                        !ReadString(&p, end, &info.format) || (p < end && *p != '\n')){
+                        return false;
+                    }
+                    (*sites)[id] = info;
+                }
+                else{
+                    return false;
+                }
+                *pp = p;
+                return true;
+            }
+
+            static void WriteSite(FILE *fp, uint32_t id, const SiteInfo &info) {
+                fprintf(fp, "site %u %d %zu %s %zu:", id, static_cast<int>(info.level), info.line,
+                        info.signature.empty() ? "-" : info.signature.c_str(), info.file.size());
+                fwrite(info.file.data(), 1, info.file.size(), fp);
+                fprintf(fp, " %zu:", info.format.size());
+                fwrite(info.format.data(), 1, info.format.size(), fp);
+                fputc('\n', fp);
+            }
+
+            //读取"长度:内容"形式的字符串
+            static bool ReadString(const char **p, const char *end, std::string *out) {
+                char *colon = nullptr;
+                size_t len = strtoul(*p, &colon, 10);
+                if (colon == nullptr || colon == *p || colon >= end || *colon != ':' ||
+                    len > static_cast<size_t>(end - colon - 1)){
+                    return false;
+                }
+                out->assign(colon + 1, len);
+                *p = colon + 1 + len;
+                return true;
+            }
+
+        private:
+            std::mutex _m_mtx;
+            std::unordered_map<uint32_t, SiteInfo> _m_sites;    // 进程内已登记的调用点
+            std::vector<uint32_t> _m_order;                     // 登记顺序, 用于增量快照
+            std::vector<AttachedFile> _m_files;                 // 已打开的登记表文件
+        };
+
+        //从二进制记录中顺序读取字段, 越界时标记失败
+        class Reader {
+        public:
+            Reader(const char *data, size_t len) : _m_p(data), _m_end(data + len), _m_ok(true) {}
+            template <typename T>
+            T Get() {
+                T v = T();
+                if (_m_end - _m_p < static_cast<ptrdiff_t>(sizeof(T))){
+                    _m_ok = false;
+                    return v;
+                }
+                memcpy(&v, _m_p, sizeof(T));
+                _m_p += sizeof(T);
+                return v;
+            }
+            //读取[u32 长度][字节], 返回指向内容的指针
+            const char *GetString(size_t *len) {
+                *len = Get<uint32_t>();
+                if (!_m_ok || static_cast<size_t>(_m_end - _m_p) < *len){
+                    _m_ok = false;
+                    *len = 0;
+                    return _m_p;
+                }
+                const char *s = _m_p;
+                _m_p += *len;
+                return s;
+            }
+            bool Ok() const { return _m_ok; }
+
+        private:
+            const char *_m_p;
+            const char *_m_end;
+            bool _m_ok;
+        };
+
+        //渲染文本头部, 与LogMessage::FormatHeader的输出一致
+        inline void RenderHeader(std::string &out, int64_t micros, uint64_t tid, LogLevel::value level,
+                                 const std::string &logger, const char *file, size_t file_len, size_t line,
+                                 TimeFormat time_fmt, TimePrecision time_prec) {
+            char tmp[TimeRender::kMaxLen + 32];
+            out += '[';
+            out.append(tmp, TimeRender::Render(tmp, micros, time_fmt, time_prec));
+            out.append(tmp, snprintf(tmp, sizeof(tmp), "][0x%" PRIx64 "][", tid));
+            out += LogLevel::ToString(level);
+            out += "][";
+            out += logger;
+            out += "][";
+            out.append(file, file_len);
+            out.append(tmp, snprintf(tmp, sizeof(tmp), ":%zu]\t", line));
+        }
+
+        //按签名解码下一个参数并以文本形式追加到out, 与Fmt::WriteArg的输出一致
+        inline void RenderArg(std::string &out, char tag, Reader &reader) {
+            char tmp[32];
+            switch (tag){
+                case 'i':
+                    out.append(tmp, snprintf(tmp, sizeof(tmp), "%" PRId64, reader.Get<int64_t>()));
+                    break;
+                case 'u':
+                    out.append(tmp, snprintf(tmp, sizeof(tmp), "%" PRIu64, reader.Get<uint64_t>()));
+                    break;
+                case 'd':
+                    out.append(tmp, Fmt::FormatFloat(tmp, sizeof(tmp), reader.Get<double>()));
+                    break;
+                case 'f':
+                    out.append(tmp, Fmt::FormatFloat(tmp, sizeof(tmp), reader.Get<float>()));
+                    break;
+                case 'b':
+                    out += reader.Get<uint8_t>() ? "true" : "false";
+                    break;
+                case 'c':
+                    out += reader.Get<char>();
+                    break;
+                case 'p':
+                    out.append(tmp, snprintf(tmp, sizeof(tmp), "%p",
+                        reinterpret_cast<void *>(static_cast<uintptr_t>(reader.Get<uint64_t>()))));
+                    break;
+                case 's': {
+                    size_t len = 0;
+                    const char *s = reader.GetString(&len);
+                    out.append(s, len);
+                    break;
+                }
+                default:
+                    out += "{?}";
+                    break;
+            }
+        }
+
+        //将[data, data + len)中的二进制记录渲染为文本追加到out
+        //lookup(id)返回调用点信息(未知时返回nullptr), 返回完整解析的字节数, 末尾不完整的记录不计入
+        template <typename Lookup>
+        size_t Render(std::string &out, const char *data, size_t len, const Lookup &lookup,
+                      const std::string &logger, TimeFormat time_fmt, TimePrecision time_prec) {
+            size_t pos = 0;
+            while (len - pos >= kRecordHeader){
+                uint32_t rec_len = 0;
+                memcpy(&rec_len, data + pos, sizeof(rec_len));
+                if (rec_len < kRecordHeader || rec_len > len - pos){
+                    break;
+                }
+                Reader reader(data + pos + sizeof(uint32_t), rec_len - sizeof(uint32_t));
+                uint32_t site_id = reader.Get<uint32_t>();
+                int64_t micros = reader.Get<int64_t>();
+                uint64_t tid = reader.Get<uint64_t>();
+                if (site_id == 0){
+                    LogLevel::value level = static_cast<LogLevel::value>(reader.Get<uint8_t>());
+                    size_t line = reader.Get<uint32_t>();
+                    size_t file_len = 0, text_len = 0;
+                    const char *file = reader.GetString(&file_len);
+                    const char *text = reader.GetString(&text_len);
+                    RenderHeader(out, micros, tid, level, logger, file, file_len, line, time_fmt, time_prec);
+                    out.append(text, text_len);
+                }
+                else if (const SiteInfo *site = lookup(site_id)){
+                    RenderHeader(out, micros, tid, site->level, logger, site->file.data(), site->file.size(),
+                                 site->line, time_fmt, time_prec);
+                    const char *fmt = site->format.c_str();
+                    size_t arg = 0;
+                    while (*fmt != '\0'){
+                        if ((fmt[0] == '{' && fmt[1] == '{') || (fmt[0] == '}' && fmt[1] == '}')){
+                            out += fmt[0];
+                            fmt += 2;
+                        }
+                        else if (fmt[0] == '{' && fmt[1] == '}' && arg < site->signature.size()){
+                            RenderArg(out, site->signature[arg++], reader);
+                            fmt += 2;
+                        }
+                        else{
+                            out += *fmt++;
+                        }
+                    }
+                }
+                else{
+                    RenderHeader(out, micros, tid, LogLevel::value::ERROR, logger, "?", 1, 0, time_fmt, time_prec);
+                    char tmp[48];
+                    out.append(tmp, snprintf(tmp, sizeof(tmp), "<unknown call site %u>", site_id));
+                }
+                if (!reader.Ok()){
+                    out += " <truncated record>";
+                }
+                out += '\n';
+                pos += rec_len;
+            }
+            return pos;
+        }
+    } // namespace Binary
+} // namespace Chronicle
@@ -11,16 +11,60 @@ namespace Chronicle {
     }
 
     // 简化用户使用，宏函数默认填上文件吗+行号
+    // XxxFmt为{}占位符风格, 格式串必须是字面量, 占位符数量在编译期检查, 每个调用位置生成一个静态调用点;
+    // 运行期才确定的格式串可用 (logger->InfoFmt)(__FILE__, __LINE__, fmt, args...) 绕过宏调用
+    // 低于CHRONICLE_MIN_LEVEL的等级替换为空函数, 不格式化也不对参数求值
+    #if CHRONICLE_MIN_LEVEL <= CHRONICLE_LEVEL_DEBUG
     #define Debug(fmt, ...) Debug(__FILE__, __LINE__, fmt, ##__VA_ARGS__)
-    #define Info(fmt, ...)  Info(__FILE__, __LINE__, fmt, ##__VA_ARGS__)
-    #define Warn(fmt, ...)  Warn(__FILE__, __LINE__, fmt, ##__VA_ARGS__)
-    #define Error(fmt, ...) Error(__FILE__, __LINE__, fmt, ##__VA_ARGS__)
-    #define Fatal(fmt, ...) Fatal(__FILE__, __LINE__, fmt, ##__VA_ARGS__)
-
-    // 无需获取日志器，默认标准输出
+    #define DebugFmt(fmt, ...) DebugFmt(CHRONICLE_CALL_SITE(DEBUG, fmt, ##__VA_ARGS__), ##__VA_ARGS__)
+    #define DebugKv(msg, ...) DebugKv(__FILE__, __LINE__, msg, ##__VA_ARGS__)
     #define LOG_DEBUG_DEFAULT(fmt, ...) Chronicle::DefaultLogger()->Debug(fmt, ##__VA_ARGS__)
+    #else
+    #define Debug(fmt, ...) Disabled()
+    #define DebugFmt(fmt, ...) Disabled()
+    #define DebugKv(msg, ...) Disabled()
+    #define LOG_DEBUG_DEFAULT(fmt, ...) ((void)0)
+    #endif
+
+    #if CHRONICLE_MIN_LEVEL <= CHRONICLE_LEVEL_INFO
+    #define Info(fmt, ...)  Info(__FILE__, __LINE__, fmt, ##__VA_ARGS__)
+    #define InfoFmt(fmt, ...)  InfoFmt(CHRONICLE_CALL_SITE(INFO, fmt, ##__VA_ARGS__), ##__VA_ARGS__)
+    #define InfoKv(msg, ...)  InfoKv(__FILE__, __LINE__, msg, ##__VA_ARGS__)
     #define LOG_INFO_DEFAULT(fmt, ...)  Chronicle::DefaultLogger()->Info(fmt, ##__VA_ARGS__)
+    #else
+    #define Info(fmt, ...)  Disabled()
+    #define InfoFmt(fmt, ...)  Disabled()
+    #define InfoKv(msg, ...)  Disabled()
+    #define LOG_INFO_DEFAULT(fmt, ...)  ((void)0)
+    #endif
+
+    #if CHRONICLE_MIN_LEVEL <= CHRONICLE_LEVEL_WARN
+    #define Warn(fmt, ...)  Warn(__FILE__, __LINE__, fmt, ##__VA_ARGS__)
+    #define WarnFmt(fmt, ...)  WarnFmt(CHRONICLE_CALL_SITE(WARN, fmt, ##__VA_ARGS__), ##__VA_ARGS__)
+    #define WarnKv(msg, ...)  WarnKv(__FILE__, __LINE__, msg, ##__VA_ARGS__)
     #define LOG_WARN_DEFAULT(fmt, ...)  Chronicle::DefaultLogger()->Warn(fmt, ##__VA_ARGS__)
+    #else
+    #define Warn(fmt, ...)  Disabled()
+    #define WarnFmt(fmt, ...)  Disabled()
+    #define WarnKv(msg, ...)  Disabled()
+    #define LOG_WARN_DEFAULT(fmt, ...)  ((void)0)
+    #endif
+
+    #if CHRONICLE_MIN_LEVEL <= CHRONICLE_LEVEL_ERROR
+    #define Error(fmt, ...) Error(__FILE__, __LINE__, fmt, ##__VA_ARGS__)
+    #define ErrorFmt(fmt, ...) ErrorFmt(CHRONICLE_CALL_SITE(ERROR, fmt, ##__VA_ARGS__), ##__VA_ARGS__)
+    #define ErrorKv(msg, ...) ErrorKv(__FILE__, __LINE__, msg, ##__VA_ARGS__)
     #define LOG_ERROR_DEFAULT(fmt, ...) Chronicle::DefaultLogger()->Error(fmt, ##__VA_ARGS__)
+    #else
+    #define Error(fmt, ...) Disabled()
+    #define ErrorFmt(fmt, ...) Disabled()
+    #define ErrorKv(msg, ...) Disabled()
+    #define LOG_ERROR_DEFAULT(fmt, ...) ((void)0)
+    #endif
+
+    // FATAL不允许在编译期关闭
+    #define Fatal(fmt, ...) Fatal(__FILE__, __LINE__, fmt, ##__VA_ARGS__)
+    #define FatalFmt(fmt, ...) FatalFmt(CHRONICLE_CALL_SITE(FATAL, fmt, ##__VA_ARGS__), ##__VA_ARGS__)
+    #define FatalKv(msg, ...) FatalKv(__FILE__, __LINE__, msg, ##__VA_ARGS__)
     #define LOG_FATAL_DEFAULT(fmt, ...) Chronicle::DefaultLogger()->Fatal(fmt, ##__VA_ARGS__)
 }  // namespace Chronicle
\ No newline at end of file
@@ -0,0 +1,276 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <fcntl.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#ifdef CHRONICLE_WITH_ZLIB
+// gzip压缩需要链接zlib(-lz)
+#include <zlib.h>
+#endif
+#ifdef CHRONICLE_WITH_BUNDLE
+// 与StorageSystem相同的bundle压缩库, 需要链接libbundle
+#include "../../StorageSystem/src/include/bundle.h"
+#endif
+
+namespace Chronicle {
+    //滚动日志关闭后的压缩算法
+    //  GZIP:   zlib的gzip格式, 输出<name>.log.gz, 可直接用zcat查看,
+    //          需要定义CHRONICLE_WITH_ZLIB并链接zlib(-lz), 未定义时不压缩, 保留原文件
+    //  BUNDLE: 使用bundle库的bundle_format算法(如bundle::ZSTD、bundle::LZ4), 输出<name>.log.<算法扩展名>,
+    //          需要定义CHRONICLE_WITH_BUNDLE并链接libbundle, 未定义时按GZIP处理
+    enum class CompressCodec { NONE = 0, GZIP, BUNDLE };
+
+    //压缩配置
+    //  level:              GZIP的压缩级别(1-9)
+    //  bundle_format:      BUNDLE使用的算法编号
+    //  threads:            压缩线程数
+    //  max_bytes_per_sec:  每个压缩线程每秒最多读取的字节数, 0表示不限制
+    struct CompressPolicy {
+        CompressCodec codec = CompressCodec::NONE;
+        int level = 6;
+        unsigned bundle_format = 0;
+        size_t threads = 1;
+        size_t max_bytes_per_sec = 32 * 1024 * 1024;
+        bool Enabled() const { return codec != CompressCodec::NONE; }
+    };
+
+    //滚动日志的后台压缩线程
+    //  输出策略每关闭一个文件调用Add()登记, 压缩线程写入<name>.<ext>.tmp, 落盘后改名为<name>.<ext>并删除原文件
+    //  压缩完成(或失败保留原文件)后以最终的文件名调用done, 用于交给Housekeeper按保留策略管理
+    //  压缩线程以最低CPU优先级(nice 19)和空闲I/O优先级(IOPRIO_CLASS_IDLE)运行, 并按max_bytes_per_sec限速,
+    //  不与消费者线程争抢磁盘带宽; 析构时中止正在压缩的文件, 尚未压缩的文件保持原样
+    class Compressor {
+    public:
+        using DoneFunc = std::function<void(const std::string &)>;
+
+        Compressor(const CompressPolicy &policy, const DoneFunc &done)
+            : _m_policy(policy), _m_done(done), _m_stop(false) {
+            size_t threads = std::max<size_t>(policy.threads, 1);
+            for (size_t i = 0; i < threads; ++i){
+                _m_threads.emplace_back(&Compressor::ThreadEntry, this);
+            }
+        }
+        ~Compressor() {
+            {
+                std::unique_lock<std::mutex> lock(_m_mtx);
+                _m_stop = true;
+            }
+            _m_cond.notify_all();
+            for (auto &t : _m_threads){
+                t.join();
+            }
+        }
+        Compressor(const Compressor&) = delete;
+        Compressor& operator=(const Compressor&) = delete;
+
+        //登记一个已关闭、不再写入的文件
+        void Add(const std::string &filename) {
+            {
+                std::unique_lock<std::mutex> lock(_m_mtx);
+                _m_pending.push_back(filename);
+            }
+            _m_cond.notify_one();
+        }
+
+    private:
+        void ThreadEntry() {
+            SetLowPriority();
+            while (1){
+                std::string filename;
+                {
+                    std::unique_lock<std::mutex> lock(_m_mtx);
+                    _m_cond.wait(lock, [&]() { return _m_stop || !_m_pending.empty(); });
+                    if (_m_stop){
+                        return;
+                    }
+                    filename = _m_pending.front();
+                    _m_pending.pop_front();
+                }
+                std::string out;
+                bool ok = Compress(filename, &out);
+                if (_m_done && !_m_stop){
+                    _m_done(ok ? out : filename);
+                }
+            }
+        }
+
+        //降低当前线程的CPU和I/O优先级, 失败时忽略
+        static void SetLowPriority() {
+            long tid = syscall(SYS_gettid);
+            setpriority(PRIO_PROCESS, static_cast<id_t>(tid), kNice);
+            syscall(SYS_ioprio_set, kIoprioWhoProcess, 0, kIoprioClassIdle << kIoprioClassShift);
+        }
+
+        bool Compress(const std::string &filename, std::string *out) {
+            int in = open(filename.c_str(), O_RDONLY | O_CLOEXEC);
+            if (in == -1){
+                std::cout << __FILE__ << " " << __LINE__ << " open log file failed " << filename << std::endl;
+                perror(NULL);
+                return false;
+            }
+#ifdef CHRONICLE_WITH_BUNDLE
+            bool ok = _m_policy.codec == CompressCodec::BUNDLE ? CompressBundle(in, filename, out)
+                                                               : CompressGzip(in, filename, out);
+#else
+            bool ok = CompressGzip(in, filename, out);
+#endif
+            // 压缩过的原文件不再需要留在页缓存中
+            posix_fadvise(in, 0, 0, POSIX_FADV_DONTNEED);
+            close(in);
+            if (ok && unlink(filename.c_str()) == -1){
+                std::cout << __FILE__ << " " << __LINE__ << " remove log file failed " << filename << std::endl;
+                perror(NULL);
+            }
+            return ok;
+        }
+
+#ifdef CHRONICLE_WITH_ZLIB
+        //逐块读取并写入gzip流, 每块之后按限速等待
+        bool CompressGzip(int in, const std::string &filename, std::string *out) {
+            *out = filename + ".gz";
+            std::string tmp = *out + ".tmp";
+            int fd = OpenOutput(tmp);
+            if (fd == -1){
+                return false;
+            }
+            char mode[8];
+            snprintf(mode, sizeof(mode), "wb%d", std::min(std::max(_m_policy.level, 1), 9));
+            gzFile gz = gzdopen(dup(fd), mode);
+            bool ok = gz != NULL;
+            std::vector<char> buf(kChunkSize);
+            size_t total = 0;
+            auto start = std::chrono::steady_clock::now();
+            while (ok && !_m_stop){
+                ssize_t n = read(in, buf.data(), buf.size());
+                if (n == -1 && errno == EINTR){
+                    continue;
+                }
+                if (n <= 0){
+                    ok = n == 0;
+                    break;
+                }
+                ok = gzwrite(gz, buf.data(), static_cast<unsigned>(n)) == n;
+                total += static_cast<size_t>(n);
+                Throttle(start, total);
+            }
+            if (gz != NULL && gzclose(gz) != Z_OK){
+                ok = false;
+            }
+            return FinishOutput(fd, tmp, *out, ok && !_m_stop);
+        }
+#else
+        //未启用zlib: 不压缩, 原文件保持原样
+        bool CompressGzip(int, const std::string &filename, std::string *) {
+            std::cout << __FILE__ << " " << __LINE__ << " gzip compression needs CHRONICLE_WITH_ZLIB, keep "
+                      << filename << std::endl;
+            return false;
+        }
+#endif
+
+#ifdef CHRONICLE_WITH_BUNDLE
+        //bundle只提供整块压缩, 整个文件读入内存后压缩
+        bool CompressBundle(int in, const std::string &filename, std::string *out) {
+            *out = filename + "." + bundle::ext_of(_m_policy.bundle_format);
+            std::string tmp = *out + ".tmp";
+            std::string content, packed;
+            std::vector<char> buf(kChunkSize);
+            auto start = std::chrono::steady_clock::now();
+            while (!_m_stop){
+                ssize_t n = read(in, buf.data(), buf.size());
+                if (n == -1 && errno == EINTR){
+                    continue;
+                }
+                if (n <= 0){
+                    if (n == -1){
+                        return false;
+                    }
+                    break;
+                }
+                content.append(buf.data(), static_cast<size_t>(n));
+                Throttle(start, content.size());
+            }
+            if (_m_stop || !bundle::pack(_m_policy.bundle_format, packed, content)){
+                return false;
+            }
+            int fd = OpenOutput(tmp);
+            if (fd == -1){
+                return false;
+            }
+            bool ok = true;
+            size_t pos = 0;
+            while (ok && pos < packed.size()){
+                ssize_t n = write(fd, packed.data() + pos, packed.size() - pos);
+                if (n == -1 && errno == EINTR){
+                    continue;
+                }
+                ok = n > 0;
+                pos += ok ? static_cast<size_t>(n) : 0;
+            }
+            return FinishOutput(fd, tmp, *out, ok);
+        }
+#endif
+
+        static int OpenOutput(const std::string &tmp) {
+            int fd = open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+            if (fd == -1){
+                std::cout << __FILE__ << " " << __LINE__ << " open compressed file failed " << tmp << std::endl;
+                perror(NULL);
+            }
+            return fd;
+        }
+
+        //成功时先落盘再改名, 保证删除原文件之前压缩结果已完整写入磁盘; 失败时删除临时文件
+        static bool FinishOutput(int fd, const std::string &tmp, const std::string &out, bool ok) {
+            if (ok && fdatasync(fd) == -1){
+                ok = false;
+            }
+            close(fd);
+            if (ok && rename(tmp.c_str(), out.c_str()) == -1){
+                ok = false;
+            }
+            if (!ok){
+                std::cout << __FILE__ << " " << __LINE__ << " compress log file failed " << out << std::endl;
+                unlink(tmp.c_str());
+            }
+            return ok;
+        }
+
+        //按max_bytes_per_sec限速: 读取total字节至少需要total / max_bytes_per_sec秒
+        void Throttle(std::chrono::steady_clock::time_point start, size_t total) {
+            if (_m_policy.max_bytes_per_sec == 0){
+                return;
+            }
+            auto due = start + std::chrono::microseconds(
+                static_cast<int64_t>(total * 1000000.0 / _m_policy.max_bytes_per_sec));
+            std::unique_lock<std::mutex> lock(_m_mtx);
+            _m_cond.wait_until(lock, due, [&]() { return _m_stop.load(); });
+        }
+
+    private:
+        enum { kChunkSize = 256 * 1024 };  // 每次读取的字节数
+        enum { kNice = 19 };
+        // ioprio_set的参数, glibc没有提供定义
+        enum { kIoprioWhoProcess = 1, kIoprioClassIdle = 3, kIoprioClassShift = 13 };
+
+        CompressPolicy _m_policy;
+        DoneFunc _m_done;
+
+        std::mutex _m_mtx;
+        std::condition_variable _m_cond;
+        std::deque<std::string> _m_pending;   // 等待压缩的文件, 由_m_mtx保护
+        std::atomic<bool> _m_stop;            // 修改时持有_m_mtx, 压缩过程中据此尽早中止
+        std::vector<std::thread> _m_threads;
+    };
+} // namespace Chronicle
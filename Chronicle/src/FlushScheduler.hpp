@@ -0,0 +1,172 @@
+/*共享落盘调度器, 多个日志器的异步工作器共用固定数量的I/O线程落盘*/
+#pragma once
+#include <algorithm>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+namespace Chronicle {
+    //每个异步工作器登记为一个任务, 有数据时通知调度器, 由I/O线程调用任务处理一块数据
+    //  按设备分组: 同一设备的任务由同一个I/O线程连续处理, 写入合并成一段, 多个线程不会同时写同一设备
+    //  公平: 同一设备内按轮转每次只处理每个任务的一块数据, 每个设备最多连续处理kMaxTurns块后让出线程
+    //  Attach()/Detach(): 登记/注销任务, Detach会等待任务正在进行的处理结束
+    //  Notify(): 任务有新数据, 由异步工作器在没有待处理通知时调用
+    class FlushScheduler {
+    public:
+        using ptr = std::shared_ptr<FlushScheduler>;
+        // 处理一块数据, 返回是否还有待处理的数据
+        using Job = std::function<bool()>;
+
+        struct Task {
+            Task(const Job &j, uint64_t dev)
+                : job(j), device(dev), queued(false), running(false), pending(false) {}
+            Job job;
+            uint64_t device;
+            bool queued;    // 是否在设备的就绪队列中
+            bool running;   // 是否正在被I/O线程处理
+            bool pending;   // 处理期间收到的新通知
+        };
+
+        explicit FlushScheduler(size_t threads) : _m_stop(false) {
+            threads = std::max<size_t>(threads, 1);
+            for (size_t i = 0; i < threads; ++i){
+                _m_threads.emplace_back(&FlushScheduler::ThreadEntry, this);
+            }
+        }
+        ~FlushScheduler() {
+            {
+                std::unique_lock<std::mutex> lock(_m_mtx);
+                _m_stop = true;
+            }
+            _m_cond.notify_all();
+            for (auto &t : _m_threads){
+                t.join();
+            }
+        }
+        FlushScheduler(const FlushScheduler&) = delete;
+        FlushScheduler& operator=(const FlushScheduler&) = delete;
+
+        size_t Threads() const { return _m_threads.size(); }
+
+        // 由LoggerManager::SetSharedFlush配置的全局调度器, 之后创建的日志器默认使用
+        // 为空时每个日志器的异步工作器使用独立的消费者线程
+        static ptr Shared() {
+            std::lock_guard<std::mutex> lock(SharedMutex());
+            return SharedInstance();
+        }
+        static void SetShared(const ptr &scheduler) {
+            std::lock_guard<std::mutex> lock(SharedMutex());
+            SharedInstance() = scheduler;
+        }
+
+        // device: 任务输出所在的设备, 0表示未知(如标准输出), 这类任务归为同一组
+        Task *Attach(const Job &job, uint64_t device) {
+            return new Task(job, device);
+        }
+
+        // 注销后不再调用任务, 返回后可以释放任务引用的对象
+        void Detach(Task *task) {
+            std::unique_lock<std::mutex> lock(_m_mtx);
+            _m_idle.wait(lock, [&]() { return !task->running; });
+            if (task->queued){
+                Device &dev = _m_devices[task->device];
+                dev.ready.erase(std::find(dev.ready.begin(), dev.ready.end(), task));
+                if (dev.ready.empty() && !dev.busy){
+                    _m_ready.erase(std::find(_m_ready.begin(), _m_ready.end(), task->device));
+                }
+            }
+            delete task;
+        }
+
+        void Notify(Task *task) {
+            std::unique_lock<std::mutex> lock(_m_mtx);
+            if (task->running){
+                task->pending = true;
+            }
+            else if (!task->queued){
+                Enqueue(task);
+            }
+        }
+
+    private:
+        struct Device {
+            Device() : busy(false) {}
+            std::deque<Task *> ready;   // 就绪的任务, 按轮转顺序
+            bool busy;                  // 是否有I/O线程正在处理该设备
+        };
+
+        // 加入设备的就绪队列, 调用时持有_m_mtx
+        // 不变式: 设备在_m_ready中 <=> 设备空闲且有就绪任务
+        void Enqueue(Task *task) {
+            Device &dev = _m_devices[task->device];
+            task->queued = true;
+            dev.ready.push_back(task);
+            if (!dev.busy && dev.ready.size() == 1){
+                _m_ready.push_back(task->device);
+                _m_cond.notify_one();
+            }
+        }
+
+        void ThreadEntry() {
+            std::unique_lock<std::mutex> lock(_m_mtx);
+            while (1){
+                _m_cond.wait(lock, [&]() { return _m_stop || !_m_ready.empty(); });
+                if (_m_ready.empty()){
+                    return;     // 已停止且没有就绪任务
+                }
+                uint64_t id = _m_ready.front();
+                _m_ready.pop_front();
+                Device &dev = _m_devices[id];
+                dev.busy = true;
+                for (size_t turns = 0; !dev.ready.empty() && turns < kMaxTurns; ++turns){
+                    Task *task = dev.ready.front();
+                    dev.ready.pop_front();
+                    task->queued = false;
+                    task->running = true;
+                    lock.unlock();
+                    bool more = task->job();
+                    lock.lock();
+                    task->running = false;
+                    if (more || task->pending){
+                        task->pending = false;
+                        task->queued = true;
+                        dev.ready.push_back(task);
+                    }
+                    _m_idle.notify_all();
+                }
+                dev.busy = false;
+                // 达到连续处理上限时让出, 其他设备的任务先得到服务
+                if (!dev.ready.empty()){
+                    _m_ready.push_back(id);
+                    _m_cond.notify_one();
+                }
+            }
+        }
+
+        static ptr &SharedInstance() {
+            static ptr instance;
+            return instance;
+        }
+        static std::mutex &SharedMutex() {
+            static std::mutex mtx;
+            return mtx;
+        }
+
+    private:
+        enum { kMaxTurns = 64 };    // 一个I/O线程连续处理同一设备的最多块数
+
+        std::mutex _m_mtx;
+        std::condition_variable _m_cond;    // 有就绪设备或停止
+        std::condition_variable _m_idle;    // 任务处理结束, Detach等待
+        bool _m_stop;
+        std::unordered_map<uint64_t, Device> _m_devices;
+        std::deque<uint64_t> _m_ready;      // 空闲且有就绪任务的设备
+        std::vector<std::thread> _m_threads;
+    };
+} // namespace Chronicle
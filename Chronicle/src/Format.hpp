@@ -0,0 +1,229 @@
+/*类型安全的{}占位符格式化, 供InfoFmt等模板接口使用*/
+#pragma once
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <type_traits>
+
+#include "AsyncBuffer.hpp"
+#include "Level.hpp"
+
+namespace Chronicle {
+    namespace Fmt {
+        //格式串语法: {} 为占位符, {{ 和 }} 分别输出 { 和 }, 其余单独出现的 { 或 } 视为非法
+        static constexpr size_t kBadFormat = static_cast<size_t>(-1);
+
+        //编译期统计占位符的辅助函数, 递归深度为格式串长度的对数, 很长的格式串也不会超过编译器的constexpr递归深度限制
+        //  分段扫描的结果编码为一个整数: 占位符数量 * 4 + 标志位, 格式串非法时为kBadFormat
+        //  kScanEnd: 段内遇到了结尾的'\0'; kScanCarry: 段内最后一个字符与下一段第一个字符组成{{、}}或{}
+        static constexpr size_t kScanEnd = 1;
+        static constexpr size_t kScanCarry = 2;
+
+        constexpr size_t ScanChar(const char *s) {
+            return s[0] == '\0' ? kScanEnd
+                 : s[0] == '{' ? (s[1] == '{' ? kScanCarry : s[1] == '}' ? 4 + kScanCarry : kBadFormat)
+                 : s[0] == '}' ? (s[1] == '}' ? kScanCarry : kBadFormat)
+                 : 0;
+        }
+
+        constexpr size_t ScanRange(const char *s, size_t len, bool skip);
+
+        //合并前后两段的结果: 前段已结束或非法时直接返回, 不读取后段
+        constexpr size_t ScanJoin(size_t left, size_t right) {
+            return right == kBadFormat ? kBadFormat : (left & ~(kScanEnd | kScanCarry)) + right;
+        }
+        constexpr size_t ScanSplit(size_t left, const char *s, size_t len, size_t half) {
+            return left == kBadFormat || (left & kScanEnd) ? left
+                 : ScanJoin(left, ScanRange(s + half, len - half, (left & kScanCarry) != 0));
+        }
+
+        //扫描s的前len个字符(遇到'\0'即停止), skip为true时第一个字符已作为上一段{{、}}或{}的后半部分处理过
+        constexpr size_t ScanRange(const char *s, size_t len, bool skip) {
+            return len == 1 ? (skip ? 0 : ScanChar(s))
+                 : ScanSplit(ScanRange(s, len / 2, skip), s, len, len / 2);
+        }
+
+        //按1、2、4、8...个字符的段依次扫描, 不需要预先知道格式串长度
+        constexpr size_t ScanFrom(const char *s, size_t len, size_t n, bool skip);
+        constexpr size_t ScanNext(size_t r, const char *s, size_t len, size_t n) {
+            return r == kBadFormat ? kBadFormat
+                 : (r & kScanEnd) ? n + r / 4
+                 : ScanFrom(s + len, len * 2, n + r / 4, (r & kScanCarry) != 0);
+        }
+        constexpr size_t ScanFrom(const char *s, size_t len, size_t n, bool skip) {
+            return ScanNext(ScanRange(s, len, skip), s, len, n);
+        }
+
+        //编译期统计占位符数量, 格式串非法时返回kBadFormat
+        constexpr size_t CountPlaceholders(const char *s) {
+            return ScanFrom(s, 1, 0, false);
+        }
+
+        //只用于在不求值的sizeof中统计参数个数: sizeof(ArgCounter(args...)) - 1
+        template <typename... Args>
+        char (&ArgCounter(const Args &...))[sizeof...(Args) + 1];
+
+        //实例化时检查占位符数量与参数个数是否一致, Check原样返回格式串
+        template <bool Match>
+        struct FormatCheck {
+            static_assert(Match, "Chronicle: format string is malformed or placeholder count does not match arguments");
+            static const char *Check(const char *fmt) { return fmt; }
+        };
+
+        //日志调用点, 由XxxFmt宏在每个调用位置生成一个静态实例
+        //二进制模式下只记录调用点id, 文件名、行号、格式串等静态信息写入调用点登记表
+        struct CallSite {
+            CallSite(LogLevel::value lv, const char *f, size_t l, const char *fmt)
+                : level(lv), file(f), line(l), format(fmt), id(0) {}
+            CallSite(const CallSite &) = delete;
+            CallSite &operator=(const CallSite &) = delete;
+
+            LogLevel::value level;
+            const char *file;
+            size_t line;
+            const char *format;
+            std::atomic<uint32_t> id;   // 二进制模式下的调用点id, 0表示尚未登记
+        };
+
+        //写入单个参数, 不支持的类型在编译期报错
+        inline void WriteArg(Buffer &buf, const char *v) {
+            if (v == nullptr){
+                v = "(null)";
+            }
+            buf.Push(v, strlen(v));
+        }
+        inline void WriteArg(Buffer &buf, char *v) { WriteArg(buf, static_cast<const char *>(v)); }
+        inline void WriteArg(Buffer &buf, const std::string &v) { buf.Push(v.data(), v.size()); }
+        inline void WriteArg(Buffer &buf, char v) { buf.Push(&v, 1); }
+        inline void WriteArg(Buffer &buf, bool v) {
+            if (v){
+                buf.Push("true", 4);
+            }
+            else{
+                buf.Push("false", 5);
+            }
+        }
+
+        template <typename T>
+        bool IsNegative(T v, std::true_type) { return v < 0; }
+        template <typename T>
+        bool IsNegative(T, std::false_type) { return false; }
+
+        //整数: 从低位向高位写入临时数组, 再一次性拷贝
+        template <typename T>
+        typename std::enable_if<std::is_integral<T>::value>::type
+        WriteArg(Buffer &buf, T v) {
+            typedef typename std::make_unsigned<T>::type U;
+            char tmp[24];
+            char *end = tmp + sizeof(tmp);
+            char *p = end;
+            bool negative = IsNegative(v, std::is_signed<T>());
+            //先转为无符号再取反, 避免最小负数取反溢出
+            U u = static_cast<U>(v);
+            if (negative){
+                u = static_cast<U>(0 - u);
+            }
+            do {
+                *--p = static_cast<char>('0' + u % 10);
+                u /= 10;
+            } while (u != 0);
+            if (negative){
+                *--p = '-';
+            }
+            buf.Push(p, end - p);
+        }
+
+        // 浮点数的最短往返表示: 从15位有效数字起逐位增加, 直到读回的值与原值相等(double最多17位),
+        // 如0.1输出0.1, 1.0/3输出0.3333333333333333; nan/inf原样输出
+        inline int FormatFloat(char *p, size_t n, double v) {
+            int r = 0;
+            for (int digits = 15; digits <= 17; ++digits){
+                r = snprintf(p, n, "%.*g", digits, v);
+                if (!std::isfinite(v) || strtod(p, nullptr) == v){
+                    break;
+                }
+            }
+            return r;
+        }
+        // float按float的精度往返(最多9位), 0.1f输出0.1而不是0.100000001490116
+        inline int FormatFloat(char *p, size_t n, float v) {
+            int r = 0;
+            for (int digits = 6; digits <= 9; ++digits){
+                r = snprintf(p, n, "%.*g", digits, static_cast<double>(v));
+                if (!std::isfinite(v) || strtof(p, nullptr) == v){
+                    break;
+                }
+            }
+            return r;
+        }
+
+        template <typename T>
+        typename std::enable_if<std::is_floating_point<T>::value>::type
+        WriteArg(Buffer &buf, T v) {
+            char *p = buf.Reserve(32);
+            int r = std::is_same<T, float>::value ? FormatFloat(p, 32, static_cast<float>(v))
+                                                  : FormatFloat(p, 32, static_cast<double>(v));
+            buf.Commit(r > 0 ? static_cast<size_t>(r) : 0);
+        }
+
+        inline void WriteArg(Buffer &buf, const void *v) {
+            char *p = buf.Reserve(24);
+            int r = snprintf(p, 24, "%p", v);
+            buf.Commit(r > 0 ? static_cast<size_t>(r) : 0);
+        }
+
+        //拷贝字面文本直到下一个占位符, 返回占位符位置(或结尾'\0'), 同时处理{{和}}转义
+        inline const char *CopyLiteral(Buffer &buf, const char *fmt) {
+            const char *begin = fmt;
+            for (;;){
+                char c = *fmt;
+                if (c == '\0' || (c == '{' && fmt[1] == '}')){
+                    buf.Push(begin, fmt - begin);
+                    return fmt;
+                }
+                if ((c == '{' && fmt[1] == '{') || (c == '}' && fmt[1] == '}')){
+                    buf.Push(begin, fmt - begin + 1);
+                    fmt += 2;
+                    begin = fmt;
+                    continue;
+                }
+                ++fmt;
+            }
+        }
+
+        //按格式串依次写入参数, 参数多于占位符时忽略多余参数, 少于占位符时剩余的{}原样输出
+        inline void FormatTo(Buffer &buf, const char *fmt) {
+            while (*(fmt = CopyLiteral(buf, fmt)) != '\0'){
+                buf.Push(fmt, 2);
+                fmt += 2;
+            }
+        }
+
+        template <typename T, typename... Rest>
+        void FormatTo(Buffer &buf, const char *fmt, const T &v, const Rest &...rest) {
+            fmt = CopyLiteral(buf, fmt);
+            if (*fmt == '\0'){
+                return;
+            }
+            WriteArg(buf, v);
+            FormatTo(buf, fmt + 2, rest...);
+        }
+    } // namespace Fmt
+} // namespace Chronicle
+
+//编译期检查格式串: 占位符数量必须与参数个数一致, 参数只出现在不求值的sizeof中
+#define CHRONICLE_FMT(fmt, ...)                                                   \
+    Chronicle::Fmt::FormatCheck<Chronicle::Fmt::CountPlaceholders(fmt) ==       \
+                                sizeof(Chronicle::Fmt::ArgCounter(__VA_ARGS__)) - 1>::Check(fmt)
+
+//在调用位置生成静态的调用点对象(只在首次执行时初始化), 同时完成格式串检查
+#define CHRONICLE_CALL_SITE(level, fmt, ...)                                                  \
+    ([]() -> Chronicle::Fmt::CallSite & {                                                    \
+        static Chronicle::Fmt::CallSite site(Chronicle::LogLevel::value::level, __FILE__, __LINE__, \
+                                             CHRONICLE_FMT(fmt, ##__VA_ARGS__));             \
+        return site;                                                                         \
+    }())
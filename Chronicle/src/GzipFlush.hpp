@@ -0,0 +1,169 @@
+#pragma once
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+#include <zlib.h>
+
+#include "GzipFrames.hpp"
+#include "LogFlush.hpp"
+
+extern Chronicle::Util::JsonData* g_conf_data;
+namespace Chronicle {
+    //日志在消费者线程上压缩后写入文件, 用CPU换磁盘带宽, 适合磁盘是瓶颈的机器
+    //  每次Flush(一批日志)压缩为一个独立的gzip成员(帧)并用一次write写入, 文件是多个gzip成员的拼接:
+    //  - 整个文件可直接用zcat/zgrep查看
+    //  - 每帧独立解码, 进程崩溃最多丢失正在写入的最后一帧
+    //  - 打开已有文件时先扫描全部帧, 把崩溃残留的半帧截断后再追加, 否则之后追加的帧无法越过它解码
+    //  - 仍在写入的文件可用tools/chronicle-zcat -f跟随输出, 只输出已完整写入的帧
+    //  level为zlib压缩级别, 默认1(最快); 批次很小时帧头和压缩字典重新开始使压缩率下降
+    //  flush_log == 2: 每帧写入后fsync
+    //  需要链接zlib(-lz); 定义CHRONICLE_WITH_ZLIB时由AsyncLogger.hpp引入, 否则直接包含本头文件
+    class GzipFileFlush : public LogFlush {
+    public:
+        using ptr = std::shared_ptr<GzipFileFlush>;
+        GzipFileFlush(const std::string &filename, int level = kDefaultLevel)
+            : _m_filename(filename), _m_raw_bytes(0), _m_compressed_bytes(0) {
+            Util::File::CreateDirectory(Util::File::Path(filename));
+            TruncateTornFrame(filename);
+            _m_fd = OpenAppend(filename);
+            memset(&_m_zs, 0, sizeof(_m_zs));
+            // windowBits + 16: 输出gzip头和尾
+            _m_zs_ready = deflateInit2(&_m_zs, level, Z_DEFLATED, MAX_WBITS + 16, kMemLevel, Z_DEFAULT_STRATEGY) == Z_OK;
+            if (!_m_zs_ready){
+                std::cout << __FILE__ << " " << __LINE__ << " deflateInit2 failed" << std::endl;
+            }
+        }
+        ~GzipFileFlush() {
+            if (_m_zs_ready){
+                deflateEnd(&_m_zs);
+            }
+            if (_m_fd != -1){
+                close(_m_fd);
+            }
+        }
+        GzipFileFlush(const GzipFileFlush&) = delete;
+        GzipFileFlush& operator=(const GzipFileFlush&) = delete;
+
+        void Flush(const char *data, size_t len) override {
+            struct iovec iov = { const_cast<char *>(data), len };
+            FlushV(&iov, 1);
+        }
+
+        // 多块数据压缩为同一帧
+        void FlushV(const struct iovec *iov, int iovcnt) override {
+            if (_m_fd == -1 || !_m_zs_ready){
+                return;
+            }
+            size_t total = 0;
+            for (int i = 0; i < iovcnt; ++i){
+                total += iov[i].iov_len;
+            }
+            if (total == 0){
+                return;
+            }
+            size_t len = Compress(iov, iovcnt, total);
+            if (len == 0){
+                return;
+            }
+            struct iovec out = { _m_out.data(), len };
+            WriteFull(_m_fd, &out, 1);
+            _m_raw_bytes += total;
+            _m_compressed_bytes += len;
+            if (FlushLog() == 2){
+                SyncFd(_m_fd, SyncLevel::FULL);
+            }
+        }
+
+        void Sync(SyncLevel level) override {
+            if (_m_fd != -1){
+                SyncFd(_m_fd, level);
+            }
+        }
+        int DupFd() override { return _m_fd == -1 ? -1 : fcntl(_m_fd, F_DUPFD_CLOEXEC, 0); }
+
+        uint64_t Device() const override { return DeviceOf(_m_filename); }
+
+        // 累计写入的原始字节数与压缩后字节数, 只在调用Flush的线程读取
+        uint64_t RawBytes() const { return _m_raw_bytes; }
+        uint64_t CompressedBytes() const { return _m_compressed_bytes; }
+
+    private:
+        // 截断文件末尾不完整的帧: 从最后一个完整帧的结尾到文件末尾的数据以gzip头开始时才截断,
+        // 不是本策略写入的文件保持原样
+        static void TruncateTornFrame(const std::string &filename) {
+            int fd = open(filename.c_str(), O_RDWR | O_CLOEXEC);
+            if (fd == -1){
+                return;
+            }
+            GzipFrameDecoder decoder;
+            uint64_t good = 0, total = 0;
+            std::vector<char> buf(256 * 1024);
+            ssize_t n;
+            while ((n = read(fd, buf.data(), buf.size())) > 0){
+                total += static_cast<uint64_t>(n);
+                decoder.Feed(buf.data(), static_cast<size_t>(n), [&good](const char *, size_t, uint64_t end) {
+                    good = end;
+                });
+            }
+            decoder.Finish([&good](const char *, size_t, uint64_t end) {
+                good = end;
+            });
+            char head[3];
+            ssize_t head_len = n == 0 && good < total ? pread(fd, head, sizeof(head), static_cast<off_t>(good)) : 0;
+            if (head_len > 0 && GzipFrameDecoder::IsFrameStart(head, static_cast<size_t>(head_len))){
+                std::cout << __FILE__ << " " << __LINE__ << " truncate " << total - good
+                          << " bytes of an incomplete frame in " << filename << std::endl;
+                if (ftruncate(fd, static_cast<off_t>(good)) == -1){
+                    perror(NULL);
+                }
+            }
+            close(fd);
+        }
+
+        // 把iov压缩为一个完整的gzip成员写入_m_out, 返回长度, 失败返回0
+        size_t Compress(const struct iovec *iov, int iovcnt, size_t total) {
+            deflateReset(&_m_zs);
+            size_t bound = deflateBound(&_m_zs, total);
+            if (_m_out.size() < bound){
+                _m_out.resize(bound);
+            }
+            size_t pos = 0;
+            for (int i = 0; i < iovcnt; ++i){
+                int flush = i + 1 == iovcnt ? Z_FINISH : Z_NO_FLUSH;
+                _m_zs.next_in = static_cast<Bytef *>(iov[i].iov_base);
+                _m_zs.avail_in = static_cast<uInt>(iov[i].iov_len);
+                int ret = Z_OK;
+                do {
+                    // deflateBound按整段数据计算, 分块输入时保险起见仍检查输出空间
+                    if (_m_out.size() - pos < kMinOutSpace){
+                        _m_out.resize(_m_out.size() * 2 + kMinOutSpace);
+                    }
+                    _m_zs.next_out = reinterpret_cast<Bytef *>(_m_out.data() + pos);
+                    _m_zs.avail_out = static_cast<uInt>(_m_out.size() - pos);
+                    ret = deflate(&_m_zs, flush);
+                    pos = _m_out.size() - _m_zs.avail_out;
+                    if (ret == Z_STREAM_ERROR){
+                        std::cout << __FILE__ << " " << __LINE__ << " deflate failed" << std::endl;
+                        return 0;
+                    }
+                } while (_m_zs.avail_in > 0 || (flush == Z_FINISH && ret != Z_STREAM_END));
+            }
+            return pos;
+        }
+
+    private:
+        enum { kDefaultLevel = 1 };                 // 默认压缩级别, 最快
+        enum { kMemLevel = 8 };                     // zlib默认的内部状态内存级别
+        static const size_t kMinOutSpace = 4096;    // 每次调用deflate前至少保留的输出空间
+
+        std::string _m_filename;
+        int _m_fd = -1;
+        z_stream _m_zs;
+        bool _m_zs_ready;
+        std::vector<char> _m_out;       // 压缩输出, 复用容量
+        uint64_t _m_raw_bytes;
+        uint64_t _m_compressed_bytes;
+    };
+} // namespace Chronicle
@@ -0,0 +1,131 @@
+/*压缩帧解码: GzipFileFlush写入的文件是多个gzip成员(帧)的拼接, 逐帧解码并能越过损坏的数据*/
+#pragma once
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <zlib.h>
+
+namespace Chronicle {
+    //逐帧解码多个gzip成员的拼接, 输入可以分多次追加
+    //  每解码完一个完整的帧调用一次on_frame(内容, 长度, 该帧在输入中的结束偏移)
+    //  遇到损坏的数据(如进程崩溃残留的半帧之后又追加了新帧)时丢弃当前帧,
+    //  从下一个gzip头(1f 8b 08)处重新开始解码, 跳过的字节数计入Skipped()
+    //  只依赖zlib, 供GzipFileFlush和tools/chronicle-zcat共用
+    class GzipFrameDecoder {
+    public:
+        GzipFrameDecoder() : _m_ready(false), _m_fed(0), _m_base(0), _m_skipped(0) {
+            memset(&_m_zs, 0, sizeof(_m_zs));
+            // windowBits + 16: 只接受gzip格式
+            _m_ready = inflateInit2(&_m_zs, MAX_WBITS + 16) == Z_OK;
+        }
+        ~GzipFrameDecoder() {
+            if (_m_ready){
+                inflateEnd(&_m_zs);
+            }
+        }
+        GzipFrameDecoder(const GzipFrameDecoder&) = delete;
+        GzipFrameDecoder& operator=(const GzipFrameDecoder&) = delete;
+
+        bool Ready() const { return _m_ready; }
+
+        template <typename OnFrame>
+        void Feed(const char *data, size_t len, const OnFrame &on_frame) {
+            if (!_m_ready){
+                return;
+            }
+            _m_raw.append(data, len);
+            char out[64 * 1024];
+            bool more = _m_fed < _m_raw.size();
+            while (more){
+                _m_zs.next_in = reinterpret_cast<Bytef *>(const_cast<char *>(_m_raw.data() + _m_fed));
+                _m_zs.avail_in = static_cast<uInt>(_m_raw.size() - _m_fed);
+                _m_zs.next_out = reinterpret_cast<Bytef *>(out);
+                _m_zs.avail_out = sizeof(out);
+                int ret = inflate(&_m_zs, Z_NO_FLUSH);
+                size_t produced = sizeof(out) - _m_zs.avail_out;
+                size_t fed = _m_raw.size() - _m_zs.avail_in;
+                _m_frame.append(out, produced);
+                bool stalled = produced == 0 && fed == _m_fed && fed < _m_raw.size();
+                _m_fed = fed;
+                if (ret == Z_STREAM_END){
+                    // 一帧结束, 从下一个gzip成员开始
+                    on_frame(_m_frame.data(), _m_frame.size(), _m_base + _m_fed);
+                    _m_frame.clear();
+                    inflateReset(&_m_zs);
+                    Drop(_m_fed);
+                }
+                else if ((ret != Z_OK && ret != Z_BUF_ERROR) || stalled){
+                    Resync();
+                }
+                // 输出空间用满时inflate内部可能还有未输出的数据, 即使输入已读完也要再调用一次
+                more = _m_fed < _m_raw.size() || produced == sizeof(out);
+            }
+        }
+
+        //输入已结束时调用: 未完整的帧之后如果还有gzip头, 说明该帧已损坏(如崩溃残留的半帧之后又追加了新帧),
+        //inflate会把之后的帧当作它的后续数据而不报错, 此时丢弃该帧, 从下一个gzip头重新解码
+        template <typename OnFrame>
+        void Finish(const OnFrame &on_frame) {
+            while (!_m_raw.empty()){
+                size_t next = NextFrame();
+                if (next == _m_raw.size()){
+                    return;
+                }
+                std::string rest = _m_raw.substr(next);
+                Skip(next);
+                _m_raw.clear();
+                Feed(rest.data(), rest.size(), on_frame);
+            }
+        }
+
+        //当前未完整的帧已读入的压缩字节数
+        size_t Pending() const { return _m_raw.size(); }
+        //因数据损坏跳过的字节数
+        uint64_t Skipped() const { return _m_skipped; }
+
+        //data是否可能是一个gzip头的开始(长度不足3字节时比较前缀)
+        static bool IsFrameStart(const char *data, size_t len) {
+            // gzip头: ID1 ID2 CM(deflate)
+            static const char kMagic[3] = { '\x1f', '\x8b', '\x08' };
+            return memcmp(data, kMagic, len < sizeof(kMagic) ? len : sizeof(kMagic)) == 0;
+        }
+
+    private:
+        //当前帧起点之后下一个gzip头的位置, 没有时返回_m_raw.size()
+        size_t NextFrame() const {
+            for (size_t i = 1; i < _m_raw.size(); ++i){
+                if (IsFrameStart(&_m_raw[i], _m_raw.size() - i)){
+                    return i;
+                }
+            }
+            return _m_raw.size();
+        }
+
+        //丢弃当前帧, 从下一个gzip头处重新开始
+        void Resync() {
+            Skip(NextFrame());
+        }
+
+        void Skip(size_t n) {
+            _m_skipped += n;
+            _m_frame.clear();
+            inflateReset(&_m_zs);
+            Drop(n);
+        }
+
+        void Drop(size_t n) {
+            _m_raw.erase(0, n);
+            _m_base += n;
+            _m_fed = 0;
+        }
+
+    private:
+        z_stream _m_zs;
+        bool _m_ready;
+        std::string _m_raw;     // 当前帧起点之后读入的压缩数据
+        size_t _m_fed;          // _m_raw中已交给inflate的字节数
+        uint64_t _m_base;       // _m_raw[0]在输入中的偏移
+        uint64_t _m_skipped;
+        std::string _m_frame;   // 当前帧已解码的内容, 帧完整后才交给on_frame
+    };
+} // namespace Chronicle
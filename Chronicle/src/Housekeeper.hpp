@@ -0,0 +1,183 @@
+#pragma once
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <ctime>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace Chronicle {
+    //滚动日志的保留策略, 从最旧的文件开始删除, 直到不再违反任一条件, 都为0时不删除
+    //  max_files:          保留的已关闭文件个数(不含正在写入的文件)
+    //  max_age_sec:        最后修改时间早于max_age_sec秒之前的文件被删除
+    //  max_total_bytes:    已关闭文件的总大小上限
+    struct RetentionPolicy {
+        size_t max_files = 0;
+        uint32_t max_age_sec = 0;
+        uint64_t max_total_bytes = 0;
+        bool Enabled() const { return max_files > 0 || max_age_sec > 0 || max_total_bytes > 0; }
+    };
+
+    //滚动日志的后台清理线程
+    //  构造时扫描一次目录, 收集文件名以prefix开头的.log文件及其压缩文件(包括之前运行留下的)
+    //  之后输出策略每关闭一个文件调用Add()登记, 不再扫描目录, 消费者线程只付出一次加锁和通知
+    //  删除在后台线程中执行; 设置max_age_sec时即使没有新文件也每kCheckIntervalSec秒检查一次
+    class Housekeeper {
+    public:
+        Housekeeper(const std::string &prefix, const RetentionPolicy &policy)
+            : _m_prefix(prefix), _m_policy(policy), _m_stop(false) {
+            Scan();
+            _m_thread = std::thread(&Housekeeper::ThreadEntry, this);
+        }
+        ~Housekeeper() {
+            {
+                std::unique_lock<std::mutex> lock(_m_mtx);
+                _m_stop = true;
+            }
+            _m_cond.notify_all();
+            _m_thread.join();
+        }
+        Housekeeper(const Housekeeper&) = delete;
+        Housekeeper& operator=(const Housekeeper&) = delete;
+
+        //登记一个已关闭、不再写入的文件
+        void Add(const std::string &filename) {
+            {
+                std::unique_lock<std::mutex> lock(_m_mtx);
+                _m_added.push_back(filename);
+            }
+            _m_cond.notify_one();
+        }
+
+    private:
+        struct Entry {
+            std::string name;
+            uint64_t size;
+            time_t mtime;
+        };
+
+        //收集目录中已有的日志文件, 只在构造时执行一次
+        void Scan() {
+            std::string::size_type pos = _m_prefix.find_last_of('/');
+            std::string dir = pos == std::string::npos ? "." : _m_prefix.substr(0, pos + 1);
+            std::string base = pos == std::string::npos ? _m_prefix : _m_prefix.substr(pos + 1);
+            std::string head = pos == std::string::npos ? "" : dir;
+            DIR *d = opendir(dir.c_str());
+            if (d == NULL){
+                return;
+            }
+            static const std::string tmp = ".tmp";
+            while (struct dirent *e = readdir(d)){
+                std::string name = e->d_name;
+                // <prefix>...log或压缩后的<prefix>...log.<ext>, 跳过压缩中的临时文件
+                if (name.compare(0, base.size(), base) != 0 || name.find(".log", base.size()) == std::string::npos ||
+                    (name.size() > tmp.size() && name.compare(name.size() - tmp.size(), tmp.size(), tmp) == 0)){
+                    continue;
+                }
+                Entry entry;
+                if (Stat(head + name, &entry)){
+                    _m_files.push_back(entry);
+                }
+            }
+            closedir(d);
+            Sort();
+        }
+
+        static bool Stat(const std::string &filename, Entry *entry) {
+            struct stat st;
+            if (stat(filename.c_str(), &st) == -1 || !S_ISREG(st.st_mode)){
+                return false;
+            }
+            entry->name = filename;
+            entry->size = static_cast<uint64_t>(st.st_size);
+            entry->mtime = st.st_mtime;
+            return true;
+        }
+
+        //按最后修改时间排序, 相同时按文件名(时间戳补零, 字典序即时间顺序)
+        void Sort() {
+            std::sort(_m_files.begin(), _m_files.end(), [](const Entry &a, const Entry &b) {
+                return a.mtime != b.mtime ? a.mtime < b.mtime : a.name < b.name;
+            });
+        }
+
+        //从最旧的文件开始删除违反策略的文件
+        void Enforce() {
+            time_t now = time(nullptr);
+            uint64_t total = 0;
+            for (auto &e : _m_files){
+                total += e.size;
+            }
+            size_t removed = 0;
+            while (removed < _m_files.size()){
+                const Entry &e = _m_files[removed];
+                bool over = (_m_policy.max_files > 0 && _m_files.size() - removed > _m_policy.max_files) ||
+                            (_m_policy.max_total_bytes > 0 && total > _m_policy.max_total_bytes) ||
+                            (_m_policy.max_age_sec > 0 && now - e.mtime > static_cast<time_t>(_m_policy.max_age_sec));
+                if (!over){
+                    break;
+                }
+                // 已被外部删除的文件直接忽略
+                if (unlink(e.name.c_str()) == -1 && errno != ENOENT){
+                    std::cout << __FILE__ << " " << __LINE__ << " remove log file failed " << e.name << std::endl;
+                    perror(NULL);
+                }
+                total -= e.size;
+                ++removed;
+            }
+            _m_files.erase(_m_files.begin(), _m_files.begin() + removed);
+        }
+
+        void ThreadEntry() {
+            std::vector<std::string> added;
+            std::unique_lock<std::mutex> lock(_m_mtx);
+            while (1){
+                lock.unlock();
+                for (auto &name : added){
+                    Entry entry;
+                    if (Stat(name, &entry)){
+                        _m_files.push_back(entry);
+                    }
+                }
+                if (!added.empty()){
+                    Sort();
+                }
+                added.clear();
+                Enforce();
+                lock.lock();
+                auto ready = [&]() { return _m_stop || !_m_added.empty(); };
+                if (_m_policy.max_age_sec > 0){
+                    _m_cond.wait_for(lock, std::chrono::seconds(kCheckIntervalSec), ready);
+                }
+                else {
+                    _m_cond.wait(lock, ready);
+                }
+                if (_m_stop){
+                    break;
+                }
+                added.swap(_m_added);
+            }
+        }
+
+    private:
+        enum { kCheckIntervalSec = 60 };   // 按时间保留时的检查间隔(秒)
+
+        std::string _m_prefix;
+        RetentionPolicy _m_policy;
+        std::vector<Entry> _m_files;        // 已关闭的文件, 由旧到新, 仅后台线程访问(构造时除外)
+
+        std::mutex _m_mtx;
+        std::condition_variable _m_cond;
+        std::vector<std::string> _m_added;  // 新登记的文件, 由_m_mtx保护
+        bool _m_stop;
+        std::thread _m_thread;
+    };
+} // namespace Chronicle
@@ -1,10 +1,23 @@
 #pragma once
 #include <string>
 
+// 编译期日志等级, 数值与LogLevel::value一致
+#define CHRONICLE_LEVEL_DEBUG 0
+#define CHRONICLE_LEVEL_INFO  1
+#define CHRONICLE_LEVEL_WARN  2
+#define CHRONICLE_LEVEL_ERROR 3
+#define CHRONICLE_LEVEL_FATAL 4
+
+// 低于CHRONICLE_MIN_LEVEL的日志宏在编译期被替换为空操作, 例如 -DCHRONICLE_MIN_LEVEL=CHRONICLE_LEVEL_WARN
+#ifndef CHRONICLE_MIN_LEVEL
+#define CHRONICLE_MIN_LEVEL CHRONICLE_LEVEL_DEBUG
+#endif
+
 namespace Chronicle {
 class LogLevel {
    public:
     enum class value { DEBUG, INFO, WARN, ERROR, FATAL};
+    static const int kCount = 5;    // 日志等级个数, 可用作按等级索引的数组大小
 
     // 提供日志等级的字符串转换接口
     static const char* ToString(value level) {
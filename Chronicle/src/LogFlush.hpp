@@ -1,11 +1,43 @@
+#pragma once
+#include <algorithm>
 #include <cassert>
+#include <cerrno>
+#include <climits>
 #include <fstream>
 #include <memory>
+#include <string>
+#include <vector>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
 #include <unistd.h>
 #include "Util.hpp"
+#include "Housekeeper.hpp"      //滚动日志的保留与后台清理
+#include "Compressor.hpp"       //滚动日志的后台压缩
 
 extern Chronicle::Util::JsonData* g_conf_data;
 namespace Chronicle {
+    //同步到存储设备的程度, 由弱到强
+    //  FLUSH:          用户态缓冲写入内核, 其他进程可见, 掉电丢失
+    //  WRITE_BEHIND:   再发起脏页回写(sync_file_range)但不等待, 缩短掉电时丢失的窗口, 不保证元数据
+    //  DATA:           等待数据落盘(fdatasync), 不等待与读取无关的元数据(如修改时间)
+    //  FULL:           等待数据和全部元数据落盘(fsync)
+    enum class SyncLevel { FLUSH = 0, WRITE_BEHIND, DATA, FULL };
+
+    //多个输出策略共享的只读数据块, 最后一个引用释放时回收
+    using SharedBlock = std::shared_ptr<const std::string>;
+
+    //输出策略的队列统计, 只有带独立队列的输出策略(QueuedFlush)会填写
+    struct SinkStats {
+        size_t queued_bytes = 0;        // 队列中等待写入的字节数
+        size_t written_bytes = 0;       // 已写入的字节数(累计)
+        size_t dropped_batches = 0;     // 队列满时按策略丢弃的批数(累计)
+        size_t dropped_bytes = 0;
+        int64_t lag_us = 0;             // 最近一次写入的数据在队列中等待的时间(微秒)
+        int64_t max_lag_us = 0;
+        size_t drain_timeouts = 0;      // 等待队列写完超时的次数(累计)
+    };
+
     //日志输出策略:
     //  StdoutFlush:    日志输出到标准输出(控制台)
     //  FileFlush:      日志写入固定文件，支持不同刷盘策略(由flush_log决定)
@@ -16,6 +48,128 @@ namespace Chronicle {
         virtual ~LogFlush() {}
         //不同的输出方式, 需要override Flush
         virtual void Flush(const char *data, size_t len) = 0;
+        //按顺序写入多块数据, 默认逐块调用Flush(); 基于文件描述符的输出策略用一次writev提交
+        virtual void FlushV(const struct iovec *iov, int iovcnt) {
+            for (int i = 0; i < iovcnt; ++i){
+                Flush(static_cast<const char *>(iov[i].iov_base), iov[i].iov_len);
+            }
+        }
+        //是否接收共享数据块: 为true时日志器每批复制一次数据到SharedBlock, 通过FlushShared()交给所有这样的输出策略
+        virtual bool WantsShared() const { return false; }
+        //接收共享数据块, 可以保存引用在之后写入
+        virtual void FlushShared(const SharedBlock &block) { Flush(block->data(), block->size()); }
+        //队列统计, 没有队列的输出策略返回空统计
+        virtual SinkStats Stats() { return SinkStats(); }
+        //输出所在的设备号, 共享落盘调度器据此合并同一设备的写入, 0表示未知
+        virtual uint64_t Device() const { return 0; }
+        //等待已提交的异步写入全部完成, 同步写入的输出策略不需要实现
+        //由异步工作器的消费者线程在退出前调用: 异步I/O请求属于提交它的线程, 线程退出后在途请求会被取消
+        virtual void Drain() {}
+        //是否带独立队列(QueuedFlush): 这样的输出策略的Drain()可在任意线程调用且有超时,
+        //日志器在释放输出锁之后再等待它, 一个卡住的输出策略不会阻塞其他输出策略和分片
+        virtual bool Queued() const { return false; }
+        //把已写入的数据同步到level指定的程度, 不支持的输出策略忽略
+        virtual void Sync(SyncLevel) {}
+
+        //由日志器的持久化策略(DurabilityPolicy)统一决定何时调用Sync(): 之后不再按flush_log == 2每批同步,
+        //滚动切换文件时先把旧文件同步到磁盘, 因为之后的Sync()只作用于当前文件
+        virtual void SetManagedSync(bool managed) { _m_managed_sync = managed; }
+
+        //当前输出文件描述符的副本, 日志器在输出锁内取得, 释放锁后用SyncFd()同步并关闭, fsync不阻塞其他分片的写入
+        //Sync()只是同步一个文件描述符的输出策略实现; 返回-1时日志器在输出锁内调用Sync()
+        virtual int DupFd() { return -1; }
+
+        //按level同步文件描述符, FLUSH不需要系统调用
+        static bool SyncFd(int fd, SyncLevel level) {
+            int ret = 0;
+            switch (level){
+                case SyncLevel::FLUSH:
+                    break;
+                case SyncLevel::WRITE_BEHIND:
+                    ret = sync_file_range(fd, 0, 0, SYNC_FILE_RANGE_WRITE);
+                    break;
+                case SyncLevel::DATA:
+                    ret = fdatasync(fd);
+                    break;
+                case SyncLevel::FULL:
+                    ret = fsync(fd);
+                    break;
+            }
+            if (ret == -1){
+                std::cout << __FILE__ << " " << __LINE__ << " sync log file failed" << std::endl;
+                perror(NULL);
+                return false;
+            }
+            return true;
+        }
+
+    protected:
+        //实际使用的flush_log, 托管同步时最多为1(不同步到磁盘)
+        size_t FlushLog() const {
+            return _m_managed_sync ? std::min<size_t>(g_conf_data->flush_log, 1) : g_conf_data->flush_log;
+        }
+
+        //把iov中的数据全部写入fd, 短写时从未写完的位置继续, 被信号中断(EINTR)时重试, 出错返回false
+        static bool WriteFull(int fd, const struct iovec *iov, int iovcnt) {
+            std::vector<struct iovec> rest;     // 短写后剩余部分的描述, 数据本身不复制
+            while (iovcnt > 0){
+                ssize_t ret = writev(fd, iov, std::min(iovcnt, static_cast<int>(IOV_MAX)));
+                if (ret == -1){
+                    if (errno == EINTR){
+                        continue;
+                    }
+                    std::cout << __FILE__ << " " << __LINE__ << " write log file failed" << std::endl;
+                    perror(NULL);
+                    return false;
+                }
+                // 跳过已完整写入的块, 剩余的第一块从写入位置继续
+                size_t n = static_cast<size_t>(ret);
+                while (iovcnt > 0 && n >= iov->iov_len){
+                    n -= iov->iov_len;
+                    ++iov;
+                    --iovcnt;
+                }
+                if (iovcnt > 0 && n > 0){
+                    std::vector<struct iovec> next(iov, iov + iovcnt);
+                    next[0].iov_base = static_cast<char *>(next[0].iov_base) + n;
+                    next[0].iov_len -= n;
+                    rest.swap(next);
+                    iov = rest.data();
+                }
+            }
+            return true;
+        }
+
+        //以追加方式打开(必要时创建)文件, 失败返回-1
+        static int OpenAppend(const std::string &filename) {
+            int fd = open(filename.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0666);
+            if (fd == -1){
+                std::cout << __FILE__ << " " << __LINE__ << " open log file failed"<< std::endl;
+                perror(NULL);
+            }
+            return fd;
+        }
+
+        static uint64_t DeviceOf(const std::string &path) {
+            struct stat st;
+            if (stat(path.c_str(), &st) == -1){
+                return 0;
+            }
+            return static_cast<uint64_t>(st.st_dev);
+        }
+
+        //滚动文件名: 前缀 + 年月日时分秒 + '-' + 序号.log, 各字段补零定长, 文件名的字典序即时间顺序,
+        //按时间段查找日志时只需比较文件名, 不需要打开文件
+        static std::string RollFilename(const std::string &prefix, time_t time_, size_t cnt) {
+            struct tm t;
+            localtime_r(&time_, &t);
+            char buf[32];
+            size_t n = strftime(buf, sizeof(buf), "%Y%m%d%H%M%S", &t);
+            snprintf(buf + n, sizeof(buf) - n, "-%06zu.log", cnt);
+            return prefix + buf;
+        }
+
+        bool _m_managed_sync = false;   // 是否由日志器的持久化策略托管同步
     };
 
     //日志输出到标准输出(控制台)
@@ -25,12 +179,15 @@ namespace Chronicle {
         void Flush(const char *data, size_t len) override{
             cout.write(data, len);
         }
+        void Sync(SyncLevel) override {
+            cout.flush();
+        }
     };
 
     //日志写入固定文件，支持不同刷盘策略(由flush_log决定)
-    //  flush_log == 1: 执行fflush将数据从用户缓冲区刷新到内核, 不强制将缓冲区的内容同步到磁盘
-    //  flush_log == 2: 执行fflush将数据从用户缓冲区刷新到内核, 强制将缓冲区的内容同步到磁盘, 影响性能
-    //  flush_log == 0: default, 仅执行write将数据写入用户缓冲区, 不执行fflush刷新到内核、不执行fsync写入硬盘
+    //直接对文件描述符调用write/writev, 数据从消费者缓冲区直接进入内核, 不经过stdio缓冲区的拷贝
+    //  flush_log == 2: 每次写入后fsync, 强制将内核缓冲区的内容同步到磁盘, 影响性能
+    //  flush_log == 0/1: default, 写入内核缓冲区后返回, 进程崩溃不丢失, 掉电可能丢失
     class FileFlush : public LogFlush {
     public:
         using ptr = std::shared_ptr<FileFlush>;
@@ -39,106 +196,163 @@ namespace Chronicle {
             Util::File::CreateDirectory(Util::File::Path(filename));
             cout << "FileFlush Path " << Util::File::Path(filename) << endl;
             // 打开文件
-            _m_fs = fopen(filename.c_str(), "ab");  //append binary
-            if(_m_fs == NULL){
-                std::cout << __FILE__ << " " << __LINE__ << " open log file failed"<< std::endl;
-                perror(NULL);
+            _m_fd = OpenAppend(filename);
+        }
+        ~FileFlush() {
+            if (_m_fd != -1){
+                close(_m_fd);
             }
         }
+        FileFlush(const FileFlush&) = delete;
+        FileFlush& operator=(const FileFlush&) = delete;
+
         void Flush(const char *data, size_t len) override {
-            //写数据流向: ptr->stream, 大小: size(元素大小) * nmemb(元素数量)
-            //size_t fwrite(const void *ptr, size_t size, size_t nmemb, FILE *stream);
-            //1. 数据写入_m_fs的用户缓冲区
-            fwrite(data, 1, len, _m_fs);    //data->file
-            if(ferror(_m_fs)){
-                std::cout << __FILE__ << " " << __LINE__ << " write log file failed"<< std::endl;
-                perror(NULL);
+            struct iovec iov = { const_cast<char *>(data), len };
+            FlushV(&iov, 1);
+        }
+        void FlushV(const struct iovec *iov, int iovcnt) override {
+            if (_m_fd == -1){
+                return;
             }
-            if(g_conf_data->flush_log == 1){
-                //2. 用户缓冲区刷新到内核缓冲区
-                if(fflush(_m_fs) == EOF){
-                    std::cout << __FILE__ << " " << __LINE__ << " fflush file failed"<< std::endl;
-                    perror(NULL);
-                }
+            //1. 一次系统调用把所有数据写入内核缓冲区
+            WriteFull(_m_fd, iov, iovcnt);
+            if(FlushLog() == 2){
+                //2. 内核缓冲区数据强制写入硬盘, 触发系统调用fsync
+                SyncFd(_m_fd, SyncLevel::FULL);
             }
-            else if(g_conf_data->flush_log == 2){
-                //2. 用户缓冲区刷新到内核缓冲区
-                fflush(_m_fs);
-                //3. 内核缓冲区数据强制写入硬盘, 触发系统调用fsync
-                fsync(fileno(_m_fs));
+        }
+
+        uint64_t Device() const override { return DeviceOf(_m_filename); }
+        void Sync(SyncLevel level) override {
+            if (_m_fd != -1){
+                SyncFd(_m_fd, level);
             }
         }
+        int DupFd() override { return _m_fd == -1 ? -1 : fcntl(_m_fd, F_DUPFD_CLOEXEC, 0); }
 
     private:
         std::string _m_filename;
-        FILE* _m_fs = NULL; 
+        int _m_fd = -1;
     };
 
-    //日志滚动写入文件(按文件大小分割)
-    //  文件大小分割: 当文件日志大小大于_m_max_size时, 自动创建新文件
+    //按时间滚动的周期, 在本地时间的整点或零点切换文件
+    enum class RollInterval { NONE = 0, HOURLY, DAILY };
+
+    //日志滚动写入文件(按文件大小和时间分割)
+    //  文件大小分割: 当文件日志大小大于_m_max_size时, 自动创建新文件, max_size为0时不按大小分割
+    //  时间分割: 写入时跨过interval指定的整点/零点则创建新文件, 只比较预先算好的切换时刻
+    //  压缩: 关闭的文件交给后台Compressor按compress压缩, 压缩后的文件再交给保留策略
+    //  保留策略: 关闭的文件交给后台Housekeeper按retention删除, 消费者线程不扫描目录
     class RollFileFlush : public LogFlush {
     public:
         using ptr = std::shared_ptr<RollFileFlush>;
-        RollFileFlush(const std::string &filename, size_t max_size)
-            : _m_max_size(max_size), _m_filename(filename) {
+        RollFileFlush(const std::string &filename, size_t max_size, RollInterval interval = RollInterval::NONE,
+                      const RetentionPolicy &retention = RetentionPolicy(),
+                      const CompressPolicy &compress = CompressPolicy())
+            : _m_max_size(max_size), _m_filename(filename), _m_interval(interval) {
             Util::File::CreateDirectory(Util::File::Path(filename));
+            if (retention.Enabled()){
+                _m_housekeeper.reset(new Housekeeper(filename, retention));
+            }
+            if (compress.Enabled()){
+                Housekeeper *housekeeper = _m_housekeeper.get();
+                _m_compressor.reset(new Compressor(compress, [housekeeper](const std::string &name) {
+                    if (housekeeper != nullptr){
+                        housekeeper->Add(name);
+                    }
+                }));
+            }
         }
+        ~RollFileFlush() {
+            if (_m_fd != -1){
+                close(_m_fd);
+            }
+        }
+        RollFileFlush(const RollFileFlush&) = delete;
+        RollFileFlush& operator=(const RollFileFlush&) = delete;
 
         void Flush(const char *data, size_t len) override {
+            struct iovec iov = { const_cast<char *>(data), len };
+            FlushV(&iov, 1);
+        }
+        void FlushV(const struct iovec *iov, int iovcnt) override {
             // 确认文件大小不满足滚动需求
             InitLogFile();
-            // 向文件写入内容
-            fwrite(data, 1, len, _m_fs);
-            if(ferror(_m_fs)){
-                std::cout << __FILE__ << " " << __LINE__ << " write log file failed"<< std::endl;
-                perror(NULL);
+            if (_m_fd == -1){
+                return;
             }
-            _m_cur_size += len;
-            if(g_conf_data->flush_log == 1){
-                if(fflush(_m_fs)){
-                    std::cout << __FILE__ << " " << __LINE__ << " fflush file failed"<< std::endl;
-                    perror(NULL);
-                }
-            }else if(g_conf_data->flush_log == 2){
-                fflush(_m_fs);
-                fsync(fileno(_m_fs));
+            // 向文件写入内容, 多块数据写入同一个文件(不在中间滚动)
+            WriteFull(_m_fd, iov, iovcnt);
+            for (int i = 0; i < iovcnt; ++i){
+                _m_cur_size += iov[i].iov_len;
+            }
+            if(FlushLog() == 2){
+                SyncFd(_m_fd, SyncLevel::FULL);
+            }
+        }
+        void Sync(SyncLevel level) override {
+            if (_m_fd != -1){
+                SyncFd(_m_fd, level);
             }
         }
+        int DupFd() override { return _m_fd == -1 ? -1 : fcntl(_m_fd, F_DUPFD_CLOEXEC, 0); }
+
+        // 滚动文件尚未创建时按所在目录取设备号
+        uint64_t Device() const override {
+            std::string::size_type pos = _m_filename.find_last_of('/');
+            return DeviceOf(pos == std::string::npos ? "." : _m_filename.substr(0, pos + 1));
+        }
 
     private:
-        //初始化一个新文件, 初始化时机: 文件满触发新滚动、刚启动时
+        //初始化一个新文件, 初始化时机: 文件满或跨过时间边界触发新滚动、刚启动时
         void InitLogFile() {
-            // 文件不存在或已达最大大小时触发滚动
-            if (_m_fs==NULL || _m_cur_size >= _m_max_size) {
+            // 不按时间滚动时不需要读取时间
+            time_t now = _m_interval == RollInterval::NONE ? 0 : Util::Date::Now();
+            // 文件不存在、已达最大大小或跨过时间边界时触发滚动
+            if (_m_fd==-1 || (_m_max_size > 0 && _m_cur_size >= _m_max_size) || (_m_next_roll > 0 && now >= _m_next_roll)) {
                 // 关闭已打开的文件(可能由于文件满触发滚动)
-                if(_m_fs!=NULL){
-                    fclose(_m_fs);
-                    _m_fs=NULL;
+                if(_m_fd!=-1){
+                    // 托管同步时旧文件之后不会再被Sync()覆盖, 关闭前同步
+                    if (_m_managed_sync){
+                        SyncFd(_m_fd, SyncLevel::DATA);
+                    }
+                    close(_m_fd);
+                    _m_fd=-1;
+                    if (_m_compressor){
+                        _m_compressor->Add(_m_cur_name);
+                    }
+                    else if (_m_housekeeper){
+                        _m_housekeeper->Add(_m_cur_name);
+                    }
                 }   
-                std::string filename = CreateFilename();
-                _m_fs=fopen(filename.c_str(), "ab");
-                if(_m_fs==NULL){
-                    std::cout << __FILE__ << " " << __LINE__ << " open file failed"<< std::endl;
-                    perror(NULL);
+                if (now == 0){
+                    now = Util::Date::Now();
                 }
+                _m_cur_name = RollFilename(_m_filename, now, _m_cnt++);
+                _m_fd = OpenAppend(_m_cur_name);
                 _m_cur_size = 0;
+                _m_next_roll = NextRollTime(now);
             }
         }
 
-        // 构建落地的滚动日志文件名称, 实际年月日+小时分钟秒数.log
-        std::string CreateFilename() {
-            time_t time_ = Util::Date::Now();
+        // 下一个时间边界(本地时间的下一个整点或零点), 不按时间滚动时返回0
+        time_t NextRollTime(time_t now) const {
+            if (_m_interval == RollInterval::NONE){
+                return 0;
+            }
             struct tm t;
-            localtime_r(&time_, &t);
-            std::string filename = _m_filename;
-            filename += std::to_string(t.tm_year + 1900);
-            filename += std::to_string(t.tm_mon + 1);
-            filename += std::to_string(t.tm_mday);
-            filename += std::to_string(t.tm_hour);
-            filename += std::to_string(t.tm_min);
-            filename += std::to_string(t.tm_sec) + '-' +
-                        std::to_string(_m_cnt++) + ".log";
-            return filename;
+            localtime_r(&now, &t);
+            t.tm_sec = 0;
+            t.tm_min = 0;
+            if (_m_interval == RollInterval::DAILY){
+                t.tm_hour = 0;
+                t.tm_mday += 1;
+            }
+            else {
+                t.tm_hour += 1;
+            }
+            t.tm_isdst = -1;    // 由mktime判断夏令时
+            return mktime(&t);
         }
 
     private:
@@ -146,8 +360,12 @@ namespace Chronicle {
         size_t _m_cur_size = 0;
         size_t _m_max_size;
         std::string _m_filename;
-        // std::ofstream;
-        FILE* _m_fs = NULL;
+        std::string _m_cur_name;    // 正在写入的文件名
+        int _m_fd = -1;
+        RollInterval _m_interval;
+        time_t _m_next_roll = 0;    // 下一次按时间滚动的时刻, 0表示不按时间滚动
+        std::unique_ptr<Housekeeper> _m_housekeeper;    // 保留策略的后台清理, 未设置保留策略时为空
+        std::unique_ptr<Compressor> _m_compressor;      // 后台压缩, 未设置压缩时为空; 先于_m_housekeeper析构
     };
 
     //工厂类, 静态工具类
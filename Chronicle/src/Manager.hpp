@@ -37,6 +37,16 @@ namespace Chronicle {
             return _m_default_logger; 
         }
 
+        //共享落盘: 之后创建的日志器不再各自启动消费者线程, 由io_threads个共享I/O线程按设备合并、
+        //按日志器轮转落盘. io_threads为0时恢复为每个日志器独立线程, 已创建的日志器不受影响
+        void SetSharedFlush(size_t io_threads) {
+            FlushScheduler::SetShared(io_threads > 0 ? std::make_shared<FlushScheduler>(io_threads)
+                                                     : FlushScheduler::ptr());
+        }
+        FlushScheduler::ptr SharedFlush() {
+            return FlushScheduler::Shared();
+        }
+
     private:
         //初次调用GetInstance()创建default Logger
         LoggerManager() {
@@ -1,33 +1,105 @@
 #pragma once
 
+#include <cstdarg>
+#include <cstdio>
+#include <cstring>
 #include <memory>
 #include <thread>
 
+#include "AsyncBuffer.hpp"
 #include "Level.hpp"
 #include "Util.hpp"
 
 #include <sstream>
 
 namespace Chronicle {
+    // 日志时间格式
+    //  TIME:        20:12:26.123
+    //  DATETIME:    2026-10-16 20:12:26.123
+    //  ISO8601_UTC: 2026-10-16T12:12:26.123Z
+    enum class TimeFormat { TIME, DATETIME, ISO8601_UTC };
+    // 秒以下的时间精度
+    enum class TimePrecision { SECOND, MILLI, MICRO };
+
+    // 时间戳渲染, 每个线程缓存当前秒的日期时间前缀, 只有秒数变化时才调用localtime_r/strftime
+    class TimeRender {
+    public:
+        // 将微秒时间戳写入dst, 返回写入长度, dst至少需要kMaxLen字节
+        static size_t Render(char *dst, int64_t micros, TimeFormat fmt, TimePrecision prec) {
+            struct Cache {
+                int64_t sec = -1;
+                TimeFormat fmt = TimeFormat::TIME;
+                char prefix[32];
+                size_t len = 0;
+            };
+            static thread_local Cache cache;
+            int64_t sec = micros / 1000000;
+            if (sec != cache.sec || fmt != cache.fmt){
+                time_t t_sec = static_cast<time_t>(sec);
+                struct tm t;
+                if (fmt == TimeFormat::ISO8601_UTC){
+                    gmtime_r(&t_sec, &t);
+                }
+                else{
+                    localtime_r(&t_sec, &t);
+                }
+                const char *pattern = "%H:%M:%S";
+                if (fmt == TimeFormat::DATETIME){
+                    pattern = "%Y-%m-%d %H:%M:%S";
+                }
+                else if (fmt == TimeFormat::ISO8601_UTC){
+                    pattern = "%Y-%m-%dT%H:%M:%S";
+                }
+                cache.len = strftime(cache.prefix, sizeof(cache.prefix), pattern, &t);
+                cache.sec = sec;
+                cache.fmt = fmt;
+            }
+            memcpy(dst, cache.prefix, cache.len);
+            char *p = dst + cache.len;
+            int64_t frac = micros % 1000000;
+            if (prec == TimePrecision::MILLI){
+                p = AppendFraction(p, frac / 1000, 3);
+            }
+            else if (prec == TimePrecision::MICRO){
+                p = AppendFraction(p, frac, 6);
+            }
+            if (fmt == TimeFormat::ISO8601_UTC){
+                *p++ = 'Z';
+            }
+            return p - dst;
+        }
+
+        static const size_t kMaxLen = 32;
+
+    private:
+        // 写入".ddd"形式的小数部分, 不足位数补0
+        static char *AppendFraction(char *p, int64_t value, int digits) {
+            *p++ = '.';
+            for (int i = digits - 1; i >= 0; --i){
+                p[i] = static_cast<char>('0' + value % 10);
+                value /= 10;
+            }
+            return p + digits;
+        }
+    };
+
     struct LogMessage{
         using ptr = std::shared_ptr<LogMessage>;
         LogMessage() = default;
         LogMessage(LogLevel::value level, std::string file, size_t line,
                 std::string name, std::string payload) : 
                     _m_name(name),
-                    _m_ctime(Util::Date::Now()),
+                    _m_ctime(Util::Date::NowMicros()),
                     _m_file_name(file),
                     _m_line(line),
                     _m_tid(std::this_thread::get_id()),
                     _m_level(level),
                     _m_payload(payload) {}
-        std::string format() {
+        std::string format(TimeFormat fmt = TimeFormat::TIME, TimePrecision prec = TimePrecision::MILLI) {
             std::stringstream ret;
             // 获取当前时间
-            struct tm t;
-            localtime_r(&_m_ctime, &t);
-            char buf[128];
-            strftime(buf, sizeof(buf), "%H:%M:%S", &t);
+            char buf[TimeRender::kMaxLen];
+            buf[TimeRender::Render(buf, _m_ctime, fmt, prec)] = '\0';
 
             // 格式化线程ID为16进制
             std::stringstream tid_ss;
@@ -42,12 +114,88 @@ namespace Chronicle {
             return ret.str();
         }
 
+        // 将一条完整日志直接格式化到buf的预留空间中, 格式与format()一致
+        // 不构造LogMessage、不产生临时string, buf容量足够时整个过程没有堆分配
+        static void FormatTo(Buffer &buf, LogLevel::value level, const char *file, size_t line,
+                             const std::string &name, TimeFormat time_fmt, TimePrecision time_prec,
+                             const char *fmt, va_list va) {
+            FormatHeader(buf, level, file, line, name, time_fmt, time_prec);
+            FormatPayload(buf, fmt, va);
+            buf.Push("\n", 1);
+        }
+
+        // 头部: [时间][线程id][等级][日志器][文件:行号]\t
+        static void FormatHeader(Buffer &buf, LogLevel::value level, const char *file, size_t line,
+                                 const std::string &name, TimeFormat time_fmt, TimePrecision time_prec) {
+            size_t file_len = strlen(file);
+            char *p = buf.Reserve(kHeaderReserve + name.size() + file_len);
+            char *begin = p;
+            *p++ = '[';
+            p += TimeRender::Render(p, Util::Date::NowMicros(), time_fmt, time_prec);
+            p = Append(p, "][", 2);
+            p = Append(p, ThreadIdString(), strlen(ThreadIdString()));
+            p = Append(p, "][", 2);
+            const char *level_str = LogLevel::ToString(level);
+            p = Append(p, level_str, strlen(level_str));
+            p = Append(p, "][", 2);
+            p = Append(p, name.c_str(), name.size());
+            p = Append(p, "][", 2);
+            p = Append(p, file, file_len);
+            *p++ = ':';
+            p += snprintf(p, 24, "%zu", line);
+            p = Append(p, "]\t", 2);
+            buf.Commit(p - begin);
+        }
+
+        // printf风格的内容: 先按剩余空间尝试一次, 不足时按实际长度扩容后重新格式化
+        static void FormatPayload(Buffer &buf, const char *fmt, va_list va) {
+            va_list va_retry;
+            va_copy(va_retry, va);
+            char *p = buf.Reserve(kPayloadReserve);
+            size_t avail = buf.WriteableSize();
+            int r = vsnprintf(p, avail, fmt, va);
+            if (r < 0){
+                perror("vsnprintf failed!!!: ");
+                r = 0;
+            }
+            else if (static_cast<size_t>(r) + 1 > avail){
+                p = buf.Reserve(r + 1);
+                vsnprintf(p, r + 1, fmt, va_retry);
+            }
+            va_end(va_retry);
+            buf.Commit(r);
+        }
+
         std::string _m_name;        // 日志器名称
-        time_t _m_ctime;            // 代码执行时间戳
+        int64_t _m_ctime;           // 代码执行时间戳(微秒)
         std::string _m_file_name;   // 源文件名
         size_t _m_line;             // 代码行号
         std::thread::id _m_tid;     // 线程id
         LogLevel::value _m_level;   // 日志级别
         std::string _m_payload;     // 日志内容
+
+        // 当前线程id的哈希值, 日志中以16进制显示
+        static uint64_t ThreadIdHash() {
+            static thread_local uint64_t tid = std::hash<std::thread::id>()(std::this_thread::get_id());
+            return tid;
+        }
+
+        // 当前线程id的16进制字符串, 每个线程只计算一次
+        static const char *ThreadIdString() {
+            static thread_local char tid[32] = {0};
+            if (tid[0] == 0){
+                snprintf(tid, sizeof(tid), "0x%zx", static_cast<size_t>(ThreadIdHash()));
+            }
+            return tid;
+        }
+
+    private:
+        static const size_t kHeaderReserve = 128;   // 头部中除日志器名、文件名外的最大长度
+        static const size_t kPayloadReserve = 256;  // 日志内容的首次预留长度
+
+        static char *Append(char *dst, const char *src, size_t len) {
+            memcpy(dst, src, len);
+            return dst + len;
+        }
     };
 } // namespace Chronicle
\ No newline at end of file
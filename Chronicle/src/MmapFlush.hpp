@@ -0,0 +1,280 @@
+/*内存映射文件输出策略, 日志数据直接memcpy到预分配并映射的分段文件中*/
+#pragma once
+#include <algorithm>
+#include <cerrno>
+#include <condition_variable>
+#include <cstring>
+#include <ctime>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include "LogFlush.hpp"
+
+namespace Chronicle {
+    //日志按固定大小的分段写入, 每个分段创建时fallocate预分配并整体映射, 写入只是一次memcpy,
+    //不经过stdio缓冲, 也没有每批一次的write系统调用
+    //  后台线程预先创建并预映射(MADV_POPULATE_WRITE)下一个分段, 当前分段写满后只需切换,
+    //  页缓存分配和缺页的开销不在消费者线程上; 切换后后台线程立即开始准备新的下一个分段
+    //  关闭分段时按实际写入大小截断文件尾部; 未使用的预创建分段在析构时删除
+    //  flush_log == 1: 每次写入后msync(MS_ASYNC)发起回写
+    //  flush_log == 2: 每次写入后msync(MS_SYNC)等待写入的页落盘
+    //  flush_log == 0: 只写入页缓存, 进程崩溃时已写入的数据仍在页缓存中, 不会丢失
+    //进程被强制结束(没有执行析构)时分段尾部残留预分配的零字节
+    //预分配或预映射失败(磁盘空间不足、文件系统不支持fallocate)的分段不映射, 改用write()写入:
+    //  映射稀疏文件后写入未分配的页会在磁盘写满时触发SIGBUS结束进程, write()只是返回失败
+    class MmapFileFlush : public LogFlush {
+    public:
+        using ptr = std::shared_ptr<MmapFileFlush>;
+        MmapFileFlush(const std::string &filename, size_t segment_size = kDefaultSegmentSize)
+            : _m_filename(filename), _m_cnt(1), _m_next_ready(false), _m_stop(false) {
+            long page = sysconf(_SC_PAGESIZE);
+            _m_page_size = page > 0 ? static_cast<size_t>(page) : 4096;
+            // 分段大小按页对齐
+            _m_segment_size = (std::max(segment_size, _m_page_size) + _m_page_size - 1) / _m_page_size * _m_page_size;
+            Util::File::CreateDirectory(Util::File::Path(filename));
+            Open(_m_cur);
+            _m_prepare_thread = std::thread(&MmapFileFlush::PrepareThreadEntry, this);
+        }
+        ~MmapFileFlush() {
+            {
+                std::unique_lock<std::mutex> lock(_m_mtx);
+                _m_stop = true;
+            }
+            _m_cond.notify_all();
+            _m_prepare_thread.join();
+            Close(_m_cur, true);
+            // 预创建但未使用的分段没有数据, 直接删除
+            Close(_m_next, false);
+        }
+        MmapFileFlush(const MmapFileFlush&) = delete;
+        MmapFileFlush& operator=(const MmapFileFlush&) = delete;
+
+        void Flush(const char *data, size_t len) override {
+            while (len > 0){
+                if (_m_cur.fd == -1){
+                    // 分段创建失败(错误已输出), 换用下一个分段, 仍然失败时丢弃本次数据
+                    Roll();
+                    if (_m_cur.fd == -1){
+                        return;
+                    }
+                }
+                size_t n = std::min(len, _m_segment_size - _m_cur.used);
+                if (_m_cur.addr != nullptr){
+                    memcpy(_m_cur.addr + _m_cur.used, data, n);
+                }
+                else {
+                    struct iovec iov = { const_cast<char *>(data), n };
+                    if (!WriteFull(_m_cur.fd, &iov, 1)){
+                        // 写入失败(错误已输出)时丢弃本次剩余数据, 写入位置退回已完整写入的末尾
+                        lseek(_m_cur.fd, static_cast<off_t>(_m_cur.used), SEEK_SET);
+                        return;
+                    }
+                }
+                SyncRange(_m_cur, _m_cur.used, n);
+                _m_cur.used += n;
+                data += n;
+                len -= n;
+                if (_m_cur.used == _m_segment_size){
+                    Roll();
+                }
+            }
+        }
+
+        // 同步当前分段中上次同步之后写入的部分, 已切换走的分段在关闭时同步
+        //  WRITE_BEHIND: msync(MS_ASYNC); DATA: msync(MS_SYNC); FULL: 再fsync
+        //  用write()写入的分段直接按level同步文件描述符
+        void Sync(SyncLevel level) override {
+            if (_m_cur.fd == -1 || level == SyncLevel::FLUSH || _m_cur.synced == _m_cur.used){
+                return;
+            }
+            if (_m_cur.addr == nullptr){
+                if (SyncFd(_m_cur.fd, level)){
+                    _m_cur.synced = _m_cur.used;
+                }
+                return;
+            }
+            size_t begin = _m_cur.synced / _m_page_size * _m_page_size;
+            int flags = level == SyncLevel::WRITE_BEHIND ? MS_ASYNC : MS_SYNC;
+            if (msync(_m_cur.addr + begin, _m_cur.used - begin, flags) == -1){
+                std::cout << __FILE__ << " " << __LINE__ << " msync log segment failed" << std::endl;
+                perror(NULL);
+                return;
+            }
+            if (level == SyncLevel::FULL){
+                SyncFd(_m_cur.fd, level);
+            }
+            _m_cur.synced = _m_cur.used;
+        }
+
+        uint64_t Device() const override {
+            std::string::size_type pos = _m_filename.find_last_of('/');
+            return DeviceOf(pos == std::string::npos ? "." : _m_filename.substr(0, pos + 1));
+        }
+
+    private:
+        struct Segment {
+            Segment() : fd(-1), addr(nullptr), used(0), synced(0) {}
+            std::string name;
+            int fd;         // 为-1表示未打开
+            char *addr;     // 映射地址, 文件已打开而为空时用write()写入
+            size_t used;    // 已写入的字节数
+            size_t synced;  // Sync()已同步到的位置
+        };
+
+        // 创建分段文件, 预分配空间并映射; 预分配、映射或预映射失败时只打开文件, 用write()写入
+        bool Open(Segment &seg) {
+            seg.name = CreateFilename();
+            seg.fd = open(seg.name.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+            if (seg.fd == -1){
+                std::cout << __FILE__ << " " << __LINE__ << " open log segment failed: " << seg.name << std::endl;
+                perror(NULL);
+                return false;
+            }
+            seg.used = 0;
+            seg.synced = 0;
+            // 不退回ftruncate: 稀疏文件的映射在磁盘写满时写入会触发SIGBUS
+            if (fallocate(seg.fd, 0, 0, _m_segment_size) == -1){
+                std::cout << __FILE__ << " " << __LINE__ << " allocate log segment failed, using write(): " << seg.name << std::endl;
+                perror(NULL);
+                return UnmapSegment(seg);
+            }
+            void *addr = mmap(NULL, _m_segment_size, PROT_READ | PROT_WRITE, MAP_SHARED, seg.fd, 0);
+            if (addr == MAP_FAILED){
+                std::cout << __FILE__ << " " << __LINE__ << " mmap log segment failed, using write(): " << seg.name << std::endl;
+                perror(NULL);
+                return UnmapSegment(seg);
+            }
+            seg.addr = static_cast<char *>(addr);
+#ifdef MADV_POPULATE_WRITE
+            // 预先建立可写的页表项, 写入时不再逐页缺页; 内核不支持时(EINVAL)忽略, 其他失败时改用write()
+            if (madvise(addr, _m_segment_size, MADV_POPULATE_WRITE) == -1 && errno != EINVAL){
+                std::cout << __FILE__ << " " << __LINE__ << " populate log segment failed, using write(): " << seg.name << std::endl;
+                perror(NULL);
+                return UnmapSegment(seg);
+            }
+#endif
+            return true;
+        }
+
+        // 分段改用write()写入: 解除映射并把文件截断为空, 释放已预分配的空间
+        bool UnmapSegment(Segment &seg) {
+            if (seg.addr != nullptr){
+                munmap(seg.addr, _m_segment_size);
+                seg.addr = nullptr;
+            }
+            if (ftruncate(seg.fd, 0) == -1){
+                std::cout << __FILE__ << " " << __LINE__ << " truncate log segment failed: " << seg.name << std::endl;
+                perror(NULL);
+                close(seg.fd);
+                seg.fd = -1;
+                return false;
+            }
+            return true;
+        }
+
+        // 解除映射并关闭, keep为false时删除文件; 保留时把文件截断到实际写入的大小
+        void Close(Segment &seg, bool keep) {
+            // 托管同步时已切换走的分段不会再被Sync()覆盖, 同样在关闭前同步
+            bool sync = keep && (FlushLog() == 2 || _m_managed_sync) && seg.used > 0;
+            if (seg.addr != nullptr){
+                if (sync){
+                    msync(seg.addr, seg.used, MS_SYNC);
+                }
+                munmap(seg.addr, _m_segment_size);
+                seg.addr = nullptr;
+            }
+            else if (seg.fd != -1 && sync){
+                SyncFd(seg.fd, SyncLevel::DATA);
+            }
+            if (seg.fd != -1){
+                if (keep && ftruncate(seg.fd, seg.used) == -1){
+                    std::cout << __FILE__ << " " << __LINE__ << " truncate log segment failed: " << seg.name << std::endl;
+                    perror(NULL);
+                }
+                close(seg.fd);
+                seg.fd = -1;
+                if (!keep){
+                    unlink(seg.name.c_str());
+                }
+            }
+        }
+
+        // 当前分段已写满, 切换到预创建的分段, 后台线程尚未准备好时等待
+        void Roll() {
+            Close(_m_cur, true);
+            {
+                std::unique_lock<std::mutex> lock(_m_mtx);
+                _m_cond.wait(lock, [&]() { return _m_next_ready; });
+                std::swap(_m_cur, _m_next);
+                _m_next = Segment();
+                _m_next_ready = false;
+            }
+            _m_cond.notify_all();
+        }
+
+        // 后台线程: 下一个分段被取走后立即创建新的分段
+        void PrepareThreadEntry() {
+            std::unique_lock<std::mutex> lock(_m_mtx);
+            while (1){
+                _m_cond.wait(lock, [&]() { return _m_stop || !_m_next_ready; });
+                if (_m_stop){
+                    return;
+                }
+                lock.unlock();
+                Segment seg;
+                Open(seg);
+                lock.lock();
+                _m_next = seg;
+                _m_next_ready = true;
+                _m_cond.notify_all();
+            }
+        }
+
+        // 按flush_log同步刚写入的[offset, offset + len), msync要求起始地址按页对齐
+        // 用write()写入的分段按flush_log发起回写(1)或等待数据落盘(2)
+        void SyncRange(Segment &seg, size_t offset, size_t len) {
+            int flags = FlushLog() == 1 ? MS_ASYNC : FlushLog() == 2 ? MS_SYNC : 0;
+            if (flags == 0){
+                return;
+            }
+            if (seg.addr == nullptr){
+                SyncFd(seg.fd, flags == MS_ASYNC ? SyncLevel::WRITE_BEHIND : SyncLevel::DATA);
+                return;
+            }
+            size_t begin = offset / _m_page_size * _m_page_size;
+            if (msync(seg.addr + begin, offset + len - begin, flags) == -1){
+                std::cout << __FILE__ << " " << __LINE__ << " msync log segment failed" << std::endl;
+                perror(NULL);
+            }
+        }
+
+        // 与RollFileFlush相同的命名方式: 文件名前缀 + 年月日时分秒 + 序号
+        // 分段在预创建时命名, 时间为上一个分段开始写入的时间
+        std::string CreateFilename() {
+            return RollFilename(_m_filename, Util::Date::Now(), _m_cnt++);
+        }
+
+    private:
+        static const size_t kDefaultSegmentSize = 64 * 1024 * 1024;   // 默认分段大小64MB
+
+        std::string _m_filename;
+        size_t _m_cnt;              // 分段序号
+        size_t _m_page_size;
+        size_t _m_segment_size;     // 分段大小, 按页对齐
+        Segment _m_cur;             // 正在写入的分段, 仅调用Flush的线程访问
+
+        // 预创建分段的后台线程, 以下成员由_m_mtx保护
+        std::mutex _m_mtx;
+        std::condition_variable _m_cond;
+        Segment _m_next;            // 预创建的下一个分段
+        bool _m_next_ready;         // _m_next是否已准备好(创建失败时addr为空)
+        bool _m_stop;
+        std::thread _m_prepare_thread;
+    };
+} // namespace Chronicle
@@ -0,0 +1,131 @@
+/*有界无锁环形缓冲区, 多生产者单消费者(MPSC), 供AsyncType::ASYNC_LOCKFREE(实验性)使用*/
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+
+#include "AsyncBuffer.hpp"
+
+namespace Chronicle {
+    //环形缓冲区中每条记录的布局: [8字节头部][数据][补齐到8字节]
+    //  头部为0:     该位置已被预留, 但生产者尚未提交(消费者在此停止)
+    //  头部最低位0: 普通记录, 头部 >> 1 为数据长度
+    //  头部最低位1: 填充记录, 头部 >> 1 为需要跳过的字节数(记录不能跨越环尾, 剩余空间用填充记录占位)
+    //生产者通过CAS移动_m_head预留空间, 在锁外拷贝数据, 最后以release语义写入头部完成提交
+    //消费者按顺序读取已提交的记录, 清零已消费区域后移动_m_tail归还空间
+    //记录之间隔着头部和填充, 已提交的数据在环中不连续, 消费者需要再拷贝一次(见Drain), 所以该模式只是实验性的:
+    //生产者之间不竞争锁, 但总拷贝量比ASYNC_SAFE多, 吞吐量不会更高
+    class RingBuffer {
+    public:
+        //容量向上取整为2的幂, 便于用掩码计算偏移
+        explicit RingBuffer(size_t capacity) : _m_head(0), _m_tail(0) {
+            size_t cap = 4096;
+            while (cap < capacity){
+                cap <<= 1;
+            }
+            _m_capacity = cap;
+            _m_mask = cap - 1;
+            //按8字节对齐分配并清零, 头部可以直接当作atomic<uint64_t>访问
+            _m_slots.reset(new std::atomic<uint64_t>[cap / kHeaderSize]);
+            for (size_t i = 0; i < cap / kHeaderSize; ++i){
+                _m_slots[i].store(0, std::memory_order_relaxed);
+            }
+        }
+        RingBuffer(const RingBuffer&) = delete;
+        RingBuffer& operator=(const RingBuffer&) = delete;
+
+        //单条记录允许的最大数据长度, 更长的数据由调用方分片写入
+        //不超过容量的一半: 记录跨越环尾时需要额外的填充空间, 记录占一半以内时空环总能放下(填充 + 记录 < 容量),
+        //否则空环也可能放不下, 生产者会一直等待
+        size_t MaxRecord() const { return _m_capacity / 2 - kHeaderSize; }
+
+        //生产者写入一条记录, 空间不足时立即返回false, 由调用方决定等待或重试
+        bool TryPush(const char *data, size_t len){
+            size_t need = Align(kHeaderSize + len);
+            if (len == 0 || need > _m_capacity / 2){
+                return false;
+            }
+            uint64_t head = _m_head.load(std::memory_order_relaxed);
+            for (;;){
+                size_t off = head & _m_mask;
+                size_t pad = 0;
+                if (off + need > _m_capacity){
+                    pad = _m_capacity - off;    //尾部放不下, 跳到环首
+                }
+                if (head + pad + need - _m_tail.load(std::memory_order_acquire) > _m_capacity){
+                    return false;
+                }
+                if (_m_head.compare_exchange_weak(head, head + pad + need,
+                        std::memory_order_acq_rel, std::memory_order_relaxed)){
+                    if (pad){
+                        Slot(off).store((static_cast<uint64_t>(pad) << 1) | 1, std::memory_order_release);
+                        off = 0;
+                    }
+                    memcpy(Data(off), data, len);
+                    Slot(off).store(static_cast<uint64_t>(len) << 1, std::memory_order_release);
+                    return true;
+                }
+            }
+        }
+
+        //消费者按顺序将已提交的记录拷贝到buf, 遇到未提交的记录即停止, 返回拷贝的字节数
+        //拷贝后立即归还环中的空间, 生产者不必等待落地完成
+        size_t Drain(Buffer &buf){
+            uint64_t tail = _m_tail.load(std::memory_order_relaxed);
+            uint64_t head = _m_head.load(std::memory_order_acquire);
+            size_t bytes = 0;
+            while (tail != head){
+                size_t off = tail & _m_mask;
+                uint64_t word = Slot(off).load(std::memory_order_acquire);
+                if (word == 0){
+                    break;
+                }
+                size_t size = word >> 1;
+                size_t advance = size;
+                if ((word & 1) == 0){
+                    buf.Push(Data(off), size);
+                    bytes += size;
+                    advance = Align(kHeaderSize + size);
+                }
+                //清零已消费区域, 保证下一圈生产者未提交时头部读到的是0
+                memset(reinterpret_cast<char *>(&Slot(off)), 0, advance);
+                tail += advance;
+            }
+            _m_tail.store(tail, std::memory_order_release);
+            return bytes;
+        }
+
+        //消费者位置上是否有已提交的记录
+        bool Readable(){
+            uint64_t tail = _m_tail.load(std::memory_order_relaxed);
+            return tail != _m_head.load(std::memory_order_acquire) &&
+                   Slot(tail & _m_mask).load(std::memory_order_acquire) != 0;
+        }
+
+        //已预留的位置与已消费的位置, 单调递增, 用于判断某一时刻之前写入的数据是否都已被消费
+        uint64_t Head() { return _m_head.load(std::memory_order_acquire); }
+        uint64_t Tail() { return _m_tail.load(std::memory_order_acquire); }
+
+        //是否存在已预留(无论是否提交)但未消费的数据
+        bool IsEmpty(){
+            return _m_head.load(std::memory_order_acquire) == _m_tail.load(std::memory_order_acquire);
+        }
+
+    private:
+        static const size_t kHeaderSize = sizeof(uint64_t);
+        static size_t Align(size_t len) { return (len + kHeaderSize - 1) & ~(kHeaderSize - 1); }
+        std::atomic<uint64_t> &Slot(size_t off) { return _m_slots[off / kHeaderSize]; }
+        char *Data(size_t off) { return reinterpret_cast<char *>(&_m_slots[off / kHeaderSize + 1]); }
+
+    private:
+        std::unique_ptr<std::atomic<uint64_t>[]> _m_slots;  // 环形存储区, 以8字节为单位
+        size_t _m_capacity;
+        size_t _m_mask;
+        //生产者预留位置与消费者位置分处不同缓存行, 避免伪共享
+        char _m_pad0[64];
+        std::atomic<uint64_t> _m_head;  // 已预留的位置(单调递增)
+        char _m_pad1[64];
+        std::atomic<uint64_t> _m_tail;  // 已消费的位置(单调递增)
+    };
+} // namespace Chronicle
@@ -0,0 +1,200 @@
+#pragma once
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "AsyncWorker.hpp"      //OverflowRule
+#include "LogFlush.hpp"
+
+namespace Chronicle {
+    //输出策略独立队列的配置
+    //  max_bytes:  队列中等待写入的数据上限(字节), 单批超过上限时只在队列为空时放入
+    //  overflow:   队列满时的处理策略, 与ASYNC_SAFE缓冲池相同:
+    //              BLOCK阻塞消费者线程(即原来的背压), BLOCK_TIMEOUT最多阻塞timeout_ms后丢弃本批,
+    //              DROP_NEWEST丢弃本批, DROP_OLDEST丢弃队列中最旧的数据, SAMPLE按DROP_NEWEST处理
+    //  drain_timeout_ms: AsyncLogger::Sync()和日志器退出时等待队列写完的最长时间, 超时计入drain_timeouts, 0表示不限
+    struct SinkQueueOptions {
+        size_t max_bytes = 64 * 1024 * 1024;
+        OverflowRule overflow = OverflowRule(OverflowPolicy::DROP_OLDEST);
+        uint32_t drain_timeout_ms = 1000;
+    };
+
+    //为一个输出策略提供独立的有界队列和写入线程, 慢的输出策略(阻塞的管道、网络)不再拖慢其他输出策略和生产者
+    //  日志器把一批数据复制一次到共享数据块(SharedBlock), 所有带队列的输出策略只保存引用, 不再各自复制
+    //  写入线程一次取出队列中连续的多块数据, 通过被包装输出策略的FlushV()一次提交
+    //  Sync(): 在队列中放入同步标记, 由写入线程在之前的数据写完后执行, 不阻塞调用者
+    //  Drain(): 等待队列中的数据和同步标记全部处理完, 最多等待drain_timeout_ms
+    //被包装输出策略的所有调用都在写入线程中执行, 包括退出前的Drain()
+    class QueuedFlush : public LogFlush {
+    public:
+        using ptr = std::shared_ptr<QueuedFlush>;
+        QueuedFlush(const LogFlush::ptr &sink, const SinkQueueOptions &options)
+            : _m_sink(sink), _m_options(options), _m_busy(false), _m_stop(false) {
+            _m_thread = std::thread(&QueuedFlush::WriterThreadEntry, this);
+        }
+        // 写完队列中剩余的数据后退出
+        ~QueuedFlush() {
+            {
+                std::unique_lock<std::mutex> lock(_m_mtx);
+                _m_stop = true;
+            }
+            _m_cond_writer.notify_all();
+            _m_thread.join();
+        }
+        QueuedFlush(const QueuedFlush&) = delete;
+        QueuedFlush& operator=(const QueuedFlush&) = delete;
+
+        void Flush(const char *data, size_t len) override {
+            FlushShared(std::make_shared<const std::string>(data, len));
+        }
+        bool WantsShared() const override { return true; }
+        void FlushShared(const SharedBlock &block) override {
+            std::unique_lock<std::mutex> lock(_m_mtx);
+            if (!MakeRoom(lock, block->size())){
+                ++_m_stats.dropped_batches;
+                _m_stats.dropped_bytes += block->size();
+                return;
+            }
+            _m_queue.push_back(Entry(block));
+            _m_stats.queued_bytes += block->size();
+            _m_cond_writer.notify_one();
+        }
+
+        void Sync(SyncLevel level) override {
+            std::unique_lock<std::mutex> lock(_m_mtx);
+            _m_queue.push_back(Entry(level));
+            _m_cond_writer.notify_one();
+        }
+
+        void Drain() override {
+            std::unique_lock<std::mutex> lock(_m_mtx);
+            auto drained = [&]() { return _m_queue.empty() && !_m_busy; };
+            if (_m_options.drain_timeout_ms == 0){
+                _m_cond_space.wait(lock, drained);
+            }
+            else if (!_m_cond_space.wait_for(lock, std::chrono::milliseconds(_m_options.drain_timeout_ms), drained)){
+                ++_m_stats.drain_timeouts;
+            }
+        }
+        bool Queued() const override { return true; }
+
+        uint64_t Device() const override { return _m_sink->Device(); }
+        void SetManagedSync(bool managed) override { _m_sink->SetManagedSync(managed); }
+
+        SinkStats Stats() override {
+            std::unique_lock<std::mutex> lock(_m_mtx);
+            return _m_stats;
+        }
+
+    private:
+        // 队列中的一项: 数据块或同步标记(block为空)
+        struct Entry {
+            explicit Entry(const SharedBlock &b)
+                : block(b), level(SyncLevel::FLUSH), enqueued(std::chrono::steady_clock::now()) {}
+            explicit Entry(SyncLevel l) : level(l), enqueued(std::chrono::steady_clock::now()) {}
+            SharedBlock block;
+            SyncLevel level;
+            std::chrono::steady_clock::time_point enqueued;
+        };
+
+        // 按溢出策略为len字节腾出空间, 调用时持有_m_mtx, 返回false表示本批被丢弃
+        bool MakeRoom(std::unique_lock<std::mutex> &lock, size_t len) {
+            auto fits = [&]() { return _m_stats.queued_bytes == 0 || _m_stats.queued_bytes + len <= _m_options.max_bytes; };
+            if (fits()){
+                return true;
+            }
+            const OverflowRule &rule = _m_options.overflow;
+            switch (rule.policy){
+                case OverflowPolicy::BLOCK:
+                    _m_cond_space.wait(lock, fits);
+                    return true;
+                case OverflowPolicy::BLOCK_TIMEOUT:
+                    return _m_cond_space.wait_for(lock, std::chrono::milliseconds(rule.timeout_ms), fits);
+                case OverflowPolicy::DROP_OLDEST:
+                    // 写入线程正在处理的数据已经取出, 只丢弃仍在队列中的数据块, 同步标记保留
+                    for (auto it = _m_queue.begin(); it != _m_queue.end() && !fits();){
+                        if (it->block){
+                            ++_m_stats.dropped_batches;
+                            _m_stats.dropped_bytes += it->block->size();
+                            _m_stats.queued_bytes -= it->block->size();
+                            it = _m_queue.erase(it);
+                        }
+                        else {
+                            ++it;
+                        }
+                    }
+                    return fits();
+                default:
+                    return false;
+            }
+        }
+
+        void WriterThreadEntry() {
+            std::vector<Entry> batch;
+            std::vector<struct iovec> iov;
+            while (1){
+                {
+                    std::unique_lock<std::mutex> lock(_m_mtx);
+                    _m_cond_writer.wait(lock, [&]() { return _m_stop || !_m_queue.empty(); });
+                    if (_m_queue.empty()){
+                        break;
+                    }
+                    // 同步标记单独处理, 否则取出连续的数据块一起写入
+                    do {
+                        batch.push_back(_m_queue.front());
+                        _m_queue.pop_front();
+                    } while (batch.front().block && !_m_queue.empty() && _m_queue.front().block &&
+                             batch.size() < kMaxGather);
+                    _m_busy = true;
+                }
+                size_t bytes = 0;
+                if (batch.front().block){
+                    for (auto &e : batch){
+                        iov.push_back({ const_cast<char *>(e.block->data()), e.block->size() });
+                        bytes += e.block->size();
+                    }
+                    _m_sink->FlushV(iov.data(), static_cast<int>(iov.size()));
+                }
+                else {
+                    _m_sink->Sync(batch.front().level);
+                }
+                auto lag = std::chrono::steady_clock::now() - batch.front().enqueued;
+                int64_t lag_us = std::chrono::duration_cast<std::chrono::microseconds>(lag).count();
+                {
+                    std::unique_lock<std::mutex> lock(_m_mtx);
+                    _m_busy = false;
+                    _m_stats.queued_bytes -= bytes;
+                    _m_stats.written_bytes += bytes;
+                    _m_stats.lag_us = lag_us;
+                    _m_stats.max_lag_us = std::max(_m_stats.max_lag_us, lag_us);
+                }
+                _m_cond_space.notify_all();
+                batch.clear();
+                iov.clear();
+            }
+            // 异步I/O请求属于提交它的线程, 在写入线程退出前等待完成
+            _m_sink->Drain();
+        }
+
+    private:
+        enum { kMaxGather = 64 };   // 一次最多合并写入的数据块数
+
+        LogFlush::ptr _m_sink;      // 被包装的输出策略, 写入、同步和Drain()只在写入线程中调用
+        SinkQueueOptions _m_options;
+
+        std::mutex _m_mtx;
+        std::condition_variable _m_cond_writer;     // 通知写入线程有新数据
+        std::condition_variable _m_cond_space;      // 通知等待空间和等待Drain()的线程
+        std::deque<Entry> _m_queue;                 // 以下由_m_mtx保护
+        SinkStats _m_stats;
+        bool _m_busy;                               // 写入线程正在处理取出的数据
+        bool _m_stop;
+        std::thread _m_thread;
+    };
+} // namespace Chronicle
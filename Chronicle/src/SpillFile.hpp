@@ -0,0 +1,159 @@
+/*磁盘溢出段, ASYNC_UNSAFE模式内存达到上限后, 新数据按顺序追加到临时文件, 由消费者按顺序读回*/
+#pragma once
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <unistd.h>
+
+#include "AsyncBuffer.hpp"
+
+namespace Chronicle {
+    //文件中每次写入的布局: [u32 长度][数据], 读回时保持每次写入的完整性
+    //  Append(): 生产者调用, 需要由调用方加锁保证串行, 写入完成后才推进写偏移
+    //  ReadInto(): 仅消费者调用, 只读取写偏移end之前(已完整写入)的数据, 不需要加锁
+    //  Clear(): 全部读回后由消费者在调用方的锁内截断文件, 之后重新从头写入
+    //临时文件创建后立即unlink, 进程退出时由系统回收
+    class SpillFile {
+    public:
+        SpillFile() : _m_fd(-1), _m_write(0), _m_read(0) {}
+        ~SpillFile() {
+            if (_m_fd != -1){
+                close(_m_fd);
+            }
+        }
+        SpillFile(const SpillFile&) = delete;
+        SpillFile& operator=(const SpillFile&) = delete;
+
+        bool Append(const char *data, size_t len) {
+            if (_m_fd == -1 && !Open()){
+                return false;
+            }
+            uint32_t header = static_cast<uint32_t>(len);
+            if (!WriteAll(reinterpret_cast<const char *>(&header), sizeof(header), _m_write) ||
+                !WriteAll(data, len, _m_write + sizeof(header))){
+                return false;
+            }
+            _m_write += sizeof(header) + len;
+            return true;
+        }
+
+        uint64_t WriteOffset() const { return _m_write; }
+        uint64_t ReadOffset() const { return _m_read; }
+
+        // 所有写入的数据都已读回
+        bool Drained() const { return _m_read == _m_write; }
+
+        // 从读偏移开始读回完整的写入, 直到end或buf中已追加max_bytes字节, 返回追加的字节数
+        // 单次写入超过max_bytes时也会完整读回, buf按需扩容
+        size_t ReadInto(Buffer &buf, uint64_t end, size_t max_bytes) {
+            size_t total = 0;
+            while (_m_read < end && total < max_bytes){
+                size_t want = static_cast<size_t>(std::min<uint64_t>(end - _m_read, static_cast<uint64_t>(kChunkSize)));
+                _m_chunk.resize(want);
+                if (!ReadAll(&_m_chunk[0], want, _m_read)){
+                    _m_read = end;  // 读取失败时跳过剩余数据, 避免消费者反复重试
+                    break;
+                }
+                size_t pos = 0;
+                while (pos + sizeof(uint32_t) <= want && total < max_bytes){
+                    uint32_t len = 0;
+                    memcpy(&len, &_m_chunk[pos], sizeof(len));
+                    if (pos + sizeof(len) + len > want){
+                        break;
+                    }
+                    buf.Push(&_m_chunk[pos + sizeof(len)], len);
+                    pos += sizeof(len) + len;
+                    total += len;
+                }
+                if (pos == 0){
+                    // 单次写入比读取块还大, 直接读入buf
+                    uint32_t len = 0;
+                    memcpy(&len, &_m_chunk[0], sizeof(len));
+                    char *p = buf.Reserve(len);
+                    if (!ReadAll(p, len, _m_read + sizeof(len))){
+                        _m_read = end;
+                        break;
+                    }
+                    buf.Commit(len);
+                    pos = sizeof(len) + len;
+                    total += len;
+                }
+                _m_read += pos;
+            }
+            return total;
+        }
+
+        // 截断文件并从头开始, 调用前需确认Drained()
+        void Clear() {
+            if (_m_fd != -1 && ftruncate(_m_fd, 0) == -1){
+                std::cout << __FILE__ << " " << __LINE__ << " truncate spill file failed" << std::endl;
+                perror(NULL);
+            }
+            _m_write = 0;
+            _m_read = 0;
+        }
+
+    private:
+        bool Open() {
+            std::string dir = g_conf_data->spill_dir.empty() ? "/tmp" : g_conf_data->spill_dir;
+            std::string path = dir + "/chronicle-spill-XXXXXX";
+            _m_fd = mkstemp(&path[0]);
+            if (_m_fd == -1){
+                std::cout << __FILE__ << " " << __LINE__ << " create spill file failed: " << path << std::endl;
+                perror(NULL);
+                return false;
+            }
+            unlink(path.c_str());
+            return true;
+        }
+
+        bool WriteAll(const char *data, size_t len, uint64_t offset) {
+            while (len > 0){
+                ssize_t ret = pwrite(_m_fd, data, len, offset);
+                if (ret == -1){
+                    if (errno == EINTR){
+                        continue;
+                    }
+                    std::cout << __FILE__ << " " << __LINE__ << " write spill file failed" << std::endl;
+                    perror(NULL);
+                    return false;
+                }
+                data += ret;
+                len -= ret;
+                offset += ret;
+            }
+            return true;
+        }
+
+        bool ReadAll(char *data, size_t len, uint64_t offset) {
+            while (len > 0){
+                ssize_t ret = pread(_m_fd, data, len, offset);
+                if (ret <= 0){
+                    if (ret == -1 && errno == EINTR){
+                        continue;
+                    }
+                    std::cout << __FILE__ << " " << __LINE__ << " read spill file failed" << std::endl;
+                    perror(NULL);
+                    return false;
+                }
+                data += ret;
+                len -= ret;
+                offset += ret;
+            }
+            return true;
+        }
+
+    private:
+        enum { kChunkSize = 1024 * 1024 };  // 每次从文件读取的块大小
+
+        int _m_fd;
+        uint64_t _m_write;          // 写偏移, 由调用方的锁保护
+        uint64_t _m_read;           // 读偏移, 仅消费者访问
+        std::vector<char> _m_chunk; // 读取缓冲, 仅消费者访问
+    };
+} // namespace Chronicle
@@ -0,0 +1,199 @@
+/*日志风暴抑制: 按调用点限速, 合并连续重复的日志*/
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+
+#include "Level.hpp"
+
+namespace Chronicle {
+    // 日志风暴抑制策略, 按日志器配置, 都未设置时不启用; FATAL不受影响
+    //  rate:               每个调用点每秒最多输出rate条, 超出的在格式化之前丢弃, 0表示不限速
+    //  burst:              允许的突发条数, 0时取rate
+    //  collapse_repeats:   同一调用点连续输出相同内容时只保留第一条, 之后汇总为"last message repeated N times"
+    //  report_interval_ms: 被丢弃和被合并的条数最多延迟report_interval_ms汇总输出一次
+    struct StormPolicy {
+        uint32_t rate = 0;
+        uint32_t burst = 0;
+        bool collapse_repeats = false;
+        uint32_t report_interval_ms = 1000;
+        bool Enabled() const { return rate > 0 || collapse_repeats; }
+    };
+
+    // 调用点表与限速状态, 所有操作无锁
+    //  调用点以宏传入的静态__FILE__指针和__LINE__为key, 不比较字符串, 也不分配内存
+    //  调用点表固定kSlots个槽位, 开放寻址最多探测kProbes次, 表满或无法编码的调用点不做抑制
+    //  限速使用GCRA(等价于令牌桶): 每个调用点只有一个原子时间戳, 判断只需一次CAS
+    class StormGuard {
+    public:
+        struct Slot {
+            std::atomic<uint64_t> key;          // 调用点编码, 0表示空槽位
+            std::atomic<int64_t> tat;           // GCRA理论到达时间(纳秒)
+            std::atomic<uint64_t> suppressed;   // 上次汇总后被限速丢弃的条数
+            std::atomic<uint64_t> last_hash;    // 上一条日志内容的哈希值
+            std::atomic<uint64_t> repeats;      // 上次汇总后被合并的重复条数
+            std::atomic<int> level;             // 最近一次被抑制的日志等级, 汇总时使用
+            const char *File() const {
+                return reinterpret_cast<const char *>(static_cast<uintptr_t>(key.load(std::memory_order_acquire) & kPtrMask));
+            }
+            size_t Line() const { return static_cast<size_t>(key.load(std::memory_order_acquire) >> kPtrBits); }
+        };
+
+        explicit StormGuard(const StormPolicy &policy)
+            : _m_policy(policy), _m_slots(new Slot[kSlots]), _m_next_report(0),
+              _m_suppressed(0), _m_collapsed(0) {
+            for (size_t i = 0; i < kSlots; ++i){
+                Slot &s = _m_slots[i];
+                s.key.store(0, std::memory_order_relaxed);
+                s.tat.store(0, std::memory_order_relaxed);
+                s.suppressed.store(0, std::memory_order_relaxed);
+                s.last_hash.store(0, std::memory_order_relaxed);
+                s.repeats.store(0, std::memory_order_relaxed);
+                s.level.store(0, std::memory_order_relaxed);
+            }
+            uint32_t burst = policy.burst > 0 ? policy.burst : policy.rate;
+            _m_interval_ns = policy.rate > 0 ? 1000000000LL / policy.rate : 0;
+            _m_tolerance_ns = burst > 0 ? _m_interval_ns * (burst - 1) : 0;
+            _m_report_ns = static_cast<int64_t>(policy.report_interval_ms) * 1000000LL;
+        }
+        StormGuard(const StormGuard&) = delete;
+        StormGuard& operator=(const StormGuard&) = delete;
+
+        // 在格式化之前调用: 返回false表示该条日志被限速丢弃
+        // *slot输出该调用点的槽位, 无法登记时为nullptr(不做抑制)
+        bool Admit(LogLevel::value level, const char *file, size_t line, Slot **slot) {
+            *slot = level == LogLevel::value::FATAL ? nullptr : Find(file, line);
+            if (*slot == nullptr || _m_interval_ns == 0){
+                return true;
+            }
+            Slot &s = **slot;
+            int64_t now = NowNs();
+            int64_t tat = s.tat.load(std::memory_order_relaxed);
+            while (1){
+                int64_t t = tat > now ? tat : now;
+                if (t - now > _m_tolerance_ns){
+                    s.level.store(static_cast<int>(level), std::memory_order_relaxed);
+                    s.suppressed.fetch_add(1, std::memory_order_relaxed);
+                    _m_suppressed.fetch_add(1, std::memory_order_relaxed);
+                    return false;
+                }
+                if (s.tat.compare_exchange_weak(tat, t + _m_interval_ns, std::memory_order_relaxed)){
+                    return true;
+                }
+            }
+        }
+
+        // 内容格式化后调用: 与该调用点上一条内容相同时返回true(计入重复次数, 不再输出)
+        // 否则在*repeats中返回此前累计、尚未汇总的重复条数
+        bool Repeat(Slot *slot, LogLevel::value level, uint64_t hash, uint64_t *repeats) {
+            *repeats = 0;
+            if (slot->last_hash.exchange(hash, std::memory_order_relaxed) == hash){
+                slot->level.store(static_cast<int>(level), std::memory_order_relaxed);
+                slot->repeats.fetch_add(1, std::memory_order_relaxed);
+                _m_collapsed.fetch_add(1, std::memory_order_relaxed);
+                return true;
+            }
+            *repeats = slot->repeats.exchange(0, std::memory_order_relaxed);
+            return false;
+        }
+
+        // 是否到了汇总时间, 多个线程同时到达时只有一个返回true
+        bool ReportDue() {
+            int64_t now = NowNs();
+            int64_t next = _m_next_report.load(std::memory_order_relaxed);
+            return now >= next &&
+                   _m_next_report.compare_exchange_strong(next, now + _m_report_ns, std::memory_order_relaxed);
+        }
+
+        // 取出所有调用点尚未汇总的丢弃和重复条数, 对每个有计数的调用点调用
+        // report(level, file, line, suppressed, repeats)
+        template <typename Report>
+        void Sweep(const Report &report) {
+            for (size_t i = 0; i < kSlots; ++i){
+                Slot &s = _m_slots[i];
+                if (s.key.load(std::memory_order_acquire) == 0){
+                    continue;
+                }
+                uint64_t suppressed = s.suppressed.exchange(0, std::memory_order_relaxed);
+                uint64_t repeats = s.repeats.exchange(0, std::memory_order_relaxed);
+                if (suppressed > 0 || repeats > 0){
+                    report(static_cast<LogLevel::value>(s.level.load(std::memory_order_relaxed)), s.File(), s.Line(),
+                           suppressed, repeats);
+                }
+            }
+        }
+
+        const StormPolicy &Policy() const { return _m_policy; }
+        size_t Suppressed() const { return _m_suppressed.load(std::memory_order_relaxed); }
+        size_t Collapsed() const { return _m_collapsed.load(std::memory_order_relaxed); }
+
+        // 日志内容的哈希值, 每次处理8字节
+        static uint64_t Hash(const char *data, size_t len) {
+            uint64_t h = 0x9E3779B97F4A7C15ULL ^ len;
+            while (len >= 8){
+                uint64_t v;
+                memcpy(&v, data, 8);
+                h = (h ^ v) * 0xFF51AFD7ED558CCDULL;
+                h ^= h >> 32;
+                data += 8;
+                len -= 8;
+            }
+            uint64_t v = 0;
+            memcpy(&v, data, len);
+            h = (h ^ v) * 0xC4CEB9FE1A85EC53ULL;
+            return h ^ (h >> 29);
+        }
+
+    private:
+        // 调用点编码为一个64位整数: 低48位为文件名指针, 高16位为行号, 超出范围的调用点返回0
+        static uint64_t KeyOf(const char *file, size_t line) {
+            uint64_t ptr = static_cast<uint64_t>(reinterpret_cast<uintptr_t>(file));
+            if (file == nullptr || line == 0 || line >= (1ULL << (64 - kPtrBits)) || (ptr & ~kPtrMask) != 0){
+                return 0;
+            }
+            return ptr | (static_cast<uint64_t>(line) << kPtrBits);
+        }
+
+        // 查找或登记调用点的槽位
+        Slot *Find(const char *file, size_t line) {
+            uint64_t key = KeyOf(file, line);
+            if (key == 0){
+                return nullptr;
+            }
+            size_t index = static_cast<size_t>((key * 0x9E3779B97F4A7C15ULL) >> 32);
+            for (size_t i = 0; i < kProbes; ++i){
+                Slot &s = _m_slots[(index + i) & (kSlots - 1)];
+                uint64_t cur = s.key.load(std::memory_order_acquire);
+                if (cur == key){
+                    return &s;
+                }
+                if (cur == 0 && (s.key.compare_exchange_strong(cur, key, std::memory_order_acq_rel) || cur == key)){
+                    return &s;
+                }
+            }
+            return nullptr;
+        }
+
+        static int64_t NowNs() {
+            return std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now().time_since_epoch()).count();
+        }
+
+    private:
+        static const size_t kSlots = 1024;          // 调用点表槽位数, 必须为2的幂
+        static const size_t kProbes = 8;            // 开放寻址的最多探测次数
+        static const int kPtrBits = 48;             // 调用点编码中文件名指针的位数
+        static const uint64_t kPtrMask = (1ULL << kPtrBits) - 1;
+
+        StormPolicy _m_policy;
+        std::unique_ptr<Slot[]> _m_slots;
+        int64_t _m_interval_ns;                     // 每条日志占用的时间, 即1/rate
+        int64_t _m_tolerance_ns;                    // 允许提前的时间, 即(burst - 1)/rate
+        int64_t _m_report_ns;
+        std::atomic<int64_t> _m_next_report;        // 下一次汇总时间(纳秒)
+        std::atomic<size_t> _m_suppressed;          // 累计被限速丢弃的条数
+        std::atomic<size_t> _m_collapsed;           // 累计被合并的重复条数
+    };
+} // namespace Chronicle
@@ -0,0 +1,261 @@
+/*结构化日志: 带类型的键值字段, 以及JSON Lines、logfmt两种记录编码*/
+#pragma once
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <type_traits>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include "AsyncBuffer.hpp"
+#include "Format.hpp"
+#include "Level.hpp"
+#include "Message.hpp"
+
+namespace Chronicle {
+    // 日志记录的编码格式, 由LoggerBuilder::SetFormat设置, 默认TEXT
+    //  TEXT:   [时间][线程id][等级][日志器][文件:行号]\t内容 k=v ...
+    //  JSON:   {"ts":"...","tid":"0x...","level":"INFO","logger":"...","file":"...","line":12,"msg":"...","k":v}
+    //  LOGFMT: ts=... tid=0x... level=INFO logger=... file=... line=12 msg="..." k=v
+    // JSON与LOGFMT每条记录一行, 下游不必再用正则解析文本头部
+    enum class LogFormat { TEXT, JSON, LOGFMT };
+
+    // 一个键值字段, 只引用键和值, 在同一条日志调用内编码完毕, 不复制
+    // 值支持字符串、字符、bool、整数和浮点数, 不支持的类型在编译期报错
+    template <typename T>
+    struct KvField {
+        const char *key;
+        const T &value;
+    };
+
+    // 构造键值字段, 例如 logger->InfoKv("request done", Chronicle::Kv("status", 200), Chronicle::Kv("user", user))
+    template <typename T>
+    KvField<T> Kv(const char *key, const T &value) {
+        return KvField<T>{ key, value };
+    }
+
+    namespace Structured {
+        // 返回s中无需转义的前缀长度
+        //  需要转义的字符: '"', '\\'和控制字符(< 0x20); bare为true时空格和'='也算, 用于判断logfmt的值能否不加引号
+        //  支持SSE2时每次检查16字节, 日志中绝大多数字符串整段无需转义, 只做一次扫描
+        inline size_t PlainPrefix(const char *s, size_t n, bool bare) {
+            size_t i = 0;
+#if defined(__SSE2__)
+            const __m128i quote = _mm_set1_epi8('"');
+            const __m128i slash = _mm_set1_epi8('\\');
+            const __m128i ctrl = _mm_set1_epi8(0x1F);
+            const __m128i space = _mm_set1_epi8(' ');
+            const __m128i equal = _mm_set1_epi8('=');
+            for (; i + 16 <= n; i += 16){
+                __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(s + i));
+                // 无符号比较v <= 0x1F: max(v, 0x1F) == 0x1F
+                __m128i hit = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, quote), _mm_cmpeq_epi8(v, slash)),
+                                           _mm_cmpeq_epi8(_mm_max_epu8(v, ctrl), ctrl));
+                if (bare){
+                    hit = _mm_or_si128(hit, _mm_or_si128(_mm_cmpeq_epi8(v, space), _mm_cmpeq_epi8(v, equal)));
+                }
+                int mask = _mm_movemask_epi8(hit);
+                if (mask != 0){
+                    return i + __builtin_ctz(mask);
+                }
+            }
+#endif
+            for (; i < n; ++i){
+                unsigned char c = static_cast<unsigned char>(s[i]);
+                if (c == '"' || c == '\\' || c < 0x20 || (bare && (c == ' ' || c == '='))){
+                    break;
+                }
+            }
+            return i;
+        }
+
+        // 写入s的转义结果(不含两侧引号), JSON与logfmt的带引号值共用
+        inline void AppendEscaped(Buffer &buf, const char *s, size_t n) {
+            static const char kHex[] = "0123456789abcdef";
+            while (n > 0){
+                size_t plain = PlainPrefix(s, n, false);
+                buf.Push(s, plain);
+                if (plain == n){
+                    return;
+                }
+                char c = s[plain];
+                char esc[6] = { '\\', c, 0, 0, 0, 0 };
+                size_t len = 2;
+                switch (c){
+                    case '"': case '\\': break;
+                    case '\n': esc[1] = 'n'; break;
+                    case '\r': esc[1] = 'r'; break;
+                    case '\t': esc[1] = 't'; break;
+                    default:
+                        esc[1] = 'u';
+                        esc[2] = '0';
+                        esc[3] = '0';
+                        esc[4] = kHex[(c >> 4) & 0xF];
+                        esc[5] = kHex[c & 0xF];
+                        len = 6;
+                }
+                buf.Push(esc, len);
+                s += plain + 1;
+                n -= plain + 1;
+            }
+        }
+
+        // 带引号的字符串
+        inline void AppendQuoted(Buffer &buf, const char *s, size_t n) {
+            buf.Push("\"", 1);
+            AppendEscaped(buf, s, n);
+            buf.Push("\"", 1);
+        }
+
+        // 就地转义buf中从begin开始的内容(用于直接格式化到buf中的日志内容)
+        // 无需转义时不做任何拷贝, 否则把第一个需要转义的字符之后的部分取出, 转义后重新写入
+        inline void EscapeTail(Buffer &buf, size_t begin) {
+            size_t len = buf.ReadableSize() - begin;
+            size_t plain = PlainPrefix(buf.Begin() + begin, len, false);
+            if (plain == len){
+                return;
+            }
+            static thread_local std::string tail;
+            tail.assign(buf.Begin() + begin + plain, len - plain);
+            buf.Truncate(begin + plain);
+            AppendEscaped(buf, tail.data(), tail.size());
+        }
+
+        // 字符串值: JSON总是加引号; logfmt(以及TEXT格式的字段)只在为空或包含空格、'='、引号、控制字符时加引号
+        inline void WriteString(Buffer &buf, LogFormat format, const char *s, size_t n) {
+            if (format == LogFormat::JSON || n == 0 || PlainPrefix(s, n, true) != n){
+                AppendQuoted(buf, s, n);
+            }
+            else {
+                buf.Push(s, n);
+            }
+        }
+
+        inline void WriteValue(Buffer &buf, LogFormat format, const char *v) {
+            if (v == nullptr){
+                if (format == LogFormat::JSON){
+                    buf.Push("null", 4);
+                }
+                else {
+                    buf.Push("(null)", 6);
+                }
+                return;
+            }
+            WriteString(buf, format, v, strlen(v));
+        }
+        inline void WriteValue(Buffer &buf, LogFormat format, char *v) {
+            WriteValue(buf, format, static_cast<const char *>(v));
+        }
+        inline void WriteValue(Buffer &buf, LogFormat format, const std::string &v) {
+            WriteString(buf, format, v.data(), v.size());
+        }
+        inline void WriteValue(Buffer &buf, LogFormat format, char v) {
+            WriteString(buf, format, &v, 1);
+        }
+        inline void WriteValue(Buffer &buf, LogFormat, bool v) {
+            Fmt::WriteArg(buf, v);
+        }
+
+        template <typename T>
+        typename std::enable_if<std::is_integral<T>::value>::type
+        WriteValue(Buffer &buf, LogFormat, T v) {
+            Fmt::WriteArg(buf, v);
+        }
+
+        // 浮点数与{}占位符相同, 按最短往返表示输出; JSON不能表示nan/inf, 写为null
+        template <typename T>
+        typename std::enable_if<std::is_floating_point<T>::value>::type
+        WriteValue(Buffer &buf, LogFormat format, T v) {
+            if (format == LogFormat::JSON && !std::isfinite(static_cast<double>(v))){
+                buf.Push("null", 4);
+                return;
+            }
+            Fmt::WriteArg(buf, v);
+        }
+
+        // 字段名: JSON中作为带引号的字符串, logfmt和TEXT中原样写入(应为不含空格和'='的标识符)
+        inline void WriteKey(Buffer &buf, LogFormat format, const char *key) {
+            if (format == LogFormat::JSON){
+                buf.Push(",", 1);
+                AppendQuoted(buf, key, strlen(key));
+                buf.Push(":", 1);
+            }
+            else {
+                buf.Push(" ", 1);
+                buf.Push(key, strlen(key));
+                buf.Push("=", 1);
+            }
+        }
+
+        // 依次写入所有字段, 每个字段前带分隔符(JSON为',', 其他为' ')
+        inline void WriteFields(Buffer &, LogFormat) {}
+
+        template <typename T, typename... Rest>
+        void WriteFields(Buffer &buf, LogFormat format, const KvField<T> &field, const Rest &...rest) {
+            WriteKey(buf, format, field.key);
+            WriteValue(buf, format, field.value);
+            WriteFields(buf, format, rest...);
+        }
+
+        // 按JSON或logfmt编码一条完整记录
+        //  seq: 全局序号, 不启用时传nullptr
+        //  write_payload: 把日志内容直接写入buf, 写完后就地转义
+        //  write_fields: 写入键值字段(WriteFields), 没有字段时为空操作
+        template <typename PayloadWriter, typename FieldsWriter>
+        void FormatRecord(Buffer &buf, LogFormat format, LogLevel::value level, const char *file, size_t line,
+                          const std::string &name, TimeFormat time_fmt, TimePrecision time_prec,
+                          const uint64_t *seq, const PayloadWriter &write_payload, const FieldsWriter &write_fields) {
+            bool json = format == LogFormat::JSON;
+            char ts[TimeRender::kMaxLen];
+            size_t ts_len = TimeRender::Render(ts, Util::Date::NowMicros(), time_fmt, time_prec);
+            const char *tid = LogMessage::ThreadIdString();
+            const char *level_str = LogLevel::ToString(level);
+            if (json){
+                buf.Push("{\"ts\":\"", 7);
+                buf.Push(ts, ts_len);
+                buf.Push("\",\"tid\":\"", 9);
+                buf.Push(tid, strlen(tid));
+                buf.Push("\",\"level\":\"", 11);
+                buf.Push(level_str, strlen(level_str));
+                buf.Push("\",\"logger\":", 11);
+                AppendQuoted(buf, name.data(), name.size());
+                buf.Push(",\"file\":", 8);
+                AppendQuoted(buf, file, strlen(file));
+                buf.Push(",\"line\":", 8);
+            }
+            else {
+                buf.Push("ts=", 3);
+                WriteString(buf, format, ts, ts_len);
+                buf.Push(" tid=", 5);
+                buf.Push(tid, strlen(tid));
+                buf.Push(" level=", 7);
+                buf.Push(level_str, strlen(level_str));
+                buf.Push(" logger=", 8);
+                WriteString(buf, format, name.data(), name.size());
+                buf.Push(" file=", 6);
+                WriteString(buf, format, file, strlen(file));
+                buf.Push(" line=", 6);
+            }
+            Fmt::WriteArg(buf, line);
+            if (seq != nullptr){
+                buf.Push(json ? ",\"seq\":" : " seq=", json ? 7 : 5);
+                Fmt::WriteArg(buf, *seq);
+            }
+            buf.Push(json ? ",\"msg\":\"" : " msg=\"", json ? 8 : 6);
+            size_t begin = buf.ReadableSize();
+            write_payload(buf);
+            EscapeTail(buf, begin);
+            buf.Push("\"", 1);
+            write_fields(buf);
+            if (json){
+                buf.Push("}\n", 2);
+            }
+            else {
+                buf.Push("\n", 1);
+            }
+        }
+    } // namespace Structured
+} // namespace Chronicle
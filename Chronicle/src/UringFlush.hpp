@@ -0,0 +1,366 @@
+/*io_uring文件输出策略, 写入和fdatasync异步提交, 消费者线程不等待磁盘往返*/
+#pragma once
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <fcntl.h>
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include "LogFlush.hpp"
+
+namespace Chronicle {
+    //日志写入固定文件, 通过io_uring提交写入, 不依赖liburing, 直接使用系统调用
+    //  Flush(): 把数据拷贝到空闲的写入槽后提交写入立即返回, 最多depth个写入同时在途,
+    //           没有空闲槽时等待最早的完成; 写入槽只在写入完成后才重新使用
+    //  flush_log == 2: 每次写入后提交一个带IOSQE_IO_DRAIN的fdatasync, 在之前提交的写入全部完成后执行
+    //  flush_log == 0/1: 没有用户态缓冲, 写入完成即进入内核, 两者相同
+    //io_uring请求属于提交它的线程, 提交线程退出前需要调用Drain()等待在途请求完成(AsyncLogger会自动调用)
+    //内核不支持io_uring(或被seccomp禁止)时退回pwrite + fdatasync同步写入
+    class UringFileFlush : public LogFlush {
+    public:
+        using ptr = std::shared_ptr<UringFileFlush>;
+        UringFileFlush(const std::string &filename, size_t depth = kDefaultDepth)
+            : _m_filename(filename), _m_fd(-1), _m_offset(0), _m_ring_fd(-1),
+              _m_sq_ptr(MAP_FAILED), _m_cq_ptr(MAP_FAILED), _m_sqes(static_cast<io_uring_sqe *>(MAP_FAILED)),
+              _m_sq_size(0), _m_cq_size(0), _m_sqes_size(0), _m_writes(0), _m_syncs(0),
+              _m_slots(std::max<size_t>(depth, 1)) {
+            Util::File::CreateDirectory(Util::File::Path(filename));
+            _m_fd = open(filename.c_str(), O_WRONLY | O_CREAT | O_CLOEXEC, 0644);
+            if (_m_fd == -1){
+                std::cout << __FILE__ << " " << __LINE__ << " open log file failed" << std::endl;
+                perror(NULL);
+                return;
+            }
+            // 追加写入: 从文件末尾开始按偏移写
+            off_t end = lseek(_m_fd, 0, SEEK_END);
+            _m_offset = end > 0 ? static_cast<uint64_t>(end) : 0;
+            if (!SetupRing(static_cast<unsigned>(_m_slots.size() * 2))){
+                std::cout << __FILE__ << " " << __LINE__ << " io_uring unavailable, fall back to pwrite" << std::endl;
+            }
+        }
+        ~UringFileFlush() {
+            if (_m_ring_fd != -1){
+                Drain();
+                TeardownRing();
+            }
+            if (_m_fd != -1){
+                close(_m_fd);
+            }
+        }
+
+        void Flush(const char *data, size_t len) override {
+            if (_m_fd == -1 || len == 0){
+                return;
+            }
+            if (_m_ring_fd == -1){
+                FallbackWrite(data, len);
+                return;
+            }
+            bool sync = FlushLog() == 2;
+            Reap();
+            Slot *slot = FreeSlot();
+            // 没有空闲写入槽, 或提交队列放不下本次的写入和fdatasync时等待完成
+            while (slot == nullptr || _m_writes + _m_syncs + (sync ? 2 : 1) > _m_sq_entries){
+                WaitCompletion();
+                slot = FreeSlot();
+            }
+            slot->data.assign(data, data + len);
+            slot->offset = _m_offset;
+            slot->done = 0;
+            slot->busy = true;
+            _m_offset += len;
+            ++_m_writes;
+            SubmitWrite(*slot);
+            if (sync){
+                SubmitSync();
+            }
+        }
+
+        uint64_t Device() const override { return DeviceOf(_m_filename); }
+
+        void Drain() override {
+            if (_m_ring_fd == -1){
+                return;
+            }
+            while (_m_writes > 0 || _m_syncs > 0){
+                WaitCompletion();
+            }
+        }
+
+        // 等待在途的写入完成后按level同步, 需要与Flush()串行调用(AsyncLogger在输出策略的锁内调用)
+        void Sync(SyncLevel level) override {
+            if (_m_fd == -1){
+                return;
+            }
+            Drain();
+            SyncFd(_m_fd, level);
+        }
+
+        // 是否在使用io_uring(否则为pwrite)
+        bool UsingUring() const { return _m_ring_fd != -1; }
+
+    private:
+        struct Slot {
+            Slot() : offset(0), done(0), busy(false) {}
+            std::vector<char> data;     // 写入数据的副本, 复用容量
+            uint64_t offset;            // 在文件中的写入位置
+            size_t done;                // 已写入的字节数, 短写时从这里继续
+            bool busy;                  // 写入是否在途
+            struct iovec iov;           // 提交给内核的iovec, 写入完成前必须保持有效
+        };
+
+        static int Setup(unsigned entries, io_uring_params *p) {
+            return static_cast<int>(syscall(__NR_io_uring_setup, entries, p));
+        }
+        static int Enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags) {
+            return static_cast<int>(syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, NULL, 0));
+        }
+
+        bool SetupRing(unsigned entries) {
+            io_uring_params p;
+            memset(&p, 0, sizeof(p));
+            int fd = Setup(entries, &p);
+            if (fd < 0){
+                return false;
+            }
+            _m_ring_fd = fd;
+            _m_sq_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+            _m_cq_size = p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe);
+            bool single = (p.features & IORING_FEAT_SINGLE_MMAP) != 0;
+            if (single){
+                _m_sq_size = _m_cq_size = std::max(_m_sq_size, _m_cq_size);
+            }
+            _m_sq_ptr = mmap(NULL, _m_sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+            _m_cq_ptr = single ? _m_sq_ptr
+                               : mmap(NULL, _m_cq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+            _m_sqes_size = p.sq_entries * sizeof(io_uring_sqe);
+            _m_sqes = static_cast<io_uring_sqe *>(mmap(NULL, _m_sqes_size, PROT_READ | PROT_WRITE,
+                                                       MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES));
+            if (_m_sq_ptr == MAP_FAILED || _m_cq_ptr == MAP_FAILED || _m_sqes == MAP_FAILED){
+                std::cout << __FILE__ << " " << __LINE__ << " mmap io_uring failed" << std::endl;
+                perror(NULL);
+                TeardownRing();
+                return false;
+            }
+            char *sq = static_cast<char *>(_m_sq_ptr);
+            char *cq = static_cast<char *>(_m_cq_ptr);
+            _m_sq_head = reinterpret_cast<unsigned *>(sq + p.sq_off.head);
+            _m_sq_tail = reinterpret_cast<unsigned *>(sq + p.sq_off.tail);
+            _m_sq_mask = *reinterpret_cast<unsigned *>(sq + p.sq_off.ring_mask);
+            _m_sq_array = reinterpret_cast<unsigned *>(sq + p.sq_off.array);
+            _m_sq_entries = p.sq_entries;
+            _m_cq_head = reinterpret_cast<unsigned *>(cq + p.cq_off.head);
+            _m_cq_tail = reinterpret_cast<unsigned *>(cq + p.cq_off.tail);
+            _m_cq_mask = *reinterpret_cast<unsigned *>(cq + p.cq_off.ring_mask);
+            _m_cqes = reinterpret_cast<io_uring_cqe *>(cq + p.cq_off.cqes);
+            return true;
+        }
+
+        void TeardownRing() {
+            if (_m_sqes != MAP_FAILED){
+                munmap(_m_sqes, _m_sqes_size);
+            }
+            if (_m_cq_ptr != MAP_FAILED && _m_cq_ptr != _m_sq_ptr){
+                munmap(_m_cq_ptr, _m_cq_size);
+            }
+            if (_m_sq_ptr != MAP_FAILED){
+                munmap(_m_sq_ptr, _m_sq_size);
+            }
+            close(_m_ring_fd);
+            _m_ring_fd = -1;
+        }
+
+        // 填写一个提交项并立即提交, 在途数量由调用方保证不超过提交队列容量
+        // 提交失败时撤回该提交项并返回false, 不会产生完成项, 由调用方改为同步执行
+        bool Submit(const io_uring_sqe &entry) {
+            unsigned tail = *_m_sq_tail;
+            unsigned index = tail & _m_sq_mask;
+            _m_sqes[index] = entry;
+            _m_sq_array[index] = index;
+            __atomic_store_n(_m_sq_tail, tail + 1, __ATOMIC_RELEASE);
+            while (Enter(_m_ring_fd, 1, 0, 0) < 0){
+                if (errno == EINTR){
+                    continue;
+                }
+                if (errno == EAGAIN || errno == EBUSY){
+                    // 完成队列满或内核资源不足, 先取走完成项再重试
+                    WaitCompletion();
+                    continue;
+                }
+                std::cout << __FILE__ << " " << __LINE__ << " io_uring_enter failed" << std::endl;
+                perror(NULL);
+                // 出错时内核没有取走本次的提交项, 撤回后提交队列恢复原状
+                if (__atomic_load_n(_m_sq_head, __ATOMIC_ACQUIRE) == tail){
+                    __atomic_store_n(_m_sq_tail, tail, __ATOMIC_RELEASE);
+                    return false;
+                }
+                return true;
+            }
+            return true;
+        }
+
+        void SubmitWrite(Slot &slot) {
+            slot.iov.iov_base = &slot.data[slot.done];
+            slot.iov.iov_len = slot.data.size() - slot.done;
+            io_uring_sqe entry;
+            memset(&entry, 0, sizeof(entry));
+            entry.opcode = IORING_OP_WRITEV;
+            // 缓冲写入能在提交时直接完成, 会在io_uring_enter中同步执行; 强制交给内核工作线程, 提交后立即返回
+            entry.flags = IOSQE_ASYNC;
+            entry.fd = _m_fd;
+            entry.addr = reinterpret_cast<uint64_t>(&slot.iov);
+            entry.len = 1;
+            entry.off = slot.offset + slot.done;
+            entry.user_data = static_cast<uint64_t>(&slot - &_m_slots[0]);
+            if (!Submit(entry)){
+                // 改为同步写入剩余部分, 写入槽随即空闲
+                uint64_t offset = slot.offset + slot.done;
+                PwriteFull(&slot.data[slot.done], slot.data.size() - slot.done, &offset);
+                slot.busy = false;
+                --_m_writes;
+            }
+        }
+
+        void SubmitSync() {
+            io_uring_sqe entry;
+            memset(&entry, 0, sizeof(entry));
+            entry.opcode = IORING_OP_FSYNC;
+            entry.flags = IOSQE_IO_DRAIN;
+            entry.fd = _m_fd;
+            entry.fsync_flags = IORING_FSYNC_DATASYNC;
+            entry.user_data = kSyncTag;
+            ++_m_syncs;
+            if (!Submit(entry)){
+                --_m_syncs;
+                // 之前提交的写入完成后再同步
+                Drain();
+                SyncFd(_m_fd, SyncLevel::DATA);
+            }
+        }
+
+        // 取走所有已完成项, 不阻塞
+        void Reap() {
+            unsigned head = *_m_cq_head;
+            while (head != __atomic_load_n(_m_cq_tail, __ATOMIC_ACQUIRE)){
+                io_uring_cqe cqe = _m_cqes[head & _m_cq_mask];
+                ++head;
+                __atomic_store_n(_m_cq_head, head, __ATOMIC_RELEASE);
+                Complete(cqe.user_data, cqe.res);
+            }
+        }
+
+        // 阻塞等待至少一个完成项
+        // io_uring_enter出错时不能阻塞等待, 短暂休眠后直接检查完成队列, 已提交的写入完成后仍会出现在完成队列中
+        void WaitCompletion() {
+            while (Enter(_m_ring_fd, 0, 1, IORING_ENTER_GETEVENTS) < 0){
+                if (errno != EINTR){
+                    usleep(1000);
+                    break;
+                }
+            }
+            Reap();
+        }
+
+        void Complete(uint64_t user_data, int res) {
+            if (user_data == kSyncTag){
+                --_m_syncs;
+                if (res < 0){
+                    std::cout << __FILE__ << " " << __LINE__ << " fdatasync log file failed: " << strerror(-res) << std::endl;
+                }
+                return;
+            }
+            Slot &slot = _m_slots[user_data];
+            if (res == -EINTR || res == -EAGAIN){
+                SubmitWrite(slot);
+                return;
+            }
+            if (res <= 0){
+                std::cout << __FILE__ << " " << __LINE__ << " write log file failed: "
+                          << (res < 0 ? strerror(-res) : "no progress") << std::endl;
+            }
+            else{
+                slot.done += res;
+                if (slot.done < slot.data.size()){
+                    // 短写, 继续写入剩余部分
+                    SubmitWrite(slot);
+                    return;
+                }
+            }
+            slot.busy = false;
+            --_m_writes;
+        }
+
+        Slot *FreeSlot() {
+            for (auto &s : _m_slots){
+                if (!s.busy){
+                    return &s;
+                }
+            }
+            return nullptr;
+        }
+
+        // 从*offset处同步写入全部数据, *offset随写入前进, 出错返回false
+        bool PwriteFull(const char *data, size_t len, uint64_t *offset) {
+            while (len > 0){
+                ssize_t ret = pwrite(_m_fd, data, len, static_cast<off_t>(*offset));
+                if (ret == -1){
+                    if (errno == EINTR){
+                        continue;
+                    }
+                    std::cout << __FILE__ << " " << __LINE__ << " write log file failed" << std::endl;
+                    perror(NULL);
+                    return false;
+                }
+                data += ret;
+                len -= ret;
+                *offset += ret;
+            }
+            return true;
+        }
+
+        // 不支持io_uring时的同步写入
+        void FallbackWrite(const char *data, size_t len) {
+            if (PwriteFull(data, len, &_m_offset) && FlushLog() == 2 && fdatasync(_m_fd) == -1){
+                std::cout << __FILE__ << " " << __LINE__ << " fdatasync log file failed" << std::endl;
+                perror(NULL);
+            }
+        }
+
+    private:
+        enum { kDefaultDepth = 4 };                     // 默认同时在途的写入数
+        static const uint64_t kSyncTag = ~0ULL;         // fdatasync完成项的user_data
+
+        std::string _m_filename;
+        int _m_fd;
+        uint64_t _m_offset;             // 下一次写入的文件偏移
+
+        // io_uring的提交队列与完成队列, 由内核共享映射
+        int _m_ring_fd;
+        void *_m_sq_ptr;
+        void *_m_cq_ptr;
+        io_uring_sqe *_m_sqes;
+        size_t _m_sq_size;
+        size_t _m_cq_size;
+        size_t _m_sqes_size;
+        unsigned *_m_sq_head;
+        unsigned *_m_sq_tail;
+        unsigned *_m_sq_array;
+        unsigned _m_sq_mask;
+        unsigned _m_sq_entries;
+        unsigned *_m_cq_head;
+        unsigned *_m_cq_tail;
+        unsigned _m_cq_mask;
+        io_uring_cqe *_m_cqes;
+
+        size_t _m_writes;               // 在途的写入数
+        size_t _m_syncs;                // 在途的fdatasync数
+        std::vector<Slot> _m_slots;     // 写入槽, 每个槽同一时刻最多一个在途写入
+    };
+} // namespace Chronicle
@@ -16,6 +16,12 @@ namespace Chronicle {
         class Date {
         public:
             static time_t Now() { return time(nullptr); }
+            // 微秒级时间戳, clock_gettime通过vDSO实现, 不陷入内核
+            static int64_t NowMicros() {
+                struct timespec ts;
+                clock_gettime(CLOCK_REALTIME, &ts);
+                return static_cast<int64_t>(ts.tv_sec) * 1000000 + ts.tv_nsec / 1000;
+            }
         };
         
         class File {
@@ -171,21 +177,29 @@ namespace Chronicle {
                     Json::Value root;
                     Chronicle::Util::JsonUtil::UnSerialize(content, &root);
                     buffer_size = root["buffer_size"].asInt64();
+                    buffer_count = root["buffer_count"].asInt64();
                     threshold = root["threshold"].asInt64();
                     linear_growth = root["linear_growth"].asInt64();
                     flush_log = root["flush_log"].asInt64();
                     backup_addr = root["backup_addr"].asString();
                     backup_port = root["backup_port"].asInt();
                     thread_count = root["thread_count"].asInt();
+                    backup_queue_size = root["backup_queue_size"].asInt64();
+                    unsafe_memory_limit = root["unsafe_memory_limit"].asInt64();
+                    spill_dir = root["spill_dir"].asString();
                 }
             public:
                 size_t buffer_size;         // 缓冲区基础容量
+                size_t buffer_count;        // AsyncWorker缓冲池中的缓冲区个数(至少为2)
                 size_t threshold;           // 扩容方式阈值(超过该值采用线性增长, 否则指数增长)
                 size_t linear_growth;       // 线性增长单次容量
                 size_t flush_log;           // 控制日志同步到磁盘的时机，默认为0, 1调用fflush，2调用fsync
                 std::string backup_addr;    // 日志备份服务器
                 uint16_t backup_port;
                 size_t thread_count;        // 线程池线程数量
+                size_t backup_queue_size;   // 远程备份队列内存上限(字节), 超出后丢弃新日志
+                size_t unsafe_memory_limit; // ASYNC_UNSAFE缓冲池内存上限(字节), 超出后写入磁盘溢出段, 0表示不限制
+                std::string spill_dir;      // 磁盘溢出段所在目录, 默认/tmp
         };
     } // namespace Util
 } // namespace Chronicle
@@ -0,0 +1,741 @@
+//性能测试: ./bench [场景], 需要在test目录下运行以读取config.conf
+//  worker: 不同线程数下AsyncWorker各工作模式的写入吞吐
+//  alloc:  每次日志调用的堆分配次数
+//  fmt:    printf风格与{}风格接口的单次调用耗时
+//  binary: 文本模式与二进制模式的单次调用耗时及输出体积
+//  stall:  落盘缓慢(模拟fsync)时不同缓冲区个数下生产者的最长阻塞时间
+//  overflow: 落盘缓慢时不同溢出策略下生产者的最长单次调用耗时与丢弃数量
+//  spill:  ASYNC_UNSAFE在突发写入为内存上限10倍时, 不限制内存与限制内存(溢出到磁盘)的峰值RSS
+//  shards: 16个生产者线程在不同异步工作器分片数下的写入吞吐, 及按序号排序后的完整性检查
+//  sched:  32个日志器使用独立消费者线程与共享I/O线程时的线程数、吞吐及各日志器落盘进度的差异
+//  uring:  FileFlush与UringFileFlush在tmpfs和磁盘上、不同flush_log下Flush调用的阻塞时间与全部落盘的耗时
+//  mmap:   RollFileFlush与MmapFileFlush写入小块数据的吞吐、单次Flush最长耗时与CPU时间
+//  gzip:   FileFlush与GzipFileFlush写入日志文本的耗时、写入磁盘的字节数与CPU时间
+//  durability: 不同持久化策略在持续写入下的吞吐与同步次数, 及少量写入后Sync()屏障的延迟
+//  backup: 逐条短连接与长连接批量发送的远程备份吞吐, 需要先在config.conf配置的地址启动BackLogServer
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "../src/Chronicle.hpp"
+#include "../src/ThreadPool.hpp"
+#include "../src/Util.hpp"
+using std::cout;
+using std::endl;
+
+ThreadPool* thread_pool = nullptr;
+Chronicle::Util::JsonData* g_conf_data;
+
+//统计堆分配次数, 禁止内联以免编译器把new/delete与malloc/free配对检查时误报
+static std::atomic<size_t> g_alloc_count(0);
+__attribute__((noinline)) void* operator new(size_t size) {
+    ++g_alloc_count;
+    void* p = malloc(size);
+    if (p == nullptr) throw std::bad_alloc();
+    return p;
+}
+__attribute__((noinline)) void operator delete(void* p) noexcept { free(p); }
+__attribute__((noinline)) void operator delete(void* p, size_t) noexcept { free(p); }
+
+//空输出策略, 只用于测量日志器本身的开销
+class NullFlush : public Chronicle::LogFlush {
+public:
+    void Flush(const char*, size_t) override {}
+};
+
+static double Seconds(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+static const char* TypeName(Chronicle::AsyncType type) {
+    switch (type) {
+        case Chronicle::AsyncType::ASYNC_SAFE:
+            return "ASYNC_SAFE";
+        case Chronicle::AsyncType::ASYNC_UNSAFE:
+            return "ASYNC_UNSAFE";
+        case Chronicle::AsyncType::ASYNC_LOCKFREE:
+            return "ASYNC_LOCKFREE";
+    }
+    return "UNKNOW";
+}
+
+//多个生产者线程共写入total条记录, 统计从开始写入到消费者处理完全部数据的吞吐
+static void BenchWorker(Chronicle::AsyncType type, int threads, size_t total) {
+    std::string line(100, 'x');
+    line.back() = '\n';
+    std::atomic<size_t> consumed(0);
+    auto start = std::chrono::steady_clock::now();
+    {
+        Chronicle::AsyncWorker worker([&](Chronicle::Buffer& buf) {
+            consumed += buf.ReadableSize();
+        }, type);
+        std::vector<std::thread> producers;
+        for (int i = 0; i < threads; ++i) {
+            producers.emplace_back([&]() {
+                for (size_t n = 0; n < total / threads; ++n) {
+                    worker.Push(line.c_str(), line.size());
+                }
+            });
+        }
+        for (auto& t : producers) {
+            t.join();
+        }
+    }  // 析构时等待消费者处理完剩余数据
+    double sec = Seconds(start);
+    size_t records = consumed / line.size();
+    printf("%-16s threads=%-3d records=%-9zu %8.3fs %10.0f records/s\n",
+           TypeName(type), threads, records, sec, records / sec);
+}
+
+//统计单线程下每次Info调用的平均堆分配次数(预热后)
+static void BenchAlloc(const char* name, size_t staging_size) {
+    Chronicle::LoggerBuilder builder;
+    builder.SetLoggerName(name);
+    builder.SetStagingBuffer(staging_size);
+    builder.BuildLoggerFlush<NullFlush>();
+    Chronicle::AsyncLogger::ptr logger = builder.BuildLogger();
+    const size_t calls = 100000;
+    for (int i = 0; i < 1000; ++i) {
+        logger->Info("warm up %d %s", i, "payload");
+    }
+    size_t before = g_alloc_count;
+    auto start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < calls; ++i) {
+        logger->Info("request %zu done, status=%d, user=%s", i, 200, "chronicle");
+    }
+    double sec = Seconds(start);
+    printf("%-12s allocs/call=%.4f  %6.0f ns/call\n", name,
+           double(g_alloc_count - before) / calls, sec * 1e9 / calls);
+}
+
+//对比printf风格与{}风格接口的单次调用耗时
+static void BenchFmt() {
+    Chronicle::LoggerBuilder builder;
+    builder.SetLoggerName("fmt");
+    builder.BuildLoggerFlush<NullFlush>();
+    Chronicle::AsyncLogger::ptr logger = builder.BuildLogger();
+    const size_t calls = 200000;
+    std::string user = "chronicle";
+    auto start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < calls; ++i) {
+        logger->Info("request %zu done, status=%d, user=%s", i, 200, user.c_str());
+    }
+    printf("printf-style %6.0f ns/call\n", Seconds(start) * 1e9 / calls);
+    start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < calls; ++i) {
+        logger->InfoFmt("request {} done, status={}, user={}", i, 200, user);
+    }
+    printf("{}-style     %6.0f ns/call\n", Seconds(start) * 1e9 / calls);
+}
+
+//模拟慢速磁盘: 每次落盘耗时slow_ms, 缓冲区大小和个数决定生产者能够吸收多少突发写入
+static void BenchStall(size_t buffer_count, int slow_ms) {
+    std::string line(100, 'x');
+    line.back() = '\n';
+    const size_t total = 10000;
+    auto start = std::chrono::steady_clock::now();
+    int64_t max_stall = 0;
+    size_t stalls = 0;
+    {
+        Chronicle::AsyncWorker worker([&](Chronicle::Buffer&) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(slow_ms));
+        }, Chronicle::AsyncType::ASYNC_SAFE, buffer_count);
+        //每次突发写入1000条(约1.5个缓冲区)后暂停200ms, 平均写入速度低于落盘速度
+        for (size_t n = 0; n < total; ++n) {
+            worker.Push(line.c_str(), line.size());
+            if (n % 1000 == 999) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(200));
+            }
+        }
+        max_stall = worker.MaxStallMicros();
+        stalls = worker.StallCount();
+    }
+    printf("buffers=%-3zu slow_flush=%dms  max_stall=%7.2fms  stalls=%-5zu total=%.3fs\n", buffer_count,
+           slow_ms, max_stall / 1000.0, stalls, Seconds(start));
+}
+
+//慢速输出策略: 统计收到的记录, ERROR记录和丢弃汇总行
+class SlowFlush : public Chronicle::LogFlush {
+public:
+    SlowFlush(int slow_ms, size_t* lines, size_t* errors, size_t* summaries)
+        : _m_slow_ms(slow_ms), _m_lines(lines), _m_errors(errors), _m_summaries(summaries) {}
+    void Flush(const char* data, size_t len) override {
+        std::string text(data, len);
+        for (size_t pos = 0; (pos = text.find('\n', pos)) != std::string::npos; ++pos) {
+            ++*_m_lines;
+        }
+        for (size_t pos = 0; (pos = text.find("[ERROR]", pos)) != std::string::npos; ++pos) {
+            ++*_m_errors;
+        }
+        for (size_t pos = 0; (pos = text.find("records dropped", pos)) != std::string::npos; ++pos) {
+            ++*_m_summaries;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(_m_slow_ms));
+    }
+private:
+    int _m_slow_ms;
+    size_t* _m_lines;
+    size_t* _m_errors;
+    size_t* _m_summaries;
+};
+
+//DEBUG按指定策略处理溢出, ERROR始终阻塞; 每1000条DEBUG写1条ERROR, 只统计DEBUG调用的最长耗时
+static void BenchOverflow(const char* name, Chronicle::OverflowPolicy policy, uint32_t timeout_ms, uint32_t rate) {
+    size_t lines = 0, errors = 0, summaries = 0, dropped = 0;
+    const size_t total = 20000;
+    double worst = 0;
+    auto start = std::chrono::steady_clock::now();
+    {
+        Chronicle::LoggerBuilder builder;
+        builder.SetLoggerName("overflow");
+        builder.SetOverflowPolicy(Chronicle::LogLevel::value::DEBUG, policy, timeout_ms, rate);
+        builder.BuildLoggerFlush<SlowFlush>(20, &lines, &errors, &summaries);
+        Chronicle::AsyncLogger::ptr logger = builder.BuildLogger();
+        for (size_t i = 0; i < total; ++i) {
+            if (i % 1000 == 999) {
+                logger->Error("request %zu failed", i);
+                continue;
+            }
+            auto t = std::chrono::steady_clock::now();
+            logger->Debug("request %zu debug detail", i);
+            worst = std::max(worst, Seconds(t));
+        }
+        dropped = logger->DroppedRecords();
+    }
+    printf("%-13s worst_debug=%7.2fms  delivered=%-6zu dropped=%-6zu errors=%-3zu summaries=%-3zu total=%.3fs\n",
+           name, worst * 1000, lines - summaries, dropped, errors, summaries, Seconds(start));
+}
+
+//在子进程中运行ASYNC_UNSAFE突发写入, 由父进程读取子进程的峰值RSS
+static void BenchSpill(const char* name, size_t memory_limit) {
+    const size_t burst = 80 * 1024 * 1024;
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid == 0) {
+        g_conf_data->buffer_size = 1024 * 1024;
+        g_conf_data->buffer_count = 2;
+        g_conf_data->unsafe_memory_limit = memory_limit;
+        std::string line(100, 'x');
+        line.back() = '\n';
+        size_t consumed = 0, spilled = 0;
+        auto start = std::chrono::steady_clock::now();
+        {
+            Chronicle::AsyncWorker worker([&](Chronicle::Buffer& buf) {
+                consumed += buf.ReadableSize();
+                std::this_thread::sleep_for(std::chrono::milliseconds(50));
+            }, Chronicle::AsyncType::ASYNC_UNSAFE);
+            for (size_t n = 0; n < burst / line.size(); ++n) {
+                worker.Push(line.c_str(), line.size());
+            }
+            spilled = worker.SpilledBytes();
+        }
+        printf("%-10s limit=%-4zuMB burst=%zuMB delivered=%zuMB spilled=%zuMB %.3fs", name, memory_limit >> 20,
+               burst >> 20, consumed >> 20, spilled >> 20, Seconds(start));
+        fflush(stdout);
+        _exit(0);
+    }
+    int status = 0;
+    struct rusage usage;
+    wait4(pid, &status, 0, &usage);
+    printf("  peak_rss=%ldMB\n", usage.ru_maxrss >> 10);
+}
+
+//统计输出字节数的空输出策略
+class CountFlush : public Chronicle::LogFlush {
+public:
+    explicit CountFlush(size_t* bytes) : _m_bytes(bytes) {}
+    void Flush(const char*, size_t len) override { *_m_bytes += len; }
+private:
+    size_t* _m_bytes;
+};
+
+//收集记录头部的[#序号], 用于检查多分片输出排序后是否完整
+class SequenceFlush : public Chronicle::LogFlush {
+public:
+    explicit SequenceFlush(std::vector<uint64_t>* seqs) : _m_seqs(seqs) {}
+    void Flush(const char* data, size_t len) override {
+        const char* end = data + len;
+        for (const char* p = data; p < end;) {
+            if (end - p > 2 && p[0] == '[' && p[1] == '#') {
+                _m_seqs->push_back(strtoull(p + 2, nullptr, 10));
+            }
+            const char* nl = static_cast<const char*>(memchr(p, '\n', end - p));
+            p = nl ? nl + 1 : end;
+        }
+    }
+private:
+    std::vector<uint64_t>* _m_seqs;
+};
+
+//16个线程共写入total条记录, 统计到全部落盘为止的吞吐; 带序号时检查排序后序号是否连续
+static void BenchShards(size_t shards, bool sequence, size_t total) {
+    const int threads = 16;
+    std::vector<uint64_t> seqs;
+    size_t bytes = 0;
+    auto start = std::chrono::steady_clock::now();
+    {
+        Chronicle::LoggerBuilder builder;
+        builder.SetLoggerName("shards");
+        builder.SetShards(shards, sequence);
+        if (sequence) {
+            seqs.reserve(total + 16);
+            builder.BuildLoggerFlush<SequenceFlush>(&seqs);
+        } else {
+            builder.BuildLoggerFlush<CountFlush>(&bytes);
+        }
+        Chronicle::AsyncLogger::ptr logger = builder.BuildLogger();
+        std::vector<std::thread> producers;
+        for (int t = 0; t < threads; ++t) {
+            producers.emplace_back([&, t]() {
+                for (size_t i = 0; i < total / threads; ++i) {
+                    logger->InfoFmt("thread {} request {} done", t, i);
+                }
+            });
+        }
+        for (auto& th : producers) th.join();
+    }
+    double sec = Seconds(start);
+    printf("shards=%-3zu sequence=%-3s %8.0f rec/s", shards, sequence ? "on" : "off", total / sec);
+    if (sequence) {
+        std::sort(seqs.begin(), seqs.end());
+        bool complete = seqs.size() == total;
+        for (size_t i = 0; complete && i < seqs.size(); ++i) {
+            complete = seqs[i] == i;
+        }
+        printf("  sorted=%zu %s", seqs.size(), complete ? "complete" : "BROKEN");
+    }
+    printf("\n");
+}
+
+//进程当前的线程数
+static int ThreadCount() {
+    FILE* fp = fopen("/proc/self/status", "r");
+    if (fp == nullptr) return -1;
+    char line[256];
+    int threads = -1;
+    while (fgets(line, sizeof(line), fp)) {
+        if (sscanf(line, "Threads: %d", &threads) == 1) break;
+    }
+    fclose(fp);
+    return threads;
+}
+
+//统计记录条数, 多个日志器各自一个实例
+class LineCountFlush : public Chronicle::LogFlush {
+public:
+    explicit LineCountFlush(std::atomic<size_t>* lines) : _m_lines(lines) {}
+    void Flush(const char* data, size_t len) override {
+        size_t n = 0;
+        for (const char* p = data; (p = static_cast<const char*>(memchr(p, '\n', data + len - p))); ++p) ++n;
+        *_m_lines += n;
+        std::this_thread::sleep_for(std::chrono::microseconds(200));  // 模拟落盘开销
+    }
+private:
+    std::atomic<size_t>* _m_lines;
+};
+
+//loggers个日志器, 4个生产者线程轮流写入各日志器; io_threads为0时每个日志器使用独立的消费者线程
+//写入一半时记录各日志器已落盘条数的最小/最大值, 衡量各日志器得到服务的公平性
+static void BenchSched(size_t io_threads, size_t loggers, size_t total) {
+    const int producers = 4;
+    std::vector<std::atomic<size_t>> lines(loggers);
+    for (auto& l : lines) l = 0;
+    int threads = 0;
+    size_t min_half = 0, max_half = 0;
+    auto start = std::chrono::steady_clock::now();
+    {
+        Chronicle::FlushScheduler::ptr scheduler;
+        if (io_threads > 0) scheduler = std::make_shared<Chronicle::FlushScheduler>(io_threads);
+        std::vector<Chronicle::AsyncLogger::ptr> group;
+        for (size_t i = 0; i < loggers; ++i) {
+            Chronicle::LoggerBuilder builder;
+            builder.SetLoggerName("sched-" + std::to_string(i));
+            builder.SetFlushScheduler(scheduler);
+            builder.BuildLoggerFlush<LineCountFlush>(&lines[i]);
+            group.push_back(builder.BuildLogger());
+        }
+        threads = ThreadCount();
+        std::atomic<size_t> written(0);
+        std::vector<std::thread> workers;
+        for (int t = 0; t < producers; ++t) {
+            workers.emplace_back([&, t]() {
+                for (size_t i = 0; i < total / producers; ++i) {
+                    group[(i + t) % loggers]->Info("request %zu done", i);
+                    if (++written == total / 2) {
+                        min_half = max_half = lines[0];
+                        for (auto& l : lines) {
+                            min_half = std::min<size_t>(min_half, l);
+                            max_half = std::max<size_t>(max_half, l);
+                        }
+                    }
+                }
+            });
+        }
+        for (auto& th : workers) th.join();
+    }
+    printf("io_threads=%-3zu loggers=%-3zu threads=%-4d %8.0f rec/s  at_half: min=%zu max=%zu\n", io_threads,
+           loggers, threads, total / Seconds(start), min_half, max_half);
+}
+
+//直接调用输出策略写入blocks个block_size的块, 分别统计Flush调用累计阻塞的时间(消费者线程不能处理下一块的时间)
+//和到全部写入完成(flush_log为2时全部fdatasync完成)的总耗时
+template <typename FlushType>
+static void BenchUring(const char* fs, const char* name, const std::string& dir, int flush_log, size_t block_size,
+                       size_t blocks) {
+    std::string path = dir + "/chronicle-bench-uring.log";
+    unlink(path.c_str());
+    int saved = g_conf_data->flush_log;
+    g_conf_data->flush_log = flush_log;
+    std::string block(block_size, 'x');
+    block.back() = '\n';
+    double in_flush = 0;
+    auto start = std::chrono::steady_clock::now();
+    {
+        FlushType sink(path);
+        for (size_t i = 0; i < blocks; ++i) {
+            auto t = std::chrono::steady_clock::now();
+            sink.Flush(block.data(), block.size());
+            in_flush += Seconds(t);
+        }
+        sink.Drain();
+    }
+    double sec = Seconds(start);
+    g_conf_data->flush_log = saved;
+    struct stat st;
+    long long size = stat(path.c_str(), &st) == 0 ? static_cast<long long>(st.st_size) : -1;
+    unlink(path.c_str());
+    printf("%-6s flush_log=%d %-15s in_flush=%7.3fs total=%7.3fs %7.1f MB/s  file=%lldB\n", fs, flush_log, name,
+           in_flush, sec, block_size * blocks / sec / 1e6, size);
+}
+
+//直接调用输出策略写入total字节(每次block_size), 统计耗时、单次Flush最长耗时与进程的用户态/内核态CPU时间,
+//结束后删除生成的文件
+template <typename FlushType>
+static void BenchMmap(const char* name, const std::string& dir, int flush_log, size_t block_size, size_t total) {
+    std::string prefix = dir + "/chronicle-bench-mmap-";
+    int saved = g_conf_data->flush_log;
+    g_conf_data->flush_log = flush_log;
+    std::string block(block_size, 'x');
+    block.back() = '\n';
+    struct rusage before, after;
+    double worst = 0;
+    getrusage(RUSAGE_SELF, &before);
+    auto start = std::chrono::steady_clock::now();
+    {
+        FlushType sink(prefix, 64 * 1024 * 1024);
+        for (size_t n = 0; n < total; n += block_size) {
+            auto t = std::chrono::steady_clock::now();
+            sink.Flush(block.data(), block.size());
+            auto d = std::chrono::steady_clock::now() - t;
+            worst = std::max(worst, std::chrono::duration<double>(d).count());
+        }
+    }
+    double sec = Seconds(start);
+    getrusage(RUSAGE_SELF, &after);
+    g_conf_data->flush_log = saved;
+    auto cpu = [](const timeval& a, const timeval& b) { return (b.tv_sec - a.tv_sec) + (b.tv_usec - a.tv_usec) / 1e6; };
+    std::string cmd = "rm -f " + prefix + "*";
+    if (system(cmd.c_str()) != 0) cout << "cleanup failed: " << cmd << endl;
+    printf("%-14s flush_log=%d block=%-6zu %7.3fs %7.1f MB/s  worst_flush=%6.2fms user=%.3fs sys=%.3fs\n", name,
+           flush_log, block_size, sec, total / sec / 1e6, worst * 1000, cpu(before.ru_utime, after.ru_utime),
+           cpu(before.ru_stime, after.ru_stime));
+}
+
+//通过日志器写入total条日志, 统计到全部落盘的耗时、文件大小与进程CPU时间, 结束后删除生成的文件
+template <typename FlushType, typename... Args>
+static void BenchGzip(const char* name, const std::string& path, size_t total, Args&&... args) {
+    unlink(path.c_str());
+    struct rusage before, after;
+    getrusage(RUSAGE_SELF, &before);
+    auto start = std::chrono::steady_clock::now();
+    {
+        Chronicle::LoggerBuilder builder;
+        builder.SetLoggerName("gzip");
+        builder.BuildLoggerFlush<FlushType>(path, std::forward<Args>(args)...);
+        Chronicle::AsyncLogger::ptr logger = builder.BuildLogger();
+        for (size_t i = 0; i < total; ++i) {
+            logger->InfoFmt("request {} from 10.0.{}.{} done in {} us, status {}", i, i % 256, i % 7, i % 1000, 200);
+        }
+    }
+    double sec = Seconds(start);
+    getrusage(RUSAGE_SELF, &after);
+    struct stat st;
+    size_t size = stat(path.c_str(), &st) == 0 ? static_cast<size_t>(st.st_size) : 0;
+    unlink(path.c_str());
+    auto cpu = [](const timeval& a, const timeval& b) { return (b.tv_sec - a.tv_sec) + (b.tv_usec - a.tv_usec) / 1e6; };
+    printf("%-14s %7.3fs %8.0f rec/s  file=%-10zu user=%.3fs sys=%.3fs\n", name, sec, total / sec, size,
+           cpu(before.ru_utime, after.ru_utime), cpu(before.ru_stime, after.ru_stime));
+}
+
+//持续写入total条日志(每100条一条ERROR)统计吞吐与同步次数, 再测量rounds轮"写100条 + Sync()"中Sync()的平均/最长耗时
+//flush_log为2且不设置策略时即原有的每批fsync
+static void BenchDurability(const char* name, const Chronicle::DurabilityPolicy& policy, int flush_log, size_t total) {
+    const std::string path = "/var/tmp/chronicle-bench-durability.log";
+    const int rounds = 20;
+    unlink(path.c_str());
+    int saved = g_conf_data->flush_log;
+    g_conf_data->flush_log = flush_log;
+    double sec = 0, barrier_sum = 0, barrier_max = 0;
+    size_t syncs = 0;
+    {
+        Chronicle::LoggerBuilder builder;
+        builder.SetLoggerName("durability");
+        builder.SetDurability(policy);
+        builder.BuildLoggerFlush<Chronicle::FileFlush>(path);
+        Chronicle::AsyncLogger::ptr logger = builder.BuildLogger();
+        auto start = std::chrono::steady_clock::now();
+        for (size_t i = 0; i < total; ++i) {
+            if (i % 100 == 99) {
+                logger->ErrorFmt("request {} failed", i);
+            } else {
+                logger->InfoFmt("request {} done", i);
+            }
+        }
+        logger->Sync();
+        sec = Seconds(start);
+        syncs = logger->SyncCount();
+        for (int r = 0; r < rounds; ++r) {
+            for (int i = 0; i < 100; ++i) {
+                logger->InfoFmt("round {} request {} done", r, i);
+            }
+            auto t = std::chrono::steady_clock::now();
+            logger->Sync();
+            double d = Seconds(t);
+            barrier_sum += d;
+            barrier_max = std::max(barrier_max, d);
+        }
+    }
+    g_conf_data->flush_log = saved;
+    unlink(path.c_str());
+    printf("%-14s flush_log=%d %8.0f rec/s  syncs=%-6zu barrier avg=%6.2fms max=%6.2fms\n", name, flush_log,
+           total / sec, syncs, barrier_sum / rounds * 1000, barrier_max * 1000);
+}
+
+//对比文本模式与二进制模式: 生产者单次调用耗时与写入输出策略的字节数
+static void BenchBinary(const char* name, bool binary) {
+    size_t bytes = 0;
+    const size_t calls = 200000;
+    double sec = 0;
+    {
+        Chronicle::LoggerBuilder builder;
+        builder.SetLoggerName(name);
+        if (binary) {
+            builder.SetBinaryMode("./logfile/bench.registry");
+        }
+        builder.BuildLoggerFlush<CountFlush>(&bytes);
+        Chronicle::AsyncLogger::ptr logger = builder.BuildLogger();
+        std::string user = "chronicle";
+        auto start = std::chrono::steady_clock::now();
+        for (size_t i = 0; i < calls; ++i) {
+            logger->InfoFmt("request {} done, status={}, user={}, cost={}ms", i, 200, user, 0.25);
+        }
+        sec = Seconds(start);
+    }  // 析构时等待全部数据写入输出策略
+    printf("%-8s %6.0f ns/call  %6.1f bytes/record\n", name, sec * 1e9 / calls, double(bytes) / calls);
+}
+
+//结构化接口在各编码格式下的生产者单次调用耗时与每条记录的字节数
+static void BenchKv(const char* name, Chronicle::LogFormat format) {
+    size_t bytes = 0;
+    const size_t calls = 200000;
+    double sec = 0;
+    {
+        Chronicle::LoggerBuilder builder;
+        builder.SetLoggerName(name);
+        builder.SetFormat(format);
+        builder.BuildLoggerFlush<CountFlush>(&bytes);
+        Chronicle::AsyncLogger::ptr logger = builder.BuildLogger();
+        std::string user = "chronicle";
+        auto start = std::chrono::steady_clock::now();
+        for (size_t i = 0; i < calls; ++i) {
+            logger->InfoKv("request done", Chronicle::Kv("id", i), Chronicle::Kv("status", 200),
+                           Chronicle::Kv("user", user), Chronicle::Kv("cost_ms", 0.25));
+        }
+        sec = Seconds(start);
+    }
+    printf("%-8s %6.0f ns/call  %6.1f bytes/record\n", name, sec * 1e9 / calls, double(bytes) / calls);
+}
+
+//日志风暴: threads个线程在同一调用点连续输出相同的ERROR日志, 对比生产者单次调用耗时与实际写入的条数
+static void BenchStorm(const char* name, const Chronicle::StormPolicy& policy, int threads, size_t total) {
+    Chronicle::LoggerBuilder builder;
+    builder.SetLoggerName(name);
+    builder.SetStormPolicy(policy);
+    builder.BuildLoggerFlush<NullFlush>();
+    Chronicle::AsyncLogger::ptr logger = builder.BuildLogger();
+    //ERROR日志会触发远程备份, 测试期间关闭标准输出中的连接错误信息
+    std::streambuf* old = cout.rdbuf(nullptr);
+    auto start = std::chrono::steady_clock::now();
+    std::vector<std::thread> workers;
+    for (int t = 0; t < threads; ++t) {
+        workers.emplace_back([&]() {
+            for (size_t i = 0; i < total / threads; ++i) {
+                logger->Error("dependency %s unavailable", "db");
+            }
+        });
+    }
+    for (auto& w : workers) {
+        w.join();
+    }
+    double sec = Seconds(start);
+    logger->Sync();
+    cout.rdbuf(old);
+    size_t dropped = logger->StormSuppressed() + logger->StormCollapsed();
+    printf("%-16s %6.0f ns/call  written=%zu\n", name, sec * 1e9 / total, total - dropped);
+}
+
+//对比start_backup(每条日志一次连接)与BackupClient(长连接, 每批一次writev)
+static void BenchBackup() {
+    const size_t records = 20000;
+    const size_t per_message = 200;    //逐条连接很慢, 只发送少量记录
+    const size_t batch = 64;
+    std::string line = "[00:00:00.000][0x0][ERROR][bench][bench.cpp:0]\tbackup benchmark record\n";
+
+    //start_backup每次调用都会输出连接信息, 测试期间关闭标准输出
+    std::streambuf* old = cout.rdbuf(nullptr);
+    auto start = std::chrono::steady_clock::now();
+    size_t ok = 0;
+    for (size_t i = 0; i < per_message; ++i) {
+        ok += start_backup(line, 0);
+    }
+    double sec = Seconds(start);
+    cout.rdbuf(old);
+    printf("per-message  sent=%-6zu %8.0f records/s  connects=%zu\n", ok, ok / sec, ok);
+
+    BackupClient client;
+    std::vector<struct iovec> iov;
+    start = std::chrono::steady_clock::now();
+    ok = 0;
+    for (size_t i = 0; i < records; i += batch) {
+        iov.clear();
+        for (size_t n = 0; n < batch && i + n < records; ++n) {
+            iov.push_back({&line[0], line.size()});
+        }
+        if (client.Send(iov.data(), iov.size())) {
+            ok += iov.size();
+        }
+    }
+    sec = Seconds(start);
+    printf("pooled       sent=%-6zu %8.0f records/s  connects=%zu  syscalls=%zu\n",
+           ok, ok / sec, client.Connects(), client.Syscalls());
+}
+
+int main(int argc, char* argv[]) {
+    g_conf_data = Chronicle::Util::JsonData::GetJsonData();
+    std::string scenario = argc > 1 ? argv[1] : "worker";
+
+    if (scenario == "worker") {
+        const size_t total = 2000000;
+        int thread_nums[] = {1, 4, 16, 64};
+        for (int threads : thread_nums) {
+            BenchWorker(Chronicle::AsyncType::ASYNC_SAFE, threads, total);
+            BenchWorker(Chronicle::AsyncType::ASYNC_LOCKFREE, threads, total);
+        }
+    } else if (scenario == "alloc") {
+        BenchAlloc("shared", 0);
+        BenchAlloc("staging", 64 * 1024);
+    } else if (scenario == "fmt") {
+        BenchFmt();
+    } else if (scenario == "binary") {
+        BenchBinary("text", false);
+        BenchBinary("binary", true);
+    } else if (scenario == "kv") {
+        BenchKv("text", Chronicle::LogFormat::TEXT);
+        BenchKv("json", Chronicle::LogFormat::JSON);
+        BenchKv("logfmt", Chronicle::LogFormat::LOGFMT);
+    } else if (scenario == "storm") {
+        const size_t total = 400000;
+        Chronicle::StormPolicy none, rate, collapse;
+        rate.rate = 100;
+        collapse.collapse_repeats = true;
+        BenchStorm("none", none, 4, total);
+        BenchStorm("rate=100/s", rate, 4, total);
+        BenchStorm("collapse", collapse, 4, total);
+    } else if (scenario == "stall") {
+        //缩小单个缓冲区, 让每次突发写入都能写满一个缓冲区
+        g_conf_data->buffer_size = 64 * 1024;
+        size_t counts[] = {2, 4, 8};
+        for (size_t k : counts) {
+            BenchStall(k, 50);
+        }
+    } else if (scenario == "overflow") {
+        g_conf_data->buffer_size = 16 * 1024;
+        g_conf_data->buffer_count = 2;
+        BenchOverflow("block", Chronicle::OverflowPolicy::BLOCK, 0, 0);
+        BenchOverflow("block-5ms", Chronicle::OverflowPolicy::BLOCK_TIMEOUT, 5, 0);
+        BenchOverflow("drop-newest", Chronicle::OverflowPolicy::DROP_NEWEST, 0, 0);
+        BenchOverflow("drop-oldest", Chronicle::OverflowPolicy::DROP_OLDEST, 0, 0);
+        BenchOverflow("sample-1/10", Chronicle::OverflowPolicy::SAMPLE, 0, 10);
+    } else if (scenario == "spill") {
+        BenchSpill("unbounded", 0);
+        BenchSpill("bounded", 8 * 1024 * 1024);
+    } else if (scenario == "shards") {
+        const size_t total = 1600000;
+        size_t shard_nums[] = {1, 2, 4, 8, 16};
+        for (size_t shards : shard_nums) {
+            BenchShards(shards, false, total);
+            BenchShards(shards, true, total);
+        }
+    } else if (scenario == "sched") {
+        BenchSched(0, 32, 400000);
+        BenchSched(1, 32, 400000);
+        BenchSched(2, 32, 400000);
+        BenchSched(4, 32, 400000);
+    } else if (scenario == "uring") {
+        const size_t block_size = 1024 * 1024, blocks = 256;
+        int modes[] = {0, 2};
+        for (int flush_log : modes) {
+            BenchUring<Chronicle::FileFlush>("tmpfs", "FileFlush", "/dev/shm", flush_log, block_size, blocks);
+            BenchUring<Chronicle::UringFileFlush>("tmpfs", "UringFileFlush", "/dev/shm", flush_log, block_size, blocks);
+            BenchUring<Chronicle::FileFlush>("disk", "FileFlush", "/var/tmp", flush_log, block_size, blocks);
+            BenchUring<Chronicle::UringFileFlush>("disk", "UringFileFlush", "/var/tmp", flush_log, block_size, blocks);
+        }
+    } else if (scenario == "mmap") {
+        const size_t total = 512 * 1024 * 1024;
+        size_t blocks[] = {4096, 65536};
+        int modes[] = {0, 1};
+        for (int flush_log : modes) {
+            for (size_t block : blocks) {
+                BenchMmap<Chronicle::RollFileFlush>("RollFileFlush", "/var/tmp", flush_log, block, total);
+                BenchMmap<Chronicle::MmapFileFlush>("MmapFileFlush", "/var/tmp", flush_log, block, total);
+            }
+        }
+    } else if (scenario == "gzip") {
+        const size_t total = 2000000;
+        BenchGzip<Chronicle::FileFlush>("FileFlush", "/var/tmp/chronicle-bench-gzip.log", total);
+        BenchGzip<Chronicle::GzipFileFlush>("Gzip level=1", "/var/tmp/chronicle-bench-gzip.log.gz", total, 1);
+        BenchGzip<Chronicle::GzipFileFlush>("Gzip level=6", "/var/tmp/chronicle-bench-gzip.log.gz", total, 6);
+    } else if (scenario == "durability") {
+        const size_t total = 500000;
+        Chronicle::DurabilityPolicy none, batch, interval, bytes, on_error, behind;
+        batch.every_batch = true;
+        interval.interval_ms = 10;
+        bytes.bytes = 1024 * 1024;
+        on_error.on_error = true;
+        behind.bytes = 1024 * 1024;
+        behind.level = Chronicle::SyncLevel::WRITE_BEHIND;
+        BenchDurability("none", none, 0, total);
+        BenchDurability("fsync/batch", none, 2, total);
+        BenchDurability("every-batch", batch, 0, total);
+        BenchDurability("interval-10ms", interval, 0, total);
+        BenchDurability("bytes-1MB", bytes, 0, total);
+        BenchDurability("on-error", on_error, 0, total);
+        BenchDurability("behind-1MB", behind, 0, total);
+    } else if (scenario == "backup") {
+        BenchBackup();
+    } else {
+        cout << "unknown scenario: " << scenario << endl;
+        return -1;
+    }
+    return 0;
+}
@@ -1,3 +1,6 @@
+#include <future>
+#include <unistd.h>
+
 #include "../src/Chronicle.hpp"
 #include "../src/ThreadPool.hpp"
 #include "../src/Util.hpp"
@@ -16,22 +19,74 @@ void test() {
         Chronicle::GetLogger("asynclogger")->Debug("测试日志-%d", cnt++);
         Chronicle::GetLogger("asynclogger")->Error("测试日志-%d", cnt++);
         Chronicle::GetLogger("asynclogger")->Fatal("测试日志-%d", cnt++);
+        Chronicle::GetLogger("asynclogger")->InfoFmt("测试日志-{}", cnt++);
+        //超过500字符的格式串也能通过编译期检查
+        Chronicle::GetLogger("asynclogger")->InfoFmt("长格式串-{} "
+            "0123456789012345678901234567890123456789012345678-" "0123456789012345678901234567890123456789012345678-"
+            "0123456789012345678901234567890123456789012345678-" "0123456789012345678901234567890123456789012345678-"
+            "0123456789012345678901234567890123456789012345678-" "0123456789012345678901234567890123456789012345678-"
+            "0123456789012345678901234567890123456789012345678-" "0123456789012345678901234567890123456789012345678-"
+            "0123456789012345678901234567890123456789012345678-" "0123456789012345678901234567890123456789012345678-"
+            "0123456789012345678901234567890123456789012345678-" "0123456789012345678901234567890123456789012345678-"
+            "0123456789012345678901234567890123456789012345678-" "0123456789012345678901234567890123456789012345678-"
+            "0123456789012345678901234567890123456789012345678-" "0123456789012345678901234567890123456789012345678-" "{{}}-{}", cnt++, cur_size);
+        Chronicle::GetLogger("asynclogger")->InfoKv("测试日志", Chronicle::Kv("cnt", cnt++), Chronicle::Kv("size", cur_size));
     }
 }
 
+//无锁模式: 接近环形缓冲区容量的大记录需要跨越环尾时也能写入, 不会让生产者一直等待
+bool test_ring_wrap() {
+    size_t old_size = g_conf_data->buffer_size;
+    g_conf_data->buffer_size = 4096;
+    std::atomic<size_t> consumed(0);
+    bool ok = true;
+    {
+        Chronicle::AsyncWorker worker([&](Chronicle::Buffer& buf) {
+            consumed += buf.ReadableSize();
+        }, Chronicle::AsyncType::ASYNC_LOCKFREE);
+        std::string small(2000, 's'), large(3000, 'l');
+        auto pushed = std::async(std::launch::async, [&]() {
+            worker.Push(small.data(), small.size());
+            worker.Barrier();
+            worker.Push(large.data(), large.size());
+            worker.Barrier();
+        });
+        if (pushed.wait_for(std::chrono::seconds(5)) != std::future_status::ready) {
+            cout << "ring wrap: producer stuck" << endl;
+            _exit(1);
+        }
+        ok = consumed == small.size() + large.size();
+    }
+    g_conf_data->buffer_size = old_size;
+    cout << "ring wrap: " << (ok ? "ok" : "failed") << endl;
+    return ok;
+}
+
 void init_thread_pool() {
     thread_pool = new ThreadPool(g_conf_data->thread_count);
 }
 int main() {
     g_conf_data = Chronicle::Util::JsonData::GetJsonData();
     init_thread_pool();
+    if (!test_ring_wrap()) {
+        return 1;
+    }
     std::shared_ptr<Chronicle::LoggerBuilder> CLoggerBuilder(new Chronicle::LoggerBuilder());
     CLoggerBuilder->SetLoggerName("asynclogger");
     //CLoggerBuilder->BuildLoggerFlush<Chronicle::FileFlush>("./test1/test2/test3/logfile/FileFlush.log");
     //CLoggerBuilder->BuildLoggerFlush<Chronicle::RollFileFlush>("./test1/test2/test3/logfile/RollFile_log", 1024 * 1024); 
     //写日志方式
     CLoggerBuilder->BuildLoggerFlush<Chronicle::FileFlush>("./logfile/FileFlush.log");
-    CLoggerBuilder->BuildLoggerFlush<Chronicle::RollFileFlush>("./logfile/RollFile_log", 1024 * 1024);
+    //按大小和天滚动, 只保留最近4个已关闭的滚动文件
+    Chronicle::RetentionPolicy retention;
+    retention.max_files = 4;
+    CLoggerBuilder->BuildLoggerFlush<Chronicle::RollFileFlush>("./logfile/RollFile_log", 1024 * 1024,
+                                                                Chronicle::RollInterval::DAILY, retention);
+    //告警文件只接收ERROR及以上的日志
+    Chronicle::FlushRoute error_route;
+    error_route.min_level = Chronicle::LogLevel::value::ERROR;
+    CLoggerBuilder->BuildLoggerFlush<Chronicle::FileFlush>("./logfile/Error.log");
+    CLoggerBuilder->SetFlushRoute(error_route);
 
     // 日志器参数已经设置完成，由LoggerManger类成员管理所有日志器
     // 调用者通过调用单例LoggerManager对象对日志进行落盘
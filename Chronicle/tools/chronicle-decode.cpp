@@ -0,0 +1,76 @@
+//二进制日志解码工具: 根据调用点登记表将二进制日志文件还原为文本
+//用法: ./chronicle-decode <登记表文件> <二进制日志文件>... [-t time|datetime|iso8601] [-p s|ms|us]
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "../src/BinaryLog.hpp"
+#include "../src/Util.hpp"
+
+Chronicle::Util::JsonData *g_conf_data = nullptr;
+
+static void Usage(const char *prog) {
+    std::cout << "usage: " << prog
+              << " <registry> <binary log>... [-t time|datetime|iso8601] [-p s|ms|us]" << std::endl;
+}
+
+int main(int argc, char *argv[]) {
+    Chronicle::TimeFormat time_fmt = Chronicle::TimeFormat::TIME;
+    Chronicle::TimePrecision time_prec = Chronicle::TimePrecision::MILLI;
+    std::vector<std::string> paths;
+    for (int i = 1; i < argc; ++i){
+        if (strcmp(argv[i], "-t") == 0 && i + 1 < argc){
+            std::string v = argv[++i];
+            if (v == "datetime"){
+                time_fmt = Chronicle::TimeFormat::DATETIME;
+            }
+            else if (v == "iso8601"){
+                time_fmt = Chronicle::TimeFormat::ISO8601_UTC;
+            }
+        }
+        else if (strcmp(argv[i], "-p") == 0 && i + 1 < argc){
+            std::string v = argv[++i];
+            if (v == "s"){
+                time_prec = Chronicle::TimePrecision::SECOND;
+            }
+            else if (v == "us"){
+                time_prec = Chronicle::TimePrecision::MICRO;
+            }
+        }
+        else{
+            paths.push_back(argv[i]);
+        }
+    }
+    if (paths.size() < 2){
+        Usage(argv[0]);
+        return -1;
+    }
+
+    std::string logger;
+    Chronicle::Binary::SiteTable sites;
+    if (!Chronicle::Binary::Registry::Load(paths[0], &logger, &sites.sites)){
+        std::cout << "load registry failed: " << paths[0] << std::endl;
+        return -1;
+    }
+    auto lookup = [&sites](uint32_t id) -> const Chronicle::Binary::SiteInfo * {
+        return sites.Find(id);
+    };
+
+    for (size_t i = 1; i < paths.size(); ++i){
+        std::string content, text;
+        Chronicle::Util::File file;
+        if (!file.GetContent(&content, paths[i])){
+            std::cout << "read log failed: " << paths[i] << std::endl;
+            return -1;
+        }
+        size_t used = Chronicle::Binary::Render(text, content.data(), content.size(), lookup,
+                                                logger, time_fmt, time_prec);
+        fwrite(text.data(), 1, text.size(), stdout);
+        if (used != content.size()){
+            std::cerr << paths[i] << ": " << content.size() - used << " trailing bytes not decoded" << std::endl;
+        }
+    }
+    return 0;
+}
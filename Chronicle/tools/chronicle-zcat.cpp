@@ -0,0 +1,93 @@
+//压缩帧日志查看工具: 解码GzipFileFlush写入的文件(多个gzip成员的拼接), 只输出已完整写入的帧
+//用法: ./chronicle-zcat [-f] <压缩日志文件>...
+//  -f: 读到文件末尾后继续等待新写入的帧(类似tail -f), 只能指定一个文件
+//文件末尾不完整的帧(正在写入或进程崩溃时残留)不输出; 不跟随时在stderr提示未解码的字节数
+//中间损坏的数据被跳过, 从下一帧继续解码, 在stderr提示跳过的字节数
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "../src/GzipFrames.hpp"
+
+static void Usage(const char *prog) {
+    std::cout << "usage: " << prog << " [-f] <compressed log>..." << std::endl;
+}
+
+//解码fd中的全部数据, follow为true时到达末尾后等待新数据
+static bool Decode(const char *path, int fd, bool follow) {
+    Chronicle::GzipFrameDecoder decoder;
+    if (!decoder.Ready()){
+        std::cerr << path << ": inflateInit2 failed" << std::endl;
+        return false;
+    }
+    auto output = [](const char *data, size_t len, uint64_t) { fwrite(data, 1, len, stdout); };
+    std::vector<char> buf(256 * 1024);
+    uint64_t skipped = 0;
+    while (1){
+        ssize_t n = read(fd, buf.data(), buf.size());
+        if (n == -1){
+            perror(path);
+            return false;
+        }
+        if (n == 0){
+            if (!follow){
+                break;
+            }
+            fflush(stdout);
+            usleep(200 * 1000);
+            continue;
+        }
+        decoder.Feed(buf.data(), static_cast<size_t>(n), output);
+        if (decoder.Skipped() != skipped){
+            fflush(stdout);
+            std::cerr << path << ": skipped " << decoder.Skipped() - skipped << " bytes of a corrupted frame"
+                      << std::endl;
+            skipped = decoder.Skipped();
+        }
+    }
+    decoder.Finish(output);
+    if (decoder.Skipped() != skipped){
+        std::cerr << path << ": skipped " << decoder.Skipped() - skipped << " bytes of a corrupted frame" << std::endl;
+    }
+    if (decoder.Pending() > 0){
+        std::cerr << path << ": " << decoder.Pending() << " trailing bytes of an incomplete frame not decoded"
+                  << std::endl;
+    }
+    return true;
+}
+
+int main(int argc, char *argv[]) {
+    bool follow = false;
+    std::vector<std::string> paths;
+    for (int i = 1; i < argc; ++i){
+        if (strcmp(argv[i], "-f") == 0){
+            follow = true;
+        }
+        else{
+            paths.push_back(argv[i]);
+        }
+    }
+    if (paths.empty() || (follow && paths.size() != 1)){
+        Usage(argv[0]);
+        return -1;
+    }
+
+    int ret = 0;
+    for (auto &path : paths){
+        int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd == -1){
+            perror(path.c_str());
+            ret = -1;
+            continue;
+        }
+        if (!Decode(path.c_str(), fd, follow)){
+            ret = -1;
+        }
+        close(fd);
+    }
+    return ret;
+}